@@ -0,0 +1,83 @@
+#ifndef _ACCELERATOR_HPP
+#define _ACCELERATOR_HPP
+
+#include <glm/vec3.hpp>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "shape.hpp"
+#include "hit.hpp"
+#include "ray_packet.hpp"
+
+using glm::vec3;
+using std::ostream;
+using std::shared_ptr;
+using std::vector;
+
+class Accelerator {
+    /** A structure that finds which shapes a ray hits, without
+     * testing every shape in the scene.
+     * This is an abstract class: BVH and Grid implement it.
+     */
+ public:
+    /** Destructor.
+     */
+    virtual ~Accelerator() {}
+
+    /** Build the structure, throwing away any previous one.
+     * @param shapes The shapes to put in the structure.
+     */
+    virtual void build(const vector<Shape*>& shapes) = 0;
+
+    /** Bring the structure up to date after some shapes have moved.
+     * The default just builds it again.
+     * @param shapes The same shapes, in the same order, as build() got.
+     * @param moved Indices (in shapes) of the ones that moved.
+     */
+    virtual void refit(const vector<Shape*>& shapes, const vector<int>& moved) {
+        build(shapes);
+    }
+
+    /** Finds the closest hit along a ray.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits further than this don't count.
+     * @param hit Hit record, which will be set if there's a hit.
+     * @return true/false if the ray does/doesn't hit some Shape.
+     */
+    virtual bool first_hit(const vec3& start, const vec3& direction,
+                           float t_max, Hit& hit) const = 0;
+
+    /** Finds the closest hit for every ray in a packet.
+     * The default traces the rays one at a time.
+     * @param packet The rays. Sets their _hits and _found.
+     * @param t_max Hits further than this don't count.
+     */
+    virtual void first_hits(Ray_Packet& packet, float t_max) const {
+        for (int i = 0; i < packet._count; i++) {
+            packet._found[i] = first_hit(packet._starts[i],
+                                         packet._directions[i],
+                                         t_max, packet._hits[i]);
+        }
+    }
+
+    /** Finds some shape that blocks a ray (used for shadows).
+     * Stops at the first one found, which needn't be the closest.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore (the one the ray starts on), or nullptr.
+     * @return The blocking shape, or nullptr if nothing blocks the ray.
+     */
+    virtual Shape *any_hit(const vec3& start, const vec3& direction,
+                           float t_max, const Shape *skip) const = 0;
+
+    /** Print a one-line summary of the structure (for tuning).
+     * @param os The stream.
+     */
+    virtual void print_stats(ostream& os) const = 0;
+};
+
+typedef shared_ptr<Accelerator> SP_Accelerator;
+
+#endif
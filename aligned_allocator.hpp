@@ -0,0 +1,58 @@
+#ifndef _ALIGNED_ALLOCATOR_HPP
+#define _ALIGNED_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Bytes in a cache line, on the machines this runs on.
+#define CACHE_LINE_BYTES 64
+
+/* An allocator whose memory starts on an ALIGNMENT-byte boundary, so
+ * that a vector<T, Aligned_Allocator<T, 64>> can hold types that are
+ * aligned more than malloc() aligns (C++14's vector ignores alignas
+ * beyond that). Each block is allocated ALIGNMENT bytes bigger, and
+ * the pointer that was allocated is kept just before the aligned one.
+ */
+template <class T, size_t ALIGNMENT>
+struct Aligned_Allocator {
+    typedef T value_type;
+
+    template <class U>
+    struct rebind {
+        typedef Aligned_Allocator<U, ALIGNMENT> other;
+    };
+
+    Aligned_Allocator() {}
+
+    template <class U>
+    Aligned_Allocator(const Aligned_Allocator<U, ALIGNMENT>&) {}
+
+    T *allocate(size_t n) {
+        static_assert(ALIGNMENT >= sizeof(void*)
+                      && (ALIGNMENT & (ALIGNMENT - 1)) == 0,
+                      "ALIGNMENT has to be a power of 2, at least a pointer");
+        char *block = (char*)::operator new(n * sizeof(T) + ALIGNMENT);
+        uintptr_t aligned = ((uintptr_t)block + ALIGNMENT) & ~(ALIGNMENT - 1);
+        ((void**)aligned)[-1] = block;
+        return (T*)aligned;
+    }
+
+    void deallocate(T *p, size_t) {
+        ::operator delete(((void**)p)[-1]);
+    }
+};
+
+template <class T, class U, size_t ALIGNMENT>
+bool operator==(const Aligned_Allocator<T, ALIGNMENT>&,
+                const Aligned_Allocator<U, ALIGNMENT>&) {
+    return true;
+}
+
+template <class T, class U, size_t ALIGNMENT>
+bool operator!=(const Aligned_Allocator<T, ALIGNMENT>&,
+                const Aligned_Allocator<U, ALIGNMENT>&) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "bounding_box.hpp"
+
+#include <limits>
+#include <glm/geometric.hpp>
+#include <glm/gtx/string_cast.hpp>
+
+using glm::to_string;
+using std::numeric_limits;
+
+Bounding_Box::Bounding_Box() {
+    float big = numeric_limits<float>::infinity();
+    _min = vec3(big, big, big);
+    _max = vec3(-big, -big, -big);
+}
+
+Bounding_Box::Bounding_Box(const vec3& lo, const vec3& hi)
+    : _min(lo), _max(hi)
+{
+    ; // nothing left to do
+}
+
+void Bounding_Box::expand(const vec3& p) {
+    _min = glm::min(_min, p);
+    _max = glm::max(_max, p);
+}
+
+void Bounding_Box::expand(const Bounding_Box& box) {
+    _min = glm::min(_min, box._min);
+    _max = glm::max(_max, box._max);
+}
+
+bool Bounding_Box::is_empty() const {
+    return _min.x > _max.x || _min.y > _max.y || _min.z > _max.z;
+}
+
+vec3 Bounding_Box::centroid() const {
+    return 0.5f * (_min + _max);
+}
+
+vec3 Bounding_Box::extent() const {
+    if (is_empty()) { return vec3(0, 0, 0); }
+    return _max - _min;
+}
+
+float Bounding_Box::surface_area() const {
+    vec3 d = extent();
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+int Bounding_Box::longest_axis() const {
+    vec3 d = extent();
+    if (d.x >= d.y && d.x >= d.z) { return 0; }
+    return (d.y >= d.z) ? 1 : 2;
+}
+
+ostream& operator<<(ostream& os, const Bounding_Box& box) {
+    os << "Bounding_Box(min=" << to_string(box._min)
+       << " max=" << to_string(box._max) << ")";
+    return os;
+}
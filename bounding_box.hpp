@@ -0,0 +1,103 @@
+#ifndef _BOUNDING_BOX_HPP
+#define _BOUNDING_BOX_HPP
+
+#include <glm/vec3.hpp>
+#include <iostream>
+
+using glm::vec3;
+using std::ostream;
+
+struct Bounding_Box {
+    /** An axis-aligned box, used to bound shapes in the
+     * acceleration structures.
+     */
+
+    /** Constructor.
+     * Makes an empty box, which contains nothing.
+     */
+    Bounding_Box();
+
+    /** Constructor.
+     * @param lo Corner with the smallest coordinates.
+     * @param hi Corner with the largest coordinates.
+     */
+    Bounding_Box(const vec3& lo, const vec3& hi);
+
+    /** Grow the box so that it contains a point.
+     * @param p The point.
+     */
+    void expand(const vec3& p);
+
+    /** Grow the box so that it contains another box.
+     * @param box The other box.
+     */
+    void expand(const Bounding_Box& box);
+
+    /** Is the box empty?
+     * @return true if nothing has been added to the box.
+     */
+    bool is_empty() const;
+
+    /** The box's center point.
+     * @return The center.
+     */
+    vec3 centroid() const;
+
+    /** Size of the box along each axis.
+     * @return hi - lo, or (0, 0, 0) for an empty box.
+     */
+    vec3 extent() const;
+
+    /** Area of the six faces (for the surface area heuristic).
+     * @return The surface area, 0 for an empty box.
+     */
+    float surface_area() const;
+
+    /** Which axis is the box longest along?
+     * @return 0, 1 or 2 for X, Y or Z.
+     */
+    int longest_axis() const;
+
+    /** Slab test of a ray against the box.
+     * Defined here, so that the traversal loops can inline it.
+     * @param start Ray's starting point.
+     * @param inv_direction 1 / (ray's direction vector), per component.
+     * @param t_max Hits further than this don't count.
+     * @param t_near Set to the ray distance where the ray enters the box.
+     * @return true if the ray hits the box between 0 and t_max.
+     */
+    bool intersects(const vec3& start, const vec3& inv_direction,
+                    float t_max, float& t_near) const {
+        float t0 = 0;
+        float t1 = t_max;
+        for (int axis = 0; axis < 3; axis++) {
+            float t_lo = (_min[axis] - start[axis]) * inv_direction[axis];
+            float t_hi = (_max[axis] - start[axis]) * inv_direction[axis];
+            if (t_lo > t_hi) {
+                float tmp = t_lo;
+                t_lo = t_hi;
+                t_hi = tmp;
+            }
+            // Written so that a NaN (0 * inf) leaves t0/t1 unchanged.
+            t0 = t_lo > t0 ? t_lo : t0;
+            t1 = t_hi < t1 ? t_hi : t1;
+            if (t0 > t1) { return false; }
+        }
+        t_near = t0;
+        return true;
+    }
+
+    /** Corner with the smallest coordinates */
+    vec3 _min;
+    /** Corner with the largest coordinates */
+    vec3 _max;
+
+    /** Output to stream (for debugging).
+     * @param os The stream
+     * @param box A Bounding_Box
+     * @return the stream, after output.
+     */
+    friend ostream& operator<<(ostream& os, const Bounding_Box& box);
+};
+
+#endif
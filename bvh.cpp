@@ -0,0 +1,753 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+using std::numeric_limits;
+using std::partition;
+using std::nth_element;
+
+// Number of buckets the centroids are sorted into when
+// looking for the best split.
+#define NUM_BINS 16
+// Below this depth, give up on the SAH and split at the median,
+// so that the traversal stack can't overflow.
+#define MAX_SAH_DEPTH 64
+#define STACK_SIZE 128
+// Cost of visiting a node, relative to one shape intersection test.
+#define TRAVERSAL_COST 0.125f
+// Big nodes are binned in chunks of this many shapes, one chunk per task.
+// The chunks don't depend on the number of threads, so neither does the tree.
+#define BUILD_CHUNK 16384
+// Subtrees with at most max(MIN_SUBTREE_SIZE, shapes / SUBTREES_PER_BUILD)
+// shapes are built as separate tasks.
+#define MIN_SUBTREE_SIZE 4096
+#define SUBTREES_PER_BUILD 128
+// A refit rebuilds a subtree once its SAH cost is this many
+// times what it was when it was built.
+#define REBUILD_RATIO 1.5f
+
+// Bin counts and bounds, on all three axes, for some range of shapes.
+struct BVH::Bins {
+    Bounding_Box _box[3][NUM_BINS];
+    int _count[3][NUM_BINS];
+
+    Bins() {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < NUM_BINS; b++) {
+                _count[axis][b] = 0;
+            }
+        }
+    }
+
+    void add(const Bins& other) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < NUM_BINS; b++) {
+                _count[axis][b] += other._count[axis][b];
+                _box[axis][b].expand(other._box[axis][b]);
+            }
+        }
+    }
+};
+
+// Which bin a centroid falls in, along one axis.
+static int bin_index(float centroid, float lo, float scale) {
+    int b = (int)((centroid - lo) * scale);
+    return std::min(b, NUM_BINS - 1);
+}
+
+BVH::BVH()
+    : _refits(0), _rebuilt_subtrees(0), _peak_build_bytes(0)
+{
+    ; // nothing to do: no nodes, no shapes, builds on one thread.
+}
+
+BVH::BVH(const SP_Thread_Pool& pool)
+    : _pool(pool), _refits(0), _rebuilt_subtrees(0), _peak_build_bytes(0)
+{
+    ; // nothing left to do
+}
+
+bool BVH::run_in_chunks(int begin, int end,
+                        const function<void(int, int, int)>& work) const {
+    int count = end - begin;
+    if (!_pool || _pool->size() == 1 || count <= 2 * BUILD_CHUNK) {
+        return false;
+    }
+    int chunks = (count + BUILD_CHUNK - 1) / BUILD_CHUNK;
+    _pool->parallel_for(chunks, [&](int chunk) {
+            int chunk_begin = begin + chunk * BUILD_CHUNK;
+            int chunk_end = std::min(chunk_begin + BUILD_CHUNK, end);
+            work(chunk, chunk_begin, chunk_end);
+        });
+    return true;
+}
+
+void BVH::build(const vector<Shape*>& shapes) {
+    _nodes.clear();
+    _shapes.clear();
+    _store.clear();
+    _refs.clear();
+    _subtrees.clear();
+    _order.clear();
+    _slots.clear();
+    _peak_build_bytes = 0;
+    _built_cost = 0;
+    if (shapes.empty()) { return; }
+
+    int num_shapes = (int)shapes.size();
+    vector<Build_Item> items(num_shapes);
+    auto make_items = [&](int chunk, int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            items[i]._box = shapes[i]->bounds();
+            items[i]._centroid = items[i]._box.centroid();
+            items[i]._index = i;
+        }
+    };
+    if (!run_in_chunks(0, num_shapes, make_items)) {
+        make_items(0, 0, num_shapes);
+    }
+
+    // Split the top of the tree here, handing the small subtrees
+    // to the thread pool. Each subtree task builds its own nodes,
+    // and they're spliced in afterwards, in order, so that the
+    // tree is the same however many threads there are.
+    _subtree_size = std::max(MIN_SUBTREE_SIZE, num_shapes / SUBTREES_PER_BUILD);
+    vector<Node> nodes;
+    // A binary tree with at least one shape per leaf
+    // has fewer than 2 * N nodes.
+    nodes.reserve(2 * num_shapes);
+    nodes.push_back(Node());
+    build_node(nodes, 0, items, 0, num_shapes, 0, &_subtrees);
+    _top_count = (int)nodes.size();
+
+    auto build_subtree = [&](int i) {
+        Subtree& subtree = _subtrees[i];
+        subtree._nodes.reserve(2 * (subtree._end - subtree._begin));
+        subtree._nodes.push_back(Node());
+        build_node(subtree._nodes, 0, items, subtree._begin, subtree._end,
+                   subtree._depth, nullptr);
+    };
+    if (_pool) {
+        _pool->parallel_for((int)_subtrees.size(), build_subtree);
+    } else {
+        for (int i = 0; i < (int)_subtrees.size(); i++) {
+            build_subtree(i);
+        }
+    }
+
+    // Everything the build has allocated is alive now.
+    _peak_build_bytes = items.capacity() * sizeof(Build_Item)
+        + nodes.capacity() * sizeof(Node)
+        + _subtrees.capacity() * sizeof(Subtree);
+    for (const Subtree& subtree : _subtrees) {
+        _peak_build_bytes += subtree._nodes.capacity() * sizeof(Node);
+    }
+
+    splice(nodes);
+    _nodes.swap(nodes);
+
+    _shapes.reserve(num_shapes);
+    _refs.reserve(num_shapes);
+    _order.reserve(num_shapes);
+    _slots.resize(num_shapes);
+    for (const Build_Item& item : items) {
+        _slots[item._index] = (int)_shapes.size();
+        _shapes.push_back(shapes[item._index]);
+        _refs.push_back(_store.add(shapes[item._index]));
+        _order.push_back(item._index);
+    }
+
+    for (Subtree& subtree : _subtrees) {
+        subtree._built_cost = subtree_cost(subtree);
+    }
+    _built_cost = sah_cost();
+}
+
+void BVH::splice(vector<Node>& nodes) {
+    for (Subtree& subtree : _subtrees) {
+        int base = (int)nodes.size();
+        if (!subtree._nodes.empty()) {
+            // Local node j (j > 0) ends up at base + j - 1,
+            // and the root replaces the placeholder node.
+            for (Node& node : subtree._nodes) {
+                if (node._count == 0) { node._first += base - 1; }
+            }
+            nodes[subtree._node] = subtree._nodes[0];
+            nodes.insert(nodes.end(), subtree._nodes.begin() + 1,
+                         subtree._nodes.end());
+            subtree._size = (int)subtree._nodes.size();
+            vector<Node>().swap(subtree._nodes);
+        } else {
+            // Unchanged: move its nodes along, root included.
+            int shift = base - subtree._base;
+            nodes.insert(nodes.end(), _nodes.begin() + subtree._base,
+                         _nodes.begin() + subtree._base + subtree._size - 1);
+            if (nodes[subtree._node]._count == 0) {
+                nodes[subtree._node]._first += shift;
+            }
+            for (int i = base; i < (int)nodes.size(); i++) {
+                if (nodes[i]._count == 0) { nodes[i]._first += shift; }
+            }
+        }
+        subtree._base = base;
+    }
+}
+
+void BVH::refit(const vector<Shape*>& shapes, const vector<int>& moved) {
+    if (_nodes.empty() || shapes.size() != _slots.size()) {
+        build(shapes);
+        return;
+    }
+    _refits++;
+
+    // Find the subtrees the moved shapes are in.
+    // Their shape ranges go up, so a binary search does it.
+    vector<bool> is_dirty(_subtrees.size(), false);
+    for (int index : moved) {
+        int slot = _slots[index];
+        _store.update(_refs[slot]);
+        auto after = std::upper_bound(
+            _subtrees.begin(), _subtrees.end(), slot,
+            [](int slot, const Subtree& subtree) {
+                return slot < subtree._begin;
+            });
+        is_dirty[after - _subtrees.begin() - 1] = true;
+    }
+    vector<int> dirty;
+    for (int i = 0; i < (int)_subtrees.size(); i++) {
+        if (is_dirty[i]) { dirty.push_back(i); }
+    }
+
+    // Children come after their parents, so a backwards
+    // sweep through a subtree's nodes refits it bottom-up.
+    vector<char> rebuilt(dirty.size(), 0);
+    auto refit_subtree = [&](int i) {
+        Subtree& subtree = _subtrees[dirty[i]];
+        for (int n = subtree._base + subtree._size - 2; n >= subtree._base; n--) {
+            refit_node(n);
+        }
+        refit_node(subtree._node);
+        if (subtree_cost(subtree) > REBUILD_RATIO * subtree._built_cost) {
+            rebuild_subtree(shapes, subtree);
+            rebuilt[i] = 1;
+        }
+    };
+    if (_pool) {
+        _pool->parallel_for((int)dirty.size(), refit_subtree);
+    } else {
+        for (int i = 0; i < (int)dirty.size(); i++) {
+            refit_subtree(i);
+        }
+    }
+
+    int num_rebuilt = 0;
+    for (char r : rebuilt) { num_rebuilt += r; }
+    if (num_rebuilt > 0) {
+        vector<Node> nodes;
+        nodes.reserve(_nodes.size());
+        nodes.insert(nodes.end(), _nodes.begin(), _nodes.begin() + _top_count);
+        splice(nodes);
+        _nodes.swap(nodes);
+        for (int i = 0; i < (int)dirty.size(); i++) {
+            Subtree& subtree = _subtrees[dirty[i]];
+            if (rebuilt[i]) { subtree._built_cost = subtree_cost(subtree); }
+        }
+        _rebuilt_subtrees += num_rebuilt;
+    }
+
+    // The few nodes above the subtrees.
+    for (int n = _top_count - 1; n >= 0; n--) {
+        refit_node(n);
+    }
+
+    // The subtrees may be fine, while the top of the tree isn't.
+    if (sah_cost() > REBUILD_RATIO * _built_cost) {
+        build(shapes);
+        _rebuilt_subtrees += (int)_subtrees.size();
+    }
+}
+
+void BVH::rebuild_subtree(const vector<Shape*>& shapes, Subtree& subtree) {
+    int begin = subtree._begin;
+    int count = subtree._end - begin;
+    vector<Build_Item> items(count);
+    for (int k = 0; k < count; k++) {
+        items[k]._box = _shapes[begin + k]->bounds();
+        items[k]._centroid = items[k]._box.centroid();
+        items[k]._index = _order[begin + k];
+    }
+
+    subtree._nodes.reserve(2 * count);
+    subtree._nodes.push_back(Node());
+    build_node(subtree._nodes, 0, items, 0, count, subtree._depth, nullptr);
+    for (Node& node : subtree._nodes) {
+        if (node._count > 0) { node._first += begin; }
+    }
+
+    // The records stay where they are; only the refs move.
+    vector<Shape_Store::Ref> refs(_refs.begin() + begin,
+                                  _refs.begin() + begin + count);
+    for (int k = 0; k < count; k++) {
+        int index = items[k]._index;
+        _shapes[begin + k] = shapes[index];
+        _refs[begin + k] = refs[_slots[index] - begin];
+        _order[begin + k] = index;
+        _slots[index] = begin + k;
+    }
+}
+
+void BVH::refit_node(int node_index) {
+    Node& node = _nodes[node_index];
+    Bounding_Box box;
+    if (node._count > 0) {
+        for (int i = node._first; i < node._first + node._count; i++) {
+            box.expand(_shapes[i]->bounds());
+        }
+    } else {
+        box.expand(_nodes[node._first]._box);
+        box.expand(_nodes[node._first + 1]._box);
+    }
+    node._box = box;
+}
+
+float BVH::subtree_cost(const Subtree& subtree) const {
+    const Node& root = _nodes[subtree._node];
+    float root_area = root._box.surface_area();
+    if (root_area <= 0) { return (float)(subtree._end - subtree._begin); }
+    auto cost_of = [](const Node& node) {
+        float area = node._box.surface_area();
+        return (node._count > 0) ? area * node._count : area * TRAVERSAL_COST;
+    };
+    float cost = cost_of(root);
+    for (int n = subtree._base; n < subtree._base + subtree._size - 1; n++) {
+        cost += cost_of(_nodes[n]);
+    }
+    return cost / root_area;
+}
+
+void BVH::build_node(vector<Node>& nodes, int node_index,
+                     vector<Build_Item>& items, int begin, int end, int depth,
+                     vector<Subtree> *subtrees) {
+    int count = end - begin;
+    if (subtrees != nullptr && count <= _subtree_size) {
+        Subtree subtree;
+        subtree._node = node_index;
+        subtree._begin = begin;
+        subtree._end = end;
+        subtree._depth = depth;
+        subtree._base = 0;
+        subtree._size = 0;
+        subtree._built_cost = 0;
+        subtrees->push_back(subtree);
+        return;
+    }
+
+    // Only the top of the tree (above the subtrees) works in parallel.
+    bool parallel = (subtrees != nullptr);
+
+    Bounding_Box box, centroid_box;
+    auto bound = [&](Bounding_Box& chunk_box, Bounding_Box& chunk_centroids,
+                     int chunk_begin, int chunk_end) {
+        for (int i = chunk_begin; i < chunk_end; i++) {
+            chunk_box.expand(items[i]._box);
+            chunk_centroids.expand(items[i]._centroid);
+        }
+    };
+    vector<Bounding_Box> chunk_boxes;
+    if (parallel) {
+        chunk_boxes.resize(2 * ((count + BUILD_CHUNK - 1) / BUILD_CHUNK));
+    }
+    if (parallel && run_in_chunks(begin, end, [&](int chunk, int b, int e) {
+                bound(chunk_boxes[2 * chunk], chunk_boxes[2 * chunk + 1], b, e);
+            })) {
+        for (int c = 0; c < (int)chunk_boxes.size(); c += 2) {
+            box.expand(chunk_boxes[c]);
+            centroid_box.expand(chunk_boxes[c + 1]);
+        }
+    } else {
+        bound(box, centroid_box, begin, end);
+    }
+    nodes[node_index]._box = box;
+
+    int middle = (count == 1) ? -1
+        : split(items, begin, end, depth, box, centroid_box, parallel);
+    if (middle < 0) {
+        nodes[node_index]._first = begin;
+        nodes[node_index]._count = count;
+        return;
+    }
+
+    // The two children sit side by side.
+    int left = (int)nodes.size();
+    nodes[node_index]._first = left;
+    nodes[node_index]._count = 0;
+    nodes.push_back(Node());
+    nodes.push_back(Node());
+    build_node(nodes, left, items, begin, middle, depth + 1, subtrees);
+    build_node(nodes, left + 1, items, middle, end, depth + 1, subtrees);
+}
+
+void BVH::fill_bins(const vector<Build_Item>& items, int begin, int end,
+                    const Bounding_Box& centroid_box, Bins& bins) const {
+    vec3 extent = centroid_box.extent();
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0) { continue; }
+        float lo = centroid_box._min[axis];
+        float scale = NUM_BINS / extent[axis];
+        for (int i = begin; i < end; i++) {
+            int b = bin_index(items[i]._centroid[axis], lo, scale);
+            bins._count[axis][b]++;
+            bins._box[axis][b].expand(items[i]._box);
+        }
+    }
+}
+
+int BVH::split(vector<Build_Item>& items, int begin, int end, int depth,
+               const Bounding_Box& box, const Bounding_Box& centroid_box,
+               bool parallel) const {
+    int count = end - begin;
+    vec3 centroid_extent = centroid_box.extent();
+
+    // Try every bin boundary on every axis, and keep the
+    // split with the lowest SAH cost.
+    float best_cost = numeric_limits<float>::infinity();
+    int best_axis = -1;
+    int best_split = 0;
+    if (depth < MAX_SAH_DEPTH) {
+        Bins bins;
+        vector<Bins> chunk_bins;
+        if (parallel) {
+            chunk_bins.resize((count + BUILD_CHUNK - 1) / BUILD_CHUNK);
+        }
+        // Merging in chunk order keeps the result independent of
+        // the thread count (and box merging is exact anyway).
+        if (parallel && run_in_chunks(begin, end, [&](int chunk, int b, int e) {
+                    fill_bins(items, b, e, centroid_box, chunk_bins[chunk]);
+                })) {
+            for (const Bins& chunk : chunk_bins) {
+                bins.add(chunk);
+            }
+        } else {
+            fill_bins(items, begin, end, centroid_box, bins);
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (centroid_extent[axis] <= 0) { continue; }
+
+            // Sweep from the right, remembering the area and count
+            // of everything right of each boundary...
+            float right_area[NUM_BINS];
+            int right_count[NUM_BINS];
+            Bounding_Box right_box;
+            int right_total = 0;
+            for (int b = NUM_BINS - 1; b > 0; b--) {
+                right_box.expand(bins._box[axis][b]);
+                right_total += bins._count[axis][b];
+                right_area[b] = right_box.surface_area();
+                right_count[b] = right_total;
+            }
+
+            // ...then sweep from the left, and cost each boundary.
+            Bounding_Box left_box;
+            int left_total = 0;
+            for (int b = 1; b < NUM_BINS; b++) {
+                left_box.expand(bins._box[axis][b - 1]);
+                left_total += bins._count[axis][b - 1];
+                if (left_total == 0 || right_count[b] == 0) { continue; }
+                float cost = left_box.surface_area() * left_total
+                    + right_area[b] * right_count[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = b;
+                }
+            }
+        }
+    }
+
+    float area = box.surface_area();
+    if (best_axis >= 0 && area > 0) {
+        best_cost = TRAVERSAL_COST + best_cost / area;
+    }
+
+    // Splitting isn't worth it: it costs more than testing every shape.
+    if (count <= MAX_LEAF_SIZE && (best_axis < 0 || best_cost >= count)) {
+        return -1;
+    }
+
+    if (best_axis >= 0) {
+        int axis = best_axis;
+        float lo = centroid_box._min[axis];
+        float scale = NUM_BINS / centroid_extent[axis];
+        Build_Item *mid = partition(
+            &items[begin], &items[0] + end,
+            [=](const Build_Item& item) {
+                return bin_index(item._centroid[axis], lo, scale) < best_split;
+            });
+        return (int)(mid - &items[0]);
+    }
+
+    // Too deep, or every centroid is in the same place:
+    // just split the shapes in half.
+    int axis = centroid_box.longest_axis();
+    int middle = (begin + end) / 2;
+    nth_element(&items[begin], &items[0] + middle, &items[0] + end,
+                [=](const Build_Item& a, const Build_Item& b) {
+                    return a._centroid[axis] < b._centroid[axis];
+                });
+    return middle;
+}
+
+bool BVH::first_hit(const vec3& start, const vec3& direction,
+                    float t_max, Hit& hit) const {
+    Lazy_Hit nearest(t_max);
+    if (!first_hit(start, direction, nearest)) { return false; }
+    nearest.finalize(start, direction, hit);
+    return true;
+}
+
+bool BVH::first_hit(const vec3& start, const vec3& direction,
+                    Lazy_Hit& hit) const {
+    if (_nodes.empty()) { return false; }
+
+    vec3 inv_direction = 1.0f / direction;
+    float t_near;
+    if (!_nodes[0]._box.intersects(start, inv_direction, hit._t, t_near)) {
+        return false;
+    }
+    return traverse(0, start, direction, inv_direction, hit);
+}
+
+bool BVH::traverse(int node_index, const vec3& start, const vec3& direction,
+                   const vec3& inv_direction, Lazy_Hit& hit) const {
+    bool found = false;
+    // The closest hit so far (a reference, so it keeps up with hit).
+    const float& closest = hit._t;
+
+    // Nodes still to visit, with the distance where the ray enters them.
+    int stack[STACK_SIZE];
+    float stack_t[STACK_SIZE];
+    int top = 0;
+
+    while (true) {
+        const Node& node = _nodes[node_index];
+        if (node._count > 0) {
+            if (_store.first_hit(&_refs[node._first], node._count,
+                                 start, direction, hit)) {
+                found = true;
+            }
+        } else {
+            int left = node._first;
+            int right = node._first + 1;
+            float t_left, t_right;
+            bool hit_left = _nodes[left]._box.intersects(
+                start, inv_direction, closest, t_left);
+            bool hit_right = _nodes[right]._box.intersects(
+                start, inv_direction, closest, t_right);
+            if (hit_left && hit_right) {
+                // Go into the nearer child, come back for the other one.
+                if (t_right < t_left) {
+                    std::swap(left, right);
+                    std::swap(t_left, t_right);
+                }
+                stack[top] = right;
+                stack_t[top] = t_right;
+                top++;
+                node_index = left;
+                continue;
+            } else if (hit_left) {
+                node_index = left;
+                continue;
+            } else if (hit_right) {
+                node_index = right;
+                continue;
+            }
+        }
+
+        // Pop the next node, skipping any that start beyond the closest hit.
+        bool popped = false;
+        while (top > 0) {
+            top--;
+            if (stack_t[top] < closest) {
+                node_index = stack[top];
+                popped = true;
+                break;
+            }
+        }
+        if (!popped) { break; }
+    }
+    return found;
+}
+
+void BVH::first_hits(Ray_Packet& packet, float t_max) const {
+    // Each ray's closest hit so far, filled in once all the rays are done.
+    Lazy_Hit nearest[MAX_PACKET_SIZE];
+    for (int i = 0; i < packet._count; i++) {
+        nearest[i]._t = t_max;
+        packet._found[i] = false;
+    }
+    if (_nodes.empty() || packet._count == 0) { return; }
+
+    // Nodes still to visit, with the rays that may hit them (one bit each).
+    int stack[STACK_SIZE];
+    uint64_t stack_rays[STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    stack_rays[top] = (packet._count == 64) ? ~(uint64_t)0
+        : ((uint64_t)1 << packet._count) - 1;
+    top++;
+
+    while (top > 0) {
+        top--;
+        int node_index = stack[top];
+        const Node& node = _nodes[node_index];
+        if (packet.frustum_misses(node._box)) { continue; }
+
+        // Keep the rays that reach the node before their closest hit.
+        uint64_t active = 0;
+        int first_ray = -1;
+        for (uint64_t rays = stack_rays[top]; rays != 0; rays &= rays - 1) {
+            int i = __builtin_ctzll(rays);
+            float t;
+            if (node._box.intersects(packet._starts[i],
+                                     packet._inv_directions[i],
+                                     nearest[i]._t, t)) {
+                active |= (uint64_t)1 << i;
+                if (first_ray < 0) { first_ray = i; }
+            }
+        }
+        if (active == 0) { continue; }
+
+        if ((active & (active - 1)) == 0) {
+            // The packet has come apart: the last ray goes on alone.
+            int i = first_ray;
+            if (traverse(node_index, packet._starts[i], packet._directions[i],
+                         packet._inv_directions[i], nearest[i])) {
+                packet._found[i] = true;
+            }
+            continue;
+        }
+
+        if (node._count > 0) {
+            for (uint64_t rays = active; rays != 0; rays &= rays - 1) {
+                int i = __builtin_ctzll(rays);
+                if (_store.first_hit(&_refs[node._first], node._count,
+                                     packet._starts[i], packet._directions[i],
+                                     nearest[i])) {
+                    packet._found[i] = true;
+                }
+            }
+            continue;
+        }
+
+        // Visit first the child that the first active ray reaches first.
+        int first = node._first;
+        int second = node._first + 1;
+        const vec3& start = packet._starts[first_ray];
+        const vec3& inv_direction = packet._inv_directions[first_ray];
+        float closest = nearest[first_ray]._t;
+        float t_first, t_second;
+        if (!_nodes[first]._box.intersects(start, inv_direction,
+                                          closest, t_first)) {
+            std::swap(first, second);
+        } else if (_nodes[second]._box.intersects(start, inv_direction,
+                                               closest, t_second)
+                   && t_second < t_first) {
+            std::swap(first, second);
+        }
+        stack[top] = second;
+        stack_rays[top] = active;
+        top++;
+        stack[top] = first;
+        stack_rays[top] = active;
+        top++;
+    }
+
+    for (int i = 0; i < packet._count; i++) {
+        if (packet._found[i]) {
+            nearest[i].finalize(packet._starts[i], packet._directions[i],
+                                packet._hits[i]);
+        }
+    }
+}
+
+Shape *BVH::any_hit(const vec3& start, const vec3& direction,
+                    float t_max, const Shape *skip) const {
+    if (_nodes.empty()) { return nullptr; }
+
+    vec3 inv_direction = 1.0f / direction;
+
+    int stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int node_index = stack[--top];
+        const Node& node = _nodes[node_index];
+        float t_near;
+        if (!node._box.intersects(start, inv_direction, t_max, t_near)) {
+            continue;
+        }
+        if (node._count > 0) {
+            for (int i = node._first; i < node._first + node._count; i++) {
+                Shape *shape = _shapes[i];
+                if (shape != skip
+                    && _store.occludes(_refs[i], start, direction, t_max, skip)) {
+                    return shape;
+                }
+            }
+        } else {
+            stack[top++] = node._first + 1;
+            stack[top++] = node._first;
+        }
+    }
+    return nullptr;
+}
+
+int BVH::node_count() const {
+    return (int)_nodes.size();
+}
+
+int BVH::leaf_count() const {
+    int leaves = 0;
+    for (const Node& node : _nodes) {
+        if (node._count > 0) { leaves++; }
+    }
+    return leaves;
+}
+
+float BVH::sah_cost() const {
+    if (_nodes.empty()) { return 0; }
+    float root_area = _nodes[0]._box.surface_area();
+    if (root_area <= 0) { return (float)_shapes.size(); }
+    float cost = 0;
+    for (const Node& node : _nodes) {
+        float p = node._box.surface_area() / root_area;
+        if (node._count > 0) {
+            cost += p * node._count;
+        } else {
+            cost += p * TRAVERSAL_COST;
+        }
+    }
+    return cost;
+}
+
+void BVH::print_stats(ostream& os) const {
+    os << "BVH: " << _shapes.size() << " shapes (";
+    _store.print_stats(os);
+    os << "), "
+       << node_count() << " nodes, "
+       << leaf_count() << " leaves, SAH cost " << sah_cost()
+       << ", peak builder memory " << _peak_build_bytes / (1024.0 * 1024.0)
+       << " MB, " << (_pool ? _pool->size() : 1) << " threads";
+    if (_refits > 0) {
+        os << ", " << _refits << " refits rebuilt "
+           << _rebuilt_subtrees << " subtrees";
+    }
+}
+
+Bounding_Box BVH::bounds() const {
+    if (_nodes.empty()) { return Bounding_Box(); }
+    return _nodes[0]._box;
+}
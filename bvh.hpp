@@ -0,0 +1,257 @@
+#ifndef _BVH_HPP
+#define _BVH_HPP
+
+#include <glm/vec3.hpp>
+#include <vector>
+#include "accelerator.hpp"
+#include "bounding_box.hpp"
+#include "shape.hpp"
+#include "hit.hpp"
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+
+// Leaves never hold more shapes than this.
+#define MAX_LEAF_SIZE 8
+
+using glm::vec3;
+using std::vector;
+
+template <int WIDTH> class Wide_BVH;
+
+class BVH : public Accelerator {
+    /** A bounding volume hierarchy over the shapes of a scene.
+     * Built top-down with a binned surface area heuristic (SAH),
+     * and stored as a flat array of nodes. The root comes first,
+     * and the two children of an interior node sit side by side.
+     */
+ public:
+    /** Constructor.
+     * Makes an empty hierarchy, which nothing can hit.
+     */
+    BVH();
+
+    /** Constructor.
+     * Makes an empty hierarchy, which builds on a pool of threads.
+     * The tree doesn't depend on how many threads there are.
+     * @param pool The threads to build with.
+     */
+    BVH(const SP_Thread_Pool& pool);
+
+    /** Build the hierarchy, throwing away any previous one.
+     * @param shapes The shapes to put in the hierarchy.
+     */
+    void build(const vector<Shape*>& shapes);
+
+    /** Bring the hierarchy up to date after some shapes have moved.
+     * Recomputes the bounds of the nodes above the moved shapes,
+     * bottom-up (in parallel, one task per subtree). Subtrees whose
+     * SAH cost has grown too much since they were built are rebuilt,
+     * and if the whole tree has, it all is.
+     * @param shapes The same shapes, in the same order, as build() got.
+     * @param moved Indices (in shapes) of the ones that moved.
+     */
+    void refit(const vector<Shape*>& shapes, const vector<int>& moved);
+
+    /** Finds the closest hit along a ray.
+     * Visits the nearer child of each node first, and skips
+     * any node that starts beyond the closest hit found so far.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits further than this don't count.
+     * @param hit Hit record, which will be set if there's a hit.
+     * @return true/false if the ray does/doesn't hit some Shape.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   float t_max, Hit& hit) const;
+
+    /** Finds the closest hit along a ray, like first_hit() above,
+     * without working out the hit's point, normal or material.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if there's a closer one.
+     * @return true if some Shape is hit before hit._t.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   Lazy_Hit& hit) const;
+
+    /** Finds the closest hit for every ray in a packet.
+     * The rays go down the tree together, and skip any node that is
+     * outside the packet's frustum, or that no ray still hits.
+     * Once a single ray is left in a node, it goes on alone.
+     * Gives the same hits as first_hit() on each ray.
+     * @param packet The rays. Sets their _hits and _found.
+     * @param t_max Hits further than this don't count.
+     */
+    void first_hits(Ray_Packet& packet, float t_max) const;
+
+    /** Finds some shape that blocks a ray (used for shadows).
+     * Stops at the first one found, which needn't be the closest.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore (the one the ray starts on), or nullptr.
+     * @return The blocking shape, or nullptr if nothing blocks the ray.
+     */
+    Shape *any_hit(const vec3& start, const vec3& direction,
+                   float t_max, const Shape *skip) const;
+
+    /** Print the node and leaf counts, the SAH cost,
+     * roughly how much memory the last build used at its peak,
+     * and how many subtrees refits have rebuilt.
+     * @param os The stream.
+     */
+    void print_stats(ostream& os) const;
+
+    /** Number of nodes (interior nodes and leaves).
+     * @return The node count.
+     */
+    int node_count() const;
+
+    /** Number of leaves.
+     * @return The leaf count.
+     */
+    int leaf_count() const;
+
+    /** Expected cost of a ray query, by the surface area heuristic,
+     * in units of one shape intersection test.
+     * @return The SAH cost of the whole tree.
+     */
+    float sah_cost() const;
+
+    /** Wide BVHs are collapsed from binary ones. */
+    template <int WIDTH> friend class Wide_BVH;
+
+    /** Bounds of the whole scene.
+     * @return The root's box (empty if there are no shapes).
+     */
+    Bounding_Box bounds() const;
+
+ private:
+    struct Node {
+        /** Bounds of everything below the node */
+        Bounding_Box _box;
+        /** Leaf: index of its first shape in _shapes.
+         * Interior node: index of its left child (the right one follows).
+         */
+        int _first;
+        /** Number of shapes in a leaf; 0 for interior nodes */
+        int _count;
+    };
+
+    struct Build_Item {
+        /** Bounds of the shape */
+        Bounding_Box _box;
+        /** Center of the bounds */
+        vec3 _centroid;
+        /** Index of the shape in the list given to build() */
+        int _index;
+    };
+
+    /** A part of the tree that one task builds, and that
+     * refit() can rebuild on its own.
+     */
+    struct Subtree {
+        /** The node (in _nodes) that the subtree's root goes into */
+        int _node;
+        /** Its shapes are _shapes[_begin, _end) */
+        int _begin, _end;
+        /** Depth of its root in the tree */
+        int _depth;
+        /** Its other nodes are _nodes[_base, _base + _size - 1) */
+        int _base, _size;
+        /** Its SAH cost (relative to its root) when it was built */
+        float _built_cost;
+        /** Its nodes, root first, between building and splicing */
+        vector<Node> _nodes;
+    };
+
+    struct Bins;
+
+    /** Finds the closest hit along a ray, below a node
+     * whose box the ray is known to hit.
+     * @param hit The closest hit so far, set if there's a closer one.
+     * @return true if there was a hit closer than hit._t.
+     */
+    bool traverse(int node_index, const vec3& start, const vec3& direction,
+                  const vec3& inv_direction, Lazy_Hit& hit) const;
+
+    /** Fill in nodes[node_index] for items [begin, end), and build
+     * everything below it, appending the new nodes.
+     * @param subtrees If not nullptr, small subtrees aren't built, but
+     *                 added to this list for separate tasks to build.
+     */
+    void build_node(vector<Node>& nodes, int node_index,
+                    vector<Build_Item>& items, int begin, int end, int depth,
+                    vector<Subtree> *subtrees);
+
+    /** Choose where to split items [begin, end), and partition them.
+     * @param parallel Whether to bin the items on the thread pool.
+     * @return Where the right half starts, or -1 to make a leaf.
+     */
+    int split(vector<Build_Item>& items, int begin, int end, int depth,
+              const Bounding_Box& box, const Bounding_Box& centroid_box,
+              bool parallel) const;
+
+    /** Count items [begin, end) into bins along all three axes.
+     */
+    void fill_bins(const vector<Build_Item>& items, int begin, int end,
+                   const Bounding_Box& centroid_box, Bins& bins) const;
+
+    /** Run work(chunk, chunk_begin, chunk_end) on the thread pool for
+     * fixed-size chunks of [begin, end).
+     * @return false (and does nothing) if the range is too small
+     *         to be worth it, or there's no pool.
+     */
+    bool run_in_chunks(int begin, int end,
+                       const function<void(int, int, int)>& work) const;
+
+    /** Append the subtrees' nodes to the nodes above them.
+     * Subtrees that were just built bring their own nodes;
+     * the others are copied over from _nodes.
+     * @param nodes The nodes above the subtrees (_top_count of them).
+     */
+    void splice(vector<Node>& nodes);
+
+    /** Build a subtree again, from its shapes' current bounds.
+     * Reorders the subtree's part of _shapes, and leaves the new
+     * nodes in subtree._nodes for splice().
+     */
+    void rebuild_subtree(const vector<Shape*>& shapes, Subtree& subtree);
+
+    /** Recompute a node's box from its shapes or its children.
+     */
+    void refit_node(int node_index);
+
+    /** SAH cost of a subtree, relative to its root.
+     */
+    float subtree_cost(const Subtree& subtree) const;
+
+    vector<Node> _nodes;
+    /** The shapes, ordered so that each leaf's shapes are contiguous */
+    vector<Shape*> _shapes;
+    /** Records of the shapes, added in the order of _shapes, and
+     * where each of _shapes has its record. Leaves test these.
+     */
+    Shape_Store _store;
+    vector<Shape_Store::Ref> _refs;
+    /** Threads to build with, or nullptr */
+    SP_Thread_Pool _pool;
+    /** Ranges this small become separate subtree tasks */
+    int _subtree_size;
+    /** In order, so that their shape ranges go up */
+    vector<Subtree> _subtrees;
+    /** Nodes above the subtrees, and the subtrees' roots, come first */
+    int _top_count;
+    /** Index (in the list given to build()) of each of _shapes */
+    vector<int> _order;
+    /** Where each shape given to build() is in _shapes */
+    vector<int> _slots;
+    /** SAH cost of the whole tree when it was built */
+    float _built_cost;
+    /** Number of refits so far, and of the subtrees they rebuilt */
+    int _refits, _rebuilt_subtrees;
+    /** Memory the last build used at its peak (roughly) */
+    size_t _peak_build_bytes;
+};
+
+#endif
@@ -7,51 +7,97 @@
 #include "material.hpp"
 #include "scene_reader.hpp"
 #include "log.hpp"
+#include "bvh.hpp"
+#include "grid.hpp"
+#include "wide_bvh.hpp"
 
 #include <glm/vec4.hpp>
+#include <glm/common.hpp>
 #include <glm/geometric.hpp>
 #include <iostream>
+#include <chrono>
+#include <atomic>
+#include <utility>
 #include <glm/gtx/string_cast.hpp> // glm::to_string
 
 using glm::vec4;
 using glm::cross;
 using glm::normalize;
+using glm::length;
 using glm::to_string;
 using std::cout;
 using std::cerr;
 using std::endl;
+using std::chrono::steady_clock;
+using std::chrono::duration;
 
 using glm::max;
 #define EPSILON 0.001
+// Primary rays don't look any further than this.
+#define FAR_AWAY 100000
+// Pixels along each side of a wavefront tile: enough rays that each
+// stage runs a long loop, few enough that its arrays stay in cache.
+#define WAVEFRONT_TILE_SIZE 64
+// A progressive frame's first pass casts one pixel in each block this
+// many pixels on a side (a power of 2); each pass after it halves that.
+#define PROGRESSIVE_STEP 4
+// An adaptive frame's pixel that hasn't been cast or filled in yet
+// (bigger than any block).
+#define NOT_SAMPLED 0x7fffffff
+
+// Every scene that a Caster builds gets its own id,
+// so that the occluder caches can tell when they're stale.
+static std::atomic<int> next_scene_id(0);
+
+// For each light, the shape that last blocked a shadow ray to it.
+// Neighbouring pixels are usually blocked by the same shape.
+// One per thread, so that threads never share it.
+struct Occluder_Cache {
+    int _scene_id = -1;
+    vector<Shape*> _occluders;
+};
+static thread_local Occluder_Cache occluder_cache;
 
 Caster::Caster(int width, int height) {
-    _pixels = nullptr;
     _width = 0;
     _height = 0;
     update_image_dimensions(width, height);
     _background_color = vec3(0.7, 0.6, 0.4);
     _shadowing = true;
+    _accelerator_name = "bvh";
+    _scene_id = next_scene_id++;
+    _num_threads = 0;
+    _pin_threads = false;
+    _thread_pool = SP_Thread_Pool(new Thread_Pool(_num_threads, _pin_threads));
+    _tile_size = 32;
+    _pixel_order = Pixel_Order::TILED;
+    _wavefront = false;
+    _progressive = false;
+    _adaptive_block = 0;
+    _adaptive_threshold = 0;
+    _rays_cast = 0;
+    _packet_size = 1;
+    _specialized = true;
+    _shape_mix = SHAPES_ANY;
+    _primary_hits_valid = false;
+    _exposure = 1.0f;
+    _srgb = false;
+    _dithering = false;
 }
 
 void Caster::allocate_image(int width, int height) {
-    deallocate_image();
-    int num_pixels = width * height * 3;
-    _pixels = new unsigned char[num_pixels];
+    _framebuffer.resize(width, height);
     _width = width;
     _height = height;
 }
 
-void Caster::deallocate_image() {
-    if (_pixels != nullptr) {
-        delete[] _pixels;
-    }
-}
-
 Caster::~Caster() {
-    deallocate_image();
+    cancel_render(); // the framebuffer frees itself
 }
 
 void Caster::update_image_dimensions(int width, int height) {
+    cancel_render();
+    invalidate_primary_hits();
     if (width != _width || height != _height) {
         allocate_image(width, height);
         _pixel_width  = (_camera._clip_Right - _camera._clip_Left) / width;
@@ -60,11 +106,142 @@ void Caster::update_image_dimensions(int width, int height) {
 }
 
 void Caster::toggle_shadowing() {
+    cancel_render();
     _shadowing = !_shadowing;
 }
 
+void Caster::set_accelerator(const string& name) {
+    cancel_render();
+    if (name != "bvh" && name != "bvh4" && name != "bvh8"
+        && name != "grid" && name != "linear") {
+        throw invalid_argument("Unknown accelerator \"" + name + "\"");
+    }
+    _accelerator_name = name;
+    if (!_scene.empty()) { build_accelerator(); }
+}
+
+void Caster::set_threads(int num_threads) {
+    cancel_render();
+    if (num_threads < 0) {
+        throw invalid_argument("Thread count can't be negative");
+    }
+    _num_threads = num_threads;
+    _thread_pool = SP_Thread_Pool(new Thread_Pool(_num_threads, _pin_threads));
+}
+
+void Caster::set_thread_pinning(bool pin) {
+    cancel_render();
+    _pin_threads = pin;
+    _thread_pool = SP_Thread_Pool(new Thread_Pool(_num_threads, _pin_threads));
+}
+
+void Caster::set_tile_size(int size) {
+    cancel_render();
+    if (size < 1) {
+        throw invalid_argument("Tile size must be at least 1");
+    }
+    _tile_size = size;
+}
+
+void Caster::set_pixel_order(const string& name) {
+    cancel_render();
+    _pixel_order = Pixel_Order::named(name);
+}
+
+void Caster::set_morton_framebuffer(bool morton) {
+    cancel_render();
+    _framebuffer.set_layout(morton ? Framebuffer::MORTON_TILES
+                            : Framebuffer::ROWS);
+}
+
+void Caster::set_wavefront(bool wavefront) {
+    cancel_render();
+    _wavefront = wavefront;
+}
+
+void Caster::set_progressive(bool progressive) {
+    cancel_render();
+    _progressive = progressive;
+}
 
-void Caster::set_ray(int x_dcs, int y_dcs, vec3& S, vec3& V) {
+void Caster::set_adaptive(int block_size, float threshold) {
+    cancel_render();
+    if (block_size < 0 || (block_size & (block_size - 1)) != 0) {
+        throw invalid_argument("Adaptive block size must be 0 or a power of 2");
+    }
+    if (threshold < 0) {
+        throw invalid_argument("Adaptive threshold can't be negative");
+    }
+    _adaptive_block = block_size;
+    _adaptive_threshold = threshold;
+    invalidate_primary_hits();
+}
+
+long long Caster::rays_cast() const {
+    return _rays_cast;
+}
+
+bool Caster::casts_rays() const {
+    return !_primary_hits_valid;
+}
+
+void Caster::move_shapes(const vector<int>& indices,
+                         const vector<vec3>& offsets) {
+    cancel_render();
+    if (indices.size() != offsets.size()) {
+        throw invalid_argument("Need one offset per moved shape");
+    }
+    for (int index : indices) {
+        if (index < 0 || index >= (int)_scene.size()) {
+            throw invalid_argument("No shape number " + std::to_string(index));
+        }
+    }
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        _scene[indices[i]]->translate(offsets[i]);
+    }
+    if (_accelerator) {
+        _accelerator->refit(_scene, indices);
+    } else {
+        _linear_shapes.build(_scene);
+    }
+    invalidate_primary_hits();
+}
+
+void Caster::set_packet_size(int size) {
+    cancel_render();
+    if (size != 1 && size != 2 && size != 4 && size != 8) {
+        throw invalid_argument("Packet size must be 1, 2, 4 or 8");
+    }
+    _packet_size = size;
+}
+
+void Caster::set_specialized(bool specialized) {
+    cancel_render();
+    _specialized = specialized;
+}
+
+void Caster::set_exposure(float exposure) {
+    cancel_render();
+    _exposure = exposure;
+}
+
+float Caster::get_exposure() const {
+    return _exposure;
+}
+
+void Caster::toggle_srgb() {
+    cancel_render();
+    _srgb = !_srgb;
+}
+
+void Caster::toggle_dithering() {
+    cancel_render();
+    _dithering = !_dithering;
+}
+
+
+void Caster::set_ray(int x_dcs, int y_dcs, vec3& S, vec3& V) const {
     float delta_x = _pixel_width;
     float delta_y = _pixel_height;
     float clip_left = _camera._clip_Left;
@@ -103,6 +280,7 @@ void Caster::set_ray(int x_dcs, int y_dcs, vec3& S, vec3& V) {
 
 
 void Caster::camera_did_move() {
+    cancel_render();
     vec3 _eye = _camera._eye;
     vec3 _up = _camera._up; 
     vec3 _lookat = _camera._lookat;
@@ -113,72 +291,74 @@ void Caster::camera_did_move() {
     _M_vcs_to_wcs[1] = glm::vec4( y_vcs_wcs.x, y_vcs_wcs.y, y_vcs_wcs.z, 0 );
     _M_vcs_to_wcs[2] = glm::vec4( z_vcs_wcs.x, z_vcs_wcs.y, z_vcs_wcs.z, 1 );
     _M_vcs_to_wcs[3] = glm::vec4(_eye.x, _eye.y, _eye.z, 1.0 );
+    invalidate_primary_hits();
 }
 
-
-bool Caster::hits_something(const vec3& start, const vec3& direction) {
-    for (Shape* s : _scene) {
-        Hit hit;
-        if (s->intersects(start, direction, hit)) {
-            float t = dot(hit._position - start, direction);
-            if (t > 0.001f) { return true; }
-        }
-    }
-    return false;
+void Caster::invalidate_primary_hits() {
+    _primary_hits_valid = false;
 }
 
 
+bool Caster::hits_something(const vec3& start, const vec3& direction,
+                            float light_distance, const Hit& from,
+                            int light_index) const {
+    // Skip the whole instance the ray starts on when searching the
+    // scene, but let its other parts shadow it.
+    const Shape *skip = from._shape;
+    if (from._instance != nullptr) {
+        skip = from._instance;
+        if (from._instance->occludes(start, direction, light_distance,
+                                     from._shape)) {
+            return true;
+        }
+    }
 
+    Occluder_Cache& cache = occluder_cache;
+    if (cache._scene_id != _scene_id) {
+        cache._scene_id = _scene_id;
+        cache._occluders.assign(_lights.size(), nullptr);
+    }
 
-
-/*
-TRAVERSAL:
-first_hit(ray, cell) {
-
-    if (ray misses cell):
-        return
-    
-    if (cell is a leaf):
-        for (each shape in cell) {
-            if (ray hits shape inside cell):
-                save that hit
-        }
-        return closest hit
+    Shape *&last = cache._occluders[light_index];
+    if (last != nullptr && last != skip
+        && last->occludes(start, direction, light_distance, skip)) {
+        return true;
     }
-    else {
 
-        for (each child cell in order that ray vists children):
-            return first_hit(ray, child)
-    
+    Shape *occluder = nullptr;
+    if (_accelerator) {
+        occluder = _accelerator->any_hit(start, direction, light_distance, skip);
+    } else {
+        occluder = _linear_shapes.any_hit(start, direction, light_distance, skip);
     }
+
+    if (occluder == nullptr) { return false; }
+    last = occluder;
+    return true;
 }
-*/
 
-bool Caster::get_first_hit(const vec3& start, const vec3& direction, Hit& hit) {
-    float t = 100000;
-    bool state = false;
-    for (Shape* s : _scene) {
-        Hit curr_hit;
-        if (s->intersects(start, direction, curr_hit)) {
-            if (curr_hit._t < t) {
-                t = curr_hit._t;
-                hit = curr_hit;
-                state = true;
-            }
-        }
-    }
-    return state;
+
+bool Caster::get_first_hit(const vec3& start, const vec3& direction, Hit& hit) const {
+    float t = FAR_AWAY;
+    if (_accelerator) { return _accelerator->first_hit(start, direction, t, hit); }
+    return _linear_shapes.first_hit(start, direction, t, hit);
 }
 
 
 
-glm::vec3 Caster::mirror_direction(const vec3& L, const vec3& N) { return 2.0f * dot(N, L) * N - L; }
+glm::vec3 Caster::mirror_direction(const vec3& L, const vec3& N) const { return 2.0f * dot(N, L) * N - L; }
 
 
-vec3 Caster::local_illumination(const vec3& V, const vec3& N, const vec3& L, const vec3& light_color, const Material& mat) {
-    vec3 N_2 = normalize(N);
-    vec3 L_Dir = normalize(L);
-    vec3 V_2  = normalize(V);
+vec3 Caster::local_illumination(const vec3& V, const vec3& N, const vec3& L, const vec3& light_color, const Material& mat) const {
+    No_Trace trace;
+    return unit_illumination(normalize(V), normalize(N), normalize(L),
+                             light_color, mat, trace);
+}
+
+template <class Trace>
+vec3 Caster::unit_illumination(const vec3& V_2, const vec3& N_2,
+                               const vec3& L_Dir, const vec3& light_color,
+                               const Material& mat, Trace& trace) const {
     vec3 R = mirror_direction(L_Dir, N_2);
     vec3 kd = mat._diffuse_reflectance;
     vec3 ks = mat._specular_reflectance;
@@ -193,25 +373,65 @@ vec3 Caster::local_illumination(const vec3& V, const vec3& N, const vec3& L, con
     vec3 diffuse = max(dot(N_2, L_Dir), 0.001f) * light_color * kd;
     vec3 specular = spec * light_color * ks;
     vec3 output = (ambient + diffuse + specular);
+    trace.terms(ambient, diffuse, specular);
     return output;
 }
 
 
-vec3 Caster::glossy_color(const vec3& S, const vec3& V, const Hit& hit) {
-    if (hit._material != nullptr) {
-        vec3 color = glm::vec3(0, 0, 0);
-            for (auto& light : _lights) {
-                vec3 L = normalize(light._position - hit._position);
-                if (_shadowing && hits_something(hit._position, L)) { continue; }
-                color += local_illumination(-V, hit._normal, normalize(light._position - hit._position), light._color, *hit._material);
+vec3 Caster::glossy_color(const vec3& S, const vec3& V, const Hit& hit) const {
+    No_Trace trace;
+    return shade<SHADOWS_ANY, ANY_LIGHTS, SHAPES_ANY>(V, hit, trace);
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX, class Trace>
+vec3 Caster::shade(const vec3& V, const Hit& hit, Trace& trace) const {
+    if (hit._material == NO_MATERIAL) { return _background_color; }
+    const Material& mat = _materials[hit._material];
+    bool shadows = (SHADOWS == SHADOWS_ANY) ? _shadowing : (SHADOWS == SHADOWS_ON);
+    int num_lights = (NUM_LIGHTS == ANY_LIGHTS) ? (int)_lights.size() : NUM_LIGHTS;
+
+    // The same for every light, so they're normalized once per hit,
+    // not once per light.
+    vec3 N = normalize(hit._normal);
+    vec3 to_eye = normalize(-V);
+
+    vec3 color = glm::vec3(0, 0, 0);
+    for (int i = 0; i < num_lights; i++) {
+        const Light& light = _lights[i];
+        vec3 to_light = light._position - hit._position;
+        float light_distance = length(to_light);
+        vec3 L = to_light / light_distance;
+        bool self_shadowed = false;
+        bool blocked = false;
+        if (shadows) {
+            // Triangles are flat, so they never shadow themselves.
+            // A sphere's normal points the same way as the hit point
+            // minus its center, which is what Sphere::shadows_itself()
+            // looks at. Anything else has to ask the shape (or the
+            // instance it belongs to).
+            if (MIX == SPHERES_ONLY) {
+                self_shadowed = dot(hit._normal, L) < 0;
+            } else if (MIX != TRIANGLES_ONLY) {
+                const Shape *surface = hit._instance ? hit._instance : hit._shape;
+                self_shadowed = surface->shadows_itself(hit, L);
             }
-        color += hit._material->_ambient_reflectance * _ambient_light;
-        return color;
-    } else { return _background_color; }
+            blocked = !self_shadowed
+                && hits_something(hit._position, L, light_distance, hit, i);
+        }
+        trace.light(i, L, self_shadowed, blocked);
+        if (self_shadowed || blocked) { continue; }
+        // L is a unit vector already, but local_illumination() used to
+        // normalize it a second time, and dropping that changes a few
+        // pixels by one. It stays, so images are byte-identical.
+        color += unit_illumination(to_eye, N, normalize(L), light._color, mat,
+                                   trace);
+    }
+    color += mat._ambient_reflectance * _ambient_light;
+    return color;
 }
 
 
-vec3 Caster::ray_color(int x_dcs, int y_dcs) {
+vec3 Caster::ray_color(int x_dcs, int y_dcs) const {
     vec3 S, V;
     Hit hit;
     set_ray(x_dcs, y_dcs, S, V);
@@ -219,51 +439,739 @@ vec3 Caster::ray_color(int x_dcs, int y_dcs) {
     else { return _background_color; }
 } 
 
+vec3 Caster::trace_ray(int x_dcs, int y_dcs, Ray_Trace& trace) const {
+    vec3 S, V;
+    Hit hit;
+    set_ray(x_dcs, y_dcs, S, V);
+    trace.ray(x_dcs, y_dcs, S, V);
+    vec3 color = _background_color;
+    if (trace_first_hit(S, V, hit, trace)) {
+        trace.found(hit);
+        color = shade<SHADOWS_ANY, ANY_LIGHTS, SHAPES_ANY>(V, hit, trace);
+    }
+    trace.color(color);
+    return color;
+}
+
+bool Caster::trace_first_hit(const vec3& start, const vec3& direction,
+                             Hit& hit, Ray_Trace& trace) const {
+    Lazy_Hit nearest(FAR_AWAY);
+    bool found = false;
+    for (Shape *shape : _scene) {
+        if (shape->trace_hit(start, direction, nearest, trace)) {
+            found = true;
+        }
+    }
+    if (found) { nearest.finalize(start, direction, hit); }
+    return found;
+}
+
+
+vec3 Caster::pixel_point(float x_dcs, float y_dcs) const {
+    float x_vcs = _camera._clip_Left + x_dcs * _pixel_width;
+    float y_vcs = _camera._clip_Bottom + y_dcs * _pixel_height;
+    vec4 p_wcs = _M_vcs_to_wcs * vec4(x_vcs, y_vcs, -_camera._clip_Near, 1.0f);
+    return vec3(p_wcs);
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::render_packet(int x0, int y0) {
+    int x1 = std::min(x0 + _packet_size, _width);
+    int y1 = std::min(y0 + _packet_size, _height);
+
+    Ray_Packet packet;
+    for (int y_dcs = y0; y_dcs < y1; y_dcs++) {
+        for (int x_dcs = x0; x_dcs < x1; x_dcs++) {
+            vec3 S, V;
+            set_ray(x_dcs, y_dcs, S, V);
+            packet.add(S, V);
+        }
+    }
+
+    // The block's outer edges are half a pixel outside its rays,
+    // so rounding can't put a ray outside the frustum.
+    vec3 corners[4] = {
+        pixel_point(x0, y0), pixel_point(x1, y0),
+        pixel_point(x1, y1), pixel_point(x0, y1)
+    };
+    packet.set_frustum(_camera._eye, corners);
+    _accelerator->first_hits(packet, FAR_AWAY);
+
+    No_Trace trace;
+    int i = 0;
+    for (int y_dcs = y0; y_dcs < y1; y_dcs++) {
+        for (int x_dcs = x0; x_dcs < x1; x_dcs++) {
+            Hit& hit = _primary_hits[y_dcs * _width + x_dcs];
+            if (packet._found[i]) { hit = packet._hits[i]; }
+            store_pixel(x_dcs, y_dcs,
+                        shade<SHADOWS, NUM_LIGHTS, MIX>(packet._directions[i],
+                                                        hit, trace));
+            i++;
+        }
+    }
+}
+
+void Caster::store_pixel(int x_dcs, int y_dcs, const vec3& color) {
+    _framebuffer.set(x_dcs, y_dcs, color);
+}
 
 void Caster::read_scene(const string& file_name) {
+    cancel_render();
     Scene_Reader reader;
     try {
-        reader.read_scene(file_name, _scene, _camera, _lights);
+        reader.read_scene(file_name, _scene, _shape_names, _materials,
+                          _camera, _lights);
     }
     catch (invalid_argument& e) {
         cerr << e.what() << endl;
         exit(1);
     }
+    print_memory(cout);
 
     _ambient_light = vec3(0, 0, 0);
     for (Light& light : _lights) {
         _ambient_light += light._color * _camera._ambient_fraction;
     }
+
+    build_accelerator();
+}
+
+// Bytes a shape object takes up. (An instance's prototype is
+// shared by all its instances, so it isn't counted.)
+static size_t shape_bytes(const Shape *shape) {
+    if (dynamic_cast<const Sphere*>(shape)) { return sizeof(Sphere); }
+    if (dynamic_cast<const Triangle*>(shape)) { return sizeof(Triangle); }
+    if (dynamic_cast<const Cylinder*>(shape)) { return sizeof(Cylinder); }
+    if (dynamic_cast<const Instance*>(shape)) { return sizeof(Instance); }
+    return sizeof(Shape);
+}
+
+void Caster::print_memory(ostream& os) const {
+    size_t shapes = 0;
+    for (const Shape *shape : _scene) {
+        shapes += shape_bytes(shape);
+    }
+    size_t materials = _materials.material_bytes();
+    size_t names = _shape_names.capacity() * sizeof(string)
+        + _materials.name_bytes();
+    for (const string& name : _shape_names) {
+        names += name.capacity();
+    }
+    size_t count = _scene.empty() ? 1 : _scene.size();
+    os << "Scene: " << _scene.size() << " shapes, "
+       << (shapes + materials) / count << " bytes per shape ("
+       << shapes << " in shapes, " << materials << " in "
+       << _materials.size() << " materials), and "
+       << names << " bytes of names, kept apart" << endl;
+}
+
+const vector<string>& Caster::shape_names() const {
+    return _shape_names;
+}
+
+void Caster::build_accelerator() {
+    _scene_id = next_scene_id++;
+    invalidate_primary_hits();
+
+    // Which kinds of shape there are, for picking the shading loop.
+    bool all_spheres = !_scene.empty();
+    bool all_triangles = !_scene.empty();
+    for (const Shape *shape : _scene) {
+        all_spheres = all_spheres && dynamic_cast<const Sphere*>(shape);
+        all_triangles = all_triangles && dynamic_cast<const Triangle*>(shape);
+    }
+    _shape_mix = all_spheres ? SPHERES_ONLY
+        : all_triangles ? TRIANGLES_ONLY : SHAPES_ANY;
+
+    _linear_shapes.clear();
+    if (_accelerator_name == "linear") {
+        _accelerator = nullptr;
+        _linear_shapes.build(_scene);
+        cout << "No accelerator: testing all " << _scene.size()
+             << " shapes (";
+        _linear_shapes.print_stats(cout);
+        cout << ") for every ray" << endl;
+        return;
+    }
+
+    if (_accelerator_name == "grid") {
+        _accelerator = SP_Accelerator(new Grid());
+    } else if (_accelerator_name == "bvh4") {
+        _accelerator = SP_Accelerator(new BVH4(_thread_pool));
+    } else if (_accelerator_name == "bvh8") {
+        _accelerator = SP_Accelerator(new BVH8(_thread_pool));
+    } else {
+        _accelerator = SP_Accelerator(new BVH(_thread_pool));
+    }
+
+    auto build_start = steady_clock::now();
+    _accelerator->build(_scene);
+    duration<double, std::milli> build_time = steady_clock::now() - build_start;
+
+    _accelerator->print_stats(cout);
+    cout << ", built in " << build_time.count() << " ms" << endl;
 }
 
 SP_Image Caster::render() {
 
     // cout << "render" << endl;
 
-    int p = 0;
-    for (int y_dcs = 0; y_dcs < _height; y_dcs++) {
-        for (int x_dcs = 0; x_dcs < _width; x_dcs++) {
+    cancel_render();
+    render_frame();
+    return output_image();
+}
+
+SP_Render_Job Caster::render_async(const Render_Job::Tile_Callback& on_tile) {
+    cancel_render();
+    _job = SP_Render_Job(new Render_Job(on_tile));
+    SP_Render_Job job = _job;
+    _render_thread = std::thread([this, job]() {
+        job->finish(render_frame() ? output_image() : SP_Image());
+    });
+    return job;
+}
+
+void Caster::cancel_render() {
+    if (_job) { _job->cancel(); }
+    if (_render_thread.joinable()) { _render_thread.join(); }
+    _job = nullptr;
+}
+
+bool Caster::render_frame() {
+    bool cast_rays = !_primary_hits_valid;
+    bool passes = in_passes(cast_rays);
+    bool adaptive = cast_rays && _adaptive_block > 0;
+    // (An adaptive frame counts its rays as it goes.)
+    _rays_cast = (cast_rays && !adaptive) ? (long long)_width * _height : 0;
+    if (passes) {
+        // Each pass resets its own hits, so the first one isn't
+        // held up resetting them all.
+        _primary_hits.resize(_width * _height);
+    } else if (cast_rays) {
+        _primary_hits.assign(_width * _height, Hit());
+    }
+
+    if (_wavefront && !passes && !adaptive) {
+        render_wavefront(cast_rays);
+    } else {
+        // Settings are looked at here, once per frame, not for every pixel.
+        Render_Loop render_loop = pick_render_loop();
+        (this->*render_loop)(cast_rays);
+    }
+
+    // A cancelled frame only has some of its hits.
+    if (_job && _job->cancelled()) { return false; }
+    _primary_hits_valid = true;
+    return true;
+}
+
+bool Caster::in_passes(bool cast_rays) const {
+    // Only a render_async() job's passes can be seen, so render()
+    // renders the whole frame at once.
+    return cast_rays && _progressive && _job && _adaptive_block == 0;
+}
+
+void Caster::run_tiles(const Pixel_Order& order,
+                       const function<void(int)>& render_tile) {
+    Render_Job *job = _job.get();
+    _thread_pool->parallel_for(order.num_tiles(), [&](int tile) {
+        if (job && job->cancelled()) { return; }
+        render_tile(tile);
+        if (job) {
+            Render_Job::Tile done;
+            order.tile(tile, done._x0, done._y0, done._x1, done._y1);
+            // (Only quantized if there's a callback to look at it.)
+            if (job->_on_tile) {
+                done._pixels.resize(3 * (done._x1 - done._x0)
+                                    * (done._y1 - done._y0));
+                _framebuffer.quantize(done._x0, done._y0, done._x1, done._y1,
+                                      _exposure, _srgb, _dithering,
+                                      done._pixels.data());
+            }
+            job->finish_tile(done);
+        }
+    });
+}
+
+SP_Image Caster::output_image() {
+    // Quantized straight into the image's own pixels.
+    vector<unsigned char> image_pixels(_width * _height * 3);
+    _framebuffer.quantize(_exposure, _srgb, _dithering, image_pixels.data());
+    return SP_Image(new Image(std::move(image_pixels), _width, _height, 3,
+                              "Ray cast image"));
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::render_pixels(bool cast_rays) {
+    if (cast_rays && _adaptive_block > 0) {
+        render_adaptive<SHADOWS, NUM_LIGHTS, MIX>();
+        return;
+    }
+    if (in_passes(cast_rays)) {
+        render_passes<SHADOWS, NUM_LIGHTS, MIX>();
+        return;
+    }
+
+    // Tiles are whole packets, so the packets are the same as
+    // if the image were traced in one piece.
+    bool packets = cast_rays && _packet_size > 1 && _accelerator;
+    int tile_size = _tile_size;
+    if (_packet_size > 1) {
+        tile_size = (tile_size + _packet_size - 1) / _packet_size * _packet_size;
+    }
+    Pixel_Order order(_pixel_order, _width, _height, tile_size,
+                      packets ? _packet_size : 1);
+
+    if (_job) { _job->start(order.num_tiles()); }
+
+    // Each tile writes only its own pixels and primary hits, and
+    // everything else it uses is only read, so the threads never
+    // share anything they write to (even the occluder caches).
+    run_tiles(order, [&](int tile) {
+        render_tile<SHADOWS, NUM_LIGHTS, MIX>(order, tile, cast_rays);
+    });
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::render_passes() {
+    // Cells are the first pass's blocks, and tiles are whole cells,
+    // so the block a pixel fills is always in the pixel's own tile.
+    int tile_size = (_tile_size + PROGRESSIVE_STEP - 1)
+        / PROGRESSIVE_STEP * PROGRESSIVE_STEP;
+    Pixel_Order order(_pixel_order, _width, _height, tile_size,
+                      PROGRESSIVE_STEP);
+
+    int num_passes = 1;
+    for (int step = PROGRESSIVE_STEP; step > 1; step /= 2) { num_passes++; }
+    if (_job) { _job->start(num_passes * order.num_tiles()); }
+
+    for (int step = PROGRESSIVE_STEP; step >= 1; step /= 2) {
+        run_tiles(order, [&](int tile) {
+            render_pass_tile<SHADOWS, NUM_LIGHTS, MIX>(order, tile, step);
+        });
+        if (!_job) { continue; }
+        if (_job->cancelled()) { return; }
+        if (step > 1) { _job->finish_pass(output_image()); }
+    }
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::render_pass_tile(const Pixel_Order& order, int tile, int step) {
+    int x0, y0, x1, y1;
+    order.tile(tile, x0, y0, x1, y1);
+
+    No_Trace trace;
+    for (const Pixel_Order::Cell& cell : order.cells()) {
+        int cell_x0 = x0 + cell._x;
+        int cell_y0 = y0 + cell._y;
+        int cell_x1 = std::min(cell_x0 + PROGRESSIVE_STEP, x1);
+        int cell_y1 = std::min(cell_y0 + PROGRESSIVE_STEP, y1);
+        for (int y_dcs = cell_y0; y_dcs < cell_y1; y_dcs += step) {
+            for (int x_dcs = cell_x0; x_dcs < cell_x1; x_dcs += step) {
+                // A coarser pass cast this one.
+                if (step < PROGRESSIVE_STEP
+                    && (x_dcs - cell_x0) % (2 * step) == 0
+                    && (y_dcs - cell_y0) % (2 * step) == 0) {
+                    continue;
+                }
+
+                vec3 S, V;
+                set_ray(x_dcs, y_dcs, S, V);
+                Hit& hit = _primary_hits[y_dcs * _width + x_dcs];
+                hit = Hit();
+                get_first_hit(S, V, hit);
+                vec3 color = shade<SHADOWS, NUM_LIGHTS, MIX>(V, hit, trace);
+
+                // Finer passes overwrite the rest of the block later.
+                int block_x1 = std::min(x_dcs + step, cell_x1);
+                int block_y1 = std::min(y_dcs + step, cell_y1);
+                for (int y = y_dcs; y < block_y1; y++) {
+                    for (int x = x_dcs; x < block_x1; x++) {
+                        store_pixel(x, y, color);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::render_adaptive() {
+    // Tiles are whole blocks. Blocks share their edges with the ones
+    // next to them in the same tile, but not with other tiles, so
+    // the threads never share pixels.
+    int tile_size = (_tile_size + _adaptive_block - 1)
+        / _adaptive_block * _adaptive_block;
+    Pixel_Order order(_pixel_order, _width, _height, tile_size,
+                      _adaptive_block);
+    if (_job) { _job->start(order.num_tiles()); }
+
+    run_tiles(order, [&](int tile_index) {
+        // Each thread keeps its arrays, so their memory is reused.
+        static thread_local Adaptive tile;
+        int x1, y1;
+        order.tile(tile_index, tile._x0, tile._y0, x1, y1);
+        tile._width = x1 - tile._x0;
+        int num_pixels = tile._width * (y1 - tile._y0);
+        tile._colors.resize(num_pixels);
+        tile._lit.resize(num_pixels);
+        tile._source.assign(num_pixels, NOT_SAMPLED);
+        tile._rays = 0;
+
+        for (const Pixel_Order::Cell& cell : order.cells()) {
+            int block_x0 = tile._x0 + cell._x;
+            int block_y0 = tile._y0 + cell._y;
+            if (block_x0 >= x1 || block_y0 >= y1) { continue; }
+            subdivide<SHADOWS, NUM_LIGHTS, MIX>(
+                block_x0, block_y0,
+                std::min(block_x0 + _adaptive_block, x1 - 1),
+                std::min(block_y0 + _adaptive_block, y1 - 1), tile);
+        }
+        _rays_cast += tile._rays;
+    });
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::subdivide(int x0, int y0, int x1, int y1, Adaptive& tile) {
+    cast_sample<SHADOWS, NUM_LIGHTS, MIX>(x0, y0, tile);
+    cast_sample<SHADOWS, NUM_LIGHTS, MIX>(x1, y0, tile);
+    cast_sample<SHADOWS, NUM_LIGHTS, MIX>(x0, y1, tile);
+    cast_sample<SHADOWS, NUM_LIGHTS, MIX>(x1, y1, tile);
+    // Every pixel is a corner.
+    if (x1 - x0 <= 1 && y1 - y0 <= 1) { return; }
+
+    if (corners_agree(x0, y0, x1, y1, tile)) {
+        fill_block(x0, y0, x1, y1, tile);
+        return;
+    }
+
+    // Cut it in half each way (or just the way it's wider than 2).
+    int xm = (x0 + x1) / 2;
+    int ym = (y0 + y1) / 2;
+    if (x1 - x0 <= 1) {
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(x0, y0, x1, ym, tile);
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(x0, ym, x1, y1, tile);
+    } else if (y1 - y0 <= 1) {
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(x0, y0, xm, y1, tile);
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(xm, y0, x1, y1, tile);
+    } else {
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(x0, y0, xm, ym, tile);
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(xm, y0, x1, ym, tile);
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(x0, ym, xm, y1, tile);
+        subdivide<SHADOWS, NUM_LIGHTS, MIX>(xm, ym, x1, y1, tile);
+    }
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::cast_sample(int x_dcs, int y_dcs, Adaptive& tile) {
+    int i = (y_dcs - tile._y0) * tile._width + (x_dcs - tile._x0);
+    if (tile._source[i] == 0) { return; }
+
+    vec3 S, V;
+    set_ray(x_dcs, y_dcs, S, V);
+    Hit& hit = _primary_hits[y_dcs * _width + x_dcs];
+    hit = Hit();
+    get_first_hit(S, V, hit);
+    Light_Mask lights;
+    vec3 color = shade<SHADOWS, NUM_LIGHTS, MIX>(V, hit, lights);
+    store_pixel(x_dcs, y_dcs, color);
+
+    tile._colors[i] = color;
+    tile._lit[i] = lights._lit;
+    tile._source[i] = 0;
+    tile._rays++;
+}
+
+bool Caster::corners_agree(int x0, int y0, int x1, int y1,
+                           const Adaptive& tile) const {
+    // Only 64 lights fit in the masks.
+    if (_lights.size() > 64) { return false; }
+
+    int xs[4] = { x0, x1, x0, x1 };
+    int ys[4] = { y0, y0, y1, y1 };
+    const Hit& first_hit = _primary_hits[y0 * _width + x0];
+    int first = (y0 - tile._y0) * tile._width + (x0 - tile._x0);
+    vec3 low = tile._colors[first];
+    vec3 high = low;
+    for (int c = 1; c < 4; c++) {
+        const Hit& hit = _primary_hits[ys[c] * _width + xs[c]];
+        int i = (ys[c] - tile._y0) * tile._width + (xs[c] - tile._x0);
+        if (hit._shape != first_hit._shape
+            || hit._instance != first_hit._instance
+            || tile._lit[i] != tile._lit[first]) {
+            return false;
+        }
+        low = glm::min(low, tile._colors[i]);
+        high = glm::max(high, tile._colors[i]);
+    }
+    vec3 spread = high - low;
+    return spread.x <= _adaptive_threshold && spread.y <= _adaptive_threshold
+        && spread.z <= _adaptive_threshold;
+}
+
+void Caster::fill_block(int x0, int y0, int x1, int y1, Adaptive& tile) {
+    const Hit& h00 = _primary_hits[y0 * _width + x0];
+    const Hit& h10 = _primary_hits[y0 * _width + x1];
+    const Hit& h01 = _primary_hits[y1 * _width + x0];
+    const Hit& h11 = _primary_hits[y1 * _width + x1];
+    unsigned long long lit = tile._lit[(y0 - tile._y0) * tile._width
+                                       + (x0 - tile._x0)];
+    int size = std::max(x1 - x0, y1 - y0);
+
+    for (int y_dcs = y0; y_dcs <= y1; y_dcs++) {
+        for (int x_dcs = x0; x_dcs <= x1; x_dcs++) {
+            // Pixels on an edge are shared with the next block: the
+            // smaller block's corners are closer, so its fill wins
+            // (whichever block gets there first).
+            int i = (y_dcs - tile._y0) * tile._width + (x_dcs - tile._x0);
+            if (tile._source[i] <= size) { continue; }
+
+            // Bilinear, between the corners' hit points and normals.
+            // (A block at the edge of a tile can be a pixel wide.)
+            float u = (x1 > x0) ? (float)(x_dcs - x0) / (x1 - x0) : 0.0f;
+            float v = (y1 > y0) ? (float)(y_dcs - y0) / (y1 - y0) : 0.0f;
+            Hit& hit = _primary_hits[y_dcs * _width + x_dcs];
+            hit = h00;
+            if (hit._material != NO_MATERIAL) {
+                hit._position = glm::mix(glm::mix(h00._position, h10._position, u),
+                                         glm::mix(h01._position, h11._position, u), v);
+                hit._normal = glm::mix(glm::mix(h00._normal, h10._normal, u),
+                                       glm::mix(h01._normal, h11._normal, u), v);
+                hit._t = glm::mix(glm::mix(h00._t, h10._t, u),
+                                  glm::mix(h01._t, h11._t, u), v);
+            }
+            vec3 S, V;
+            set_ray(x_dcs, y_dcs, S, V);
+            store_pixel(x_dcs, y_dcs, shade_lit(V, hit, lit));
+            tile._source[i] = size;
+        }
+    }
+}
+
+vec3 Caster::shade_lit(const vec3& V, const Hit& hit,
+                       unsigned long long lit) const {
+    if (hit._material == NO_MATERIAL) { return _background_color; }
+    const Material& mat = _materials[hit._material];
+    vec3 N = normalize(hit._normal);
+    vec3 to_eye = normalize(-V);
+
+    No_Trace trace;
+    vec3 color = glm::vec3(0, 0, 0);
+    for (int i = 0; i < (int)_lights.size(); i++) {
+        if (!(lit & (1ULL << i))) { continue; }
+        const Light& light = _lights[i];
+        vec3 L = normalize(light._position - hit._position);
+        color += unit_illumination(to_eye, N, L, light._color, mat, trace);
+    }
+    color += mat._ambient_reflectance * _ambient_light;
+    return color;
+}
+
+template <int SHADOWS, int NUM_LIGHTS, int MIX>
+void Caster::render_tile(const Pixel_Order& order, int tile,
+                         bool cast_rays) {
+    int x0, y0, x1, y1;
+    order.tile(tile, x0, y0, x1, y1);
+    bool packets = cast_rays && _packet_size > 1 && _accelerator;
 
-            vec3 color = ray_color(x_dcs, y_dcs);
+    // A missed ray leaves a Hit with no material,
+    // which shade() turns into the background.
+    No_Trace trace;
+    for (const Pixel_Order::Cell& cell : order.cells()) {
+        int x_dcs = x0 + cell._x;
+        int y_dcs = y0 + cell._y;
+        if (x_dcs >= x1 || y_dcs >= y1) { continue; }
+        if (packets) {
+            render_packet<SHADOWS, NUM_LIGHTS, MIX>(x_dcs, y_dcs);
+            continue;
+        }
+        vec3 S, V;
+        set_ray(x_dcs, y_dcs, S, V);
+        Hit& hit = _primary_hits[y_dcs * _width + x_dcs];
+        if (cast_rays) { get_first_hit(S, V, hit); }
+        store_pixel(x_dcs, y_dcs,
+                    shade<SHADOWS, NUM_LIGHTS, MIX>(V, hit, trace));
+    }
+}
+
+void Caster::render_wavefront(bool cast_rays) {
+    Pixel_Order order(_pixel_order, _width, _height, WAVEFRONT_TILE_SIZE, 1);
+    if (_job) { _job->start(order.num_tiles()); }
+    run_tiles(order, [&](int tile) {
+        // Each thread keeps its streams, so their memory is reused.
+        static thread_local Wavefront wave;
+        render_wavefront_tile(order, tile, cast_rays, wave);
+    });
+}
 
-            int r = static_cast<int>(color.r * 255.0);
-            int g = static_cast<int>(color.g * 255.0);
-            int b = static_cast<int>(color.b * 255.0);
+void Caster::render_wavefront_tile(const Pixel_Order& order, int tile,
+                                   bool cast_rays, Wavefront& wave) {
+    int x0, y0, x1, y1;
+    order.tile(tile, x0, y0, x1, y1);
 
-            r = fmax(0, fmin(r, 255));
-            g = fmax(0, fmin(g, 255));
-            b = fmax(0, fmin(b, 255));
+    // 1. The primary rays, in pixel order.
+    wave._primary.clear();
+    for (const Pixel_Order::Cell& cell : order.cells()) {
+        int x_dcs = x0 + cell._x;
+        int y_dcs = y0 + cell._y;
+        if (x_dcs >= x1 || y_dcs >= y1) { continue; }
+        vec3 S, V;
+        set_ray(x_dcs, y_dcs, S, V);
+        wave._primary.add(S, V, FAR_AWAY, y_dcs * _width + x_dcs);
+    }
 
-            _pixels[p++] = r;
-            _pixels[p++] = g;
-            _pixels[p++] = b;
+    // 2. Their hits (unless the last frame's are still good).
+    const Ray_Stream& rays = wave._primary;
+    if (cast_rays) {
+        for (int i = 0; i < rays.size(); i++) {
+            get_first_hit(rays.start(i), rays.direction(i),
+                          _primary_hits[rays._owners[i]]);
         }
     }
 
-    vector<unsigned char> image_pixels;
-    int num_pixels = _width * _height * 3;
-    image_pixels.reserve(num_pixels);
-    std::copy(_pixels, _pixels + num_pixels, back_inserter(image_pixels));
-    return SP_Image(
-        new Image(image_pixels, _width, _height, 3, "Ray cast image"));
-}
\ No newline at end of file
+    // 3. The ones that hit something, by material.
+    sort_hits(wave);
+
+    // 4. The lights, one stream at a time.
+    int num_lights = (int)_lights.size();
+    wave._to_light.assign(wave._hits.size() * num_lights, vec3(0, 0, 0));
+    wave._lit.assign(wave._hits.size() * num_lights, 0);
+    for (int i = 0; i < num_lights; i++) {
+        trace_shadow_stream(i, wave);
+    }
+
+    // 5. The colors.
+    shade_stream(wave);
+}
+
+void Caster::sort_hits(Wavefront& wave) {
+    const Ray_Stream& rays = wave._primary;
+
+    // Count each material's hits, and then put each hit in its
+    // material's part of the list (a counting sort, so the hits of
+    // one material stay in pixel order).
+    vector<int> first(_materials.size() + 1, 0);
+    for (int i = 0; i < rays.size(); i++) {
+        int pixel = rays._owners[i];
+        int material = _primary_hits[pixel]._material;
+        if (material == NO_MATERIAL) {
+            store_pixel(pixel % _width, pixel / _width, _background_color);
+        } else {
+            first[material + 1]++;
+        }
+    }
+    for (size_t m = 1; m < first.size(); m++) {
+        first[m] += first[m - 1];
+    }
+
+    wave._hits.resize(first.back());
+    for (int i = 0; i < rays.size(); i++) {
+        int material = _primary_hits[rays._owners[i]]._material;
+        if (material != NO_MATERIAL) {
+            wave._hits[first[material]++] = i;
+        }
+    }
+}
+
+void Caster::trace_shadow_stream(int light_index, Wavefront& wave) {
+    const Light& light = _lights[light_index];
+    const Ray_Stream& rays = wave._primary;
+    int num_lights = (int)_lights.size();
+
+    // Which way the light is from each hit, and a shadow ray towards
+    // it, unless the hit's shape is in its own way.
+    wave._shadows.clear();
+    for (int h = 0; h < (int)wave._hits.size(); h++) {
+        const Hit& hit = _primary_hits[rays._owners[wave._hits[h]]];
+        vec3 to_light = light._position - hit._position;
+        float light_distance = length(to_light);
+        vec3 L = to_light / light_distance;
+        bool lit = true;
+        if (_shadowing) {
+            const Shape *surface = hit._instance ? hit._instance : hit._shape;
+            lit = !surface->shadows_itself(hit, L);
+            if (lit) { wave._shadows.add(hit._position, L, light_distance, h); }
+        }
+        wave._to_light[h * num_lights + light_index] = L;
+        wave._lit[h * num_lights + light_index] = lit;
+    }
+
+    // Then trace the shadow rays, one after another.
+    const Ray_Stream& shadows = wave._shadows;
+    for (int j = 0; j < shadows.size(); j++) {
+        int h = shadows._owners[j];
+        const Hit& from = _primary_hits[rays._owners[wave._hits[h]]];
+        if (hits_something(shadows.start(j), shadows.direction(j),
+                           shadows._t_max[j], from, light_index)) {
+            wave._lit[h * num_lights + light_index] = false;
+        }
+    }
+}
+
+void Caster::shade_stream(Wavefront& wave) {
+    const Ray_Stream& rays = wave._primary;
+    int num_lights = (int)_lights.size();
+    No_Trace trace;
+
+    // The same sums as shade(), in the same order, so the colors are too.
+    // The hits are grouped by material, so it's looked up once a group.
+    const Material *mat = nullptr;
+    int material = NO_MATERIAL;
+    for (int h = 0; h < (int)wave._hits.size(); h++) {
+        int ray = wave._hits[h];
+        int pixel = rays._owners[ray];
+        const Hit& hit = _primary_hits[pixel];
+        if (hit._material != material) {
+            material = hit._material;
+            mat = &_materials[material];
+        }
+
+        vec3 N = normalize(hit._normal);
+        vec3 to_eye = normalize(-rays.direction(ray));
+        vec3 color = glm::vec3(0, 0, 0);
+        for (int i = 0; i < num_lights; i++) {
+            if (!wave._lit[h * num_lights + i]) { continue; }
+            // Normalized again, like shade() does, so the bytes match.
+            color += unit_illumination(to_eye, N,
+                                       normalize(wave._to_light[h * num_lights + i]),
+                                       _lights[i]._color, *mat, trace);
+        }
+        color += mat->_ambient_reflectance * _ambient_light;
+        store_pixel(pixel % _width, pixel / _width, color);
+    }
+}
+
+Caster::Render_Loop Caster::pick_render_loop() const {
+    if (!_specialized) {
+        return &Caster::render_pixels<SHADOWS_ANY, ANY_LIGHTS, SHAPES_ANY>;
+    }
+    int num_lights = (int)_lights.size();
+    if (_shadowing) { return loop_for_lights<SHADOWS_ON>(num_lights, _shape_mix); }
+    return loop_for_lights<SHADOWS_OFF>(num_lights, _shape_mix);
+}
+
+template <int SHADOWS>
+Caster::Render_Loop Caster::loop_for_lights(int num_lights, int mix) {
+    switch (num_lights) {
+    case 1:
+        return loop_for_mix<SHADOWS, 1>(mix);
+    case 2:
+        return loop_for_mix<SHADOWS, 2>(mix);
+    case 4:
+        return loop_for_mix<SHADOWS, 4>(mix);
+    default:
+        return loop_for_mix<SHADOWS, ANY_LIGHTS>(mix);
+    }
+}
+
+template <int SHADOWS, int NUM_LIGHTS>
+Caster::Render_Loop Caster::loop_for_mix(int mix) {
+    switch (mix) {
+    case SPHERES_ONLY:
+        return &Caster::render_pixels<SHADOWS, NUM_LIGHTS, SPHERES_ONLY>;
+    case TRIANGLES_ONLY:
+        return &Caster::render_pixels<SHADOWS, NUM_LIGHTS, TRIANGLES_ONLY>;
+    default:
+        return &Caster::render_pixels<SHADOWS, NUM_LIGHTS, SHAPES_ANY>;
+    }
+}
@@ -5,13 +5,29 @@
 #include <glm/mat4x4.hpp>
 #include <string>
 #include "shape.hpp"
+#include "material.hpp"
 #include "image.hpp"
 #include "camera.hpp"
 #include "light.hpp"
+#include "accelerator.hpp"
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+#include "ray_trace.hpp"
+#include "framebuffer.hpp"
+#include "pixel_order.hpp"
+#include "ray_stream.hpp"
+#include "render_job.hpp"
+#include <atomic>
+#include <functional>
+#include <thread>
 
 using glm::vec3;
 using glm::mat4;
 using std::string;
+using std::function;
+
+// Light count for a shading loop that works with any number of lights.
+#define ANY_LIGHTS 0
 
 /** A ray caster.
  * Given a scene with several shapes,
@@ -38,7 +54,7 @@ class Caster {
      * @param V Ray's direction vector (the other output of this function).
      */
     void set_ray(int x_dcs, int y_dcs,
-                 vec3& S, vec3& V);
+                 vec3& S, vec3& V) const;
 
     /** This is called when the image should be re-sized.
      * @param width New width (number of pixel columns) of the image.
@@ -57,34 +73,77 @@ class Caster {
      * @return true/false if the ray does/doesn't hit some Shape.
      */
     bool get_first_hit(const vec3& start, const vec3& direction,
-                       Hit& hit);
+                       Hit& hit) const;
 
     /** Returns the color of a pixel.
      * @param x_dcs DCS X coordinate (column) of the pixel.
      * @param y_dcs DCS Y coordinate (row) of the pixel.
      * @return The pixels' RGB.
      */
-    vec3 ray_color(int x_dcs, int y_dcs);
+    vec3 ray_color(int x_dcs, int y_dcs) const;
+
+    /** Returns the color of a pixel, like ray_color(), recording
+     * everything that happens to its ray (for debugging). The ray is
+     * tested against every shape, not just the ones the accelerator
+     * would pick, so the trace shows every t; the hit is the same.
+     * @param x_dcs DCS X coordinate (column) of the pixel.
+     * @param y_dcs DCS Y coordinate (row) of the pixel.
+     * @param trace The trace to fill in.
+     * @return The pixels' RGB.
+     */
+    vec3 trace_ray(int x_dcs, int y_dcs, Ray_Trace& trace) const;
 
     /** Re-render the image.
+     * Keeps each pixel's primary hit. If the camera, the image size
+     * and the scene haven't changed since the last render, only the
+     * lighting has, so it re-shades those hits without casting rays.
+     * The colors go into a float framebuffer, which output_image()
+     * then turns into bytes.
      * @return The new image
      */
     SP_Image render();
 
+    /** Start rendering the image in the background, like render(),
+     * and return straight away. Any render that's still running is
+     * abandoned first (see cancel_render()).
+     * While it runs, don't change the caster (including _camera)
+     * without calling cancel_render() first. Its functions that
+     * change what's rendered, like camera_did_move(), call it
+     * themselves.
+     * @param on_tile Told about each tile as it's finished (on the
+     *                rendering threads, one tile at a time), or nullptr.
+     * @return The job, which can be cancelled, watched, or waited for.
+     */
+    SP_Render_Job render_async(const Render_Job::Tile_Callback& on_tile);
+
+    /** Abandon the render_async() job that's running, if any: the
+     * threads finish the tiles they're on, and start no more. Returns
+     * when they have.
+     */
+    void cancel_render();
+
+    /** Turn the last render's colors into an image again, with the
+     * current exposure, sRGB and dithering settings, without
+     * shading anything.
+     * @return The image.
+     */
+    SP_Image output_image();
+
     /** Compute the total color for one hit point, taking all lights
-     * into account.
+     * into account. (render() uses versions of this that are
+     * specialized for the scene and the settings; see shade().)
      * @param S ray start point.
      * @param V ray direction vector.
      * @param hit The hit information.
      */
-    vec3 glossy_color(const vec3& S, const vec3& V, const Hit& hit);
+    vec3 glossy_color(const vec3& S, const vec3& V, const Hit& hit) const;
 
     /** Get the reflected ray.
      * @param L unit vector towards light source.
      * @param N surface normal.
      * @return The reflection of L on N.
      */
-    vec3 mirror_direction(const vec3& L, const vec3& N);
+    vec3 mirror_direction(const vec3& L, const vec3& N) const;
 
     /** Get one light's contribution to the color.
      * @param V unit vector towards eye point (negative of ray direction vector)
@@ -95,7 +154,7 @@ class Caster {
      */
     vec3 local_illumination(const vec3& V, const vec3& N,
                             const vec3& L, const vec3& light_color,
-                            const Material& mat);
+                            const Material& mat) const;
 
 
     vec3 calculate_ray_direction(int x_dcs, int y_dcs);
@@ -106,39 +165,507 @@ class Caster {
      */
     void read_scene(const string& file_name);
 
+    /** The scene's shape names, which shapes refer to by index
+     * (for debugging).
+     * @return The names.
+     */
+    const vector<string>& shape_names() const;
+
     /** Public access to the renderer's camera position.*/
     Camera _camera;
 
     /** Flip the shadow status */
     void toggle_shadowing();
 
+    /** Choose how rays find the shapes they hit.
+     * Throws an invalid_argument if the name isn't one of these:
+     * "bvh"    bounding volume hierarchy (the default),
+     * "bvh4"   BVH with 4 quantized children per node,
+     * "bvh8"   BVH with 8 quantized children per node,
+     * "grid"   uniform grid,
+     * "linear" test every shape in the scene.
+     * @param name Which of them to use.
+     */
+    void set_accelerator(const string& name);
+
+    /** Choose how many threads build the accelerator and render.
+     * The structure that gets built, and the image, are the same
+     * either way.
+     * Throws an invalid_argument if num_threads is negative.
+     * @param num_threads Thread count, or 0 for one per hardware thread.
+     */
+    void set_threads(int num_threads);
+
+    /** Choose whether the threads are pinned to cores (off by
+     * default; only on Linux).
+     * @param pin true to pin them.
+     */
+    void set_thread_pinning(bool pin);
+
+    /** Choose how big a tile of the image each thread renders at a
+     * time (32 by default). With packets, tiles are rounded up to
+     * a whole number of packets.
+     * Throws an invalid_argument if the size is less than 1.
+     * @param size Pixels along each side of a tile.
+     */
+    void set_tile_size(int size);
+
+    /** Choose the order the image's tiles, and the pixels (or
+     * packets) in each tile, are rendered in (see pixel_order.hpp):
+     * "scanline", "tiled" (the default), "morton" or "hilbert".
+     * The image is the same either way.
+     * Throws an invalid_argument if the name isn't one of those.
+     * @param name Which order.
+     */
+    void set_pixel_order(const string& name);
+
+    /** Choose whether the framebuffer keeps its pixels in 8x8 tiles
+     * along a Z-order curve, rather than row by row (which is the
+     * default). They're put back into rows for the image.
+     * @param morton true for Morton-ordered tiles.
+     */
+    void set_morton_framebuffer(bool morton);
+
+    /** Choose whether render() uses the wavefront renderer, which
+     * takes each large tile of the image through a stage at a time:
+     *   1. generate the tile's primary rays, into a Ray_Stream,
+     *   2. intersect them all with the scene,
+     *   3. keep the ones that hit, grouped by material,
+     *   4. for each light, make a stream of shadow rays from the
+     *      hits, and trace it,
+     *   5. shade the hits, a material at a time.
+     * Otherwise (the default) it takes each pixel through all of
+     * that before going on to the next one. The image is the same
+     * either way.
+     * @param wavefront true for the wavefront renderer.
+     */
+    void set_wavefront(bool wavefront);
+
+    /** Choose whether frames that cast rays are rendered in passes,
+     * coarse to fine. The first pass casts one pixel in every 4x4
+     * block and fills the block with its color; the next casts one
+     * more in each 2x2 block, and fills that; the last casts the
+     * rest. Each pixel is cast once, so a frame casts as many rays
+     * as it would otherwise, and the last pass's image is the same.
+     * A render_async() job has the image as of each pass (see
+     * Render_Job::pass_image()); render() renders whole frames, as
+     * no one sees its passes. Progressive frames are cast one ray
+     * at a time (not in packets, or with the wavefront renderer).
+     * Off by default.
+     * @param progressive true to render in passes.
+     */
+    void set_progressive(bool progressive);
+
+    /** Choose whether frames that cast rays cast them adaptively.
+     * Each tile is cut into blocks, and rays are cast at their
+     * corners. A block whose corners hit the same shape, are lit by
+     * the same lights, and have colors within the threshold of each
+     * other is filled in: each of its pixels gets a hit interpolated
+     * from the corners' (the shading inputs), which is shaded without
+     * casting any rays. Any other block is cut into four, and so on,
+     * down to single pixels. Small shapes, or shadows, that fit
+     * between a block's corners can be missed, so the image isn't
+     * quite the same; caster_bench's "adaptive" mode measures by how
+     * much. Blocks don't cross tiles, so the image depends on the
+     * tile size (but not on the threads or the pixel order).
+     * Adaptive frames are rendered whole, a ray at a time
+     * (not in passes or packets, or with the wavefront renderer).
+     * Scenes with more than 64 lights are cast at every pixel.
+     * Throws an invalid_argument if block_size isn't 0 or a power of
+     * 2, or the threshold is negative.
+     * @param block_size Pixels along each side of the first blocks,
+     *                   or 0 to cast every pixel (the default).
+     * @param threshold How far apart the corners' colors can be, in
+     *                  each of red, green and blue (1 is full scale).
+     */
+    void set_adaptive(int block_size, float threshold);
+
+    /** How many primary rays the last frame cast (0 if it only
+     * re-shaded its hits).
+     * @return The ray count.
+     */
+    long long rays_cast() const;
+
+    /** Will the next frame cast primary rays? It won't if nothing
+     * has changed them since the last one, and it only re-shades
+     * that frame's hits.
+     * @return true if it casts rays.
+     */
+    bool casts_rays() const;
+
+    /** Move some of the scene's shapes (for animation).
+     * The accelerator is refit rather than rebuilt, where it can be.
+     * Throws an invalid_argument if an index is out of range, or
+     * the lists are different lengths.
+     * @param indices Which shapes, in the order the scene file lists them.
+     * @param offsets How far to move each of them.
+     */
+    void move_shapes(const vector<int>& indices, const vector<vec3>& offsets);
+
+    /** Choose how primary rays are traced: one at a time (1), or in
+     * packets of 2x2, 4x4 or 8x8 pixels that go through the
+     * accelerator together. The image is the same either way.
+     * Throws an invalid_argument if the size isn't 1, 2, 4 or 8.
+     * @param size Pixels along each side of a packet.
+     */
+    void set_packet_size(int size);
+
+    /** Choose whether render() uses shading loops that are compiled
+     * separately for each setting: shadows on or off; 1, 2, 4 or any
+     * number of lights; spheres only, triangles only, or any shapes.
+     * It picks the one to use once per frame. Otherwise it uses the
+     * loop that checks all of that for every pixel. The image is the
+     * same either way; this is for benchmarking.
+     * @param specialized true (the default) for the specialized loops.
+     */
+    void set_specialized(bool specialized);
+
+    /** Set what colors are multiplied by when they're turned into
+     * bytes (1, the default, leaves them as they are).
+     * @param exposure The factor.
+     */
+    void set_exposure(float exposure);
+
+    /** Access the exposure.
+     * @return The factor colors are multiplied by.
+     */
+    float get_exposure() const;
+
+    /** Flip whether images are encoded as sRGB (off by default:
+     * colors are turned into bytes as they are). */
+    void toggle_srgb();
+
+    /** Flip whether images are dithered (off by default). */
+    void toggle_dithering();
+
  private:
+    /** What a shading loop knows about the shadows when it's compiled */
+    enum Shadows { SHADOWS_OFF, SHADOWS_ON, SHADOWS_ANY };
+    /** What a shading loop knows about the scene's shapes */
+    enum Shape_Mix { SHAPES_ANY, SPHERES_ONLY, TRIANGLES_ONLY };
+
+    /** A frame's rendering loop, for one set of template arguments */
+    typedef void (Caster::*Render_Loop)(bool cast_rays);
+
+    /** Compute the total color for one hit point, like glossy_color(),
+     * with what's known about the settings and scene built in.
+     * @tparam SHADOWS Whether to cast shadow rays, or SHADOWS_ANY
+     *                 to check _shadowing.
+     * @tparam NUM_LIGHTS How many lights there are, or ANY_LIGHTS.
+     * @tparam MIX Which kinds of shape the scene has.
+     * @tparam Trace No_Trace, or Ray_Trace to debug the ray
+     *               (see ray_trace.hpp).
+     * @param V ray direction vector.
+     * @param hit The hit information.
+     * @param trace Told about each light.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX, class Trace>
+    vec3 shade(const vec3& V, const Hit& hit, Trace& trace) const;
 
-    /** Allocate the pixels for the image.
+    /** Render a frame into the framebuffer, for render() or the
+     * render_async() job.
+     * @return false if the job was cancelled before it was done.
+     */
+    bool render_frame();
+
+    /** Is a frame rendered in passes (see set_progressive())?
+     * @param cast_rays Whether it casts rays.
+     * @return true if it is.
+     */
+    bool in_passes(bool cast_rays) const;
+
+    /** Render each tile of a frame (or of a pass) on all the
+     * threads, and tell the render_async() job (if there is one)
+     * about each of them. Once the job is cancelled, the tiles that
+     * haven't started are skipped.
+     * @param order The frame's tiles.
+     * @param render_tile Renders a tile, given its number.
+     */
+    void run_tiles(const Pixel_Order& order,
+                   const function<void(int)>& render_tile);
+
+    /** Cast (if cast_rays) and shade every pixel of a frame, a tile
+     * at a time, on all the threads.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void render_pixels(bool cast_rays);
+
+    /** Cast (if cast_rays) and shade the pixels of one tile,
+     * one ray or one packet at a time, in order.
+     * @param order The frame's tiles and their order.
+     * @param tile Which tile.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void render_tile(const Pixel_Order& order, int tile, bool cast_rays);
+
+    /** Cast and shade every pixel of a frame in passes, coarse to
+     * fine (see set_progressive()), on all the threads.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void render_passes();
+
+    /** Cast and shade one tile's pixels for one pass, and fill in
+     * the block each of them stands for.
+     * @param order The frame's tiles and their order.
+     * @param tile Which tile.
+     * @param step The pass casts pixels whose column and row are
+     *             multiples of step (and fills step x step blocks),
+     *             except the ones a coarser pass cast.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void render_pass_tile(const Pixel_Order& order, int tile, int step);
+
+    /** What adaptive rendering keeps for one tile */
+    struct Adaptive {
+        /** The tile's first column and row, and how wide it is */
+        int _x0, _y0, _width;
+        /** For each pixel: its color and which lights reach it (if
+         * it was cast), and where its color came from: 0 if it was
+         * cast, or the size of the block that filled it in */
+        vector<vec3> _colors;
+        vector<unsigned long long> _lit;
+        vector<int> _source;
+        /** How many rays the tile has cast */
+        int _rays;
+    };
+
+    /** Render every tile of a frame adaptively (see set_adaptive()),
+     * on all the threads.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void render_adaptive();
+
+    /** Cast rays at a block's corners, then fill it in, or cut it
+     * up and do the same with each piece. The corners are inclusive.
+     * @param x0 DCS X coordinate of the block's left edge.
+     * @param y0 DCS Y coordinate of its bottom edge.
+     * @param x1 DCS X coordinate of its right edge.
+     * @param y1 DCS Y coordinate of its top edge.
+     * @param tile What's known about the tile.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void subdivide(int x0, int y0, int x1, int y1, Adaptive& tile);
+
+    /** Cast and shade one pixel for adaptive rendering, unless it
+     * already has been.
+     * @param x_dcs DCS X coordinate (column) of the pixel.
+     * @param y_dcs DCS Y coordinate (row) of the pixel.
+     * @param tile What's known about the tile.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void cast_sample(int x_dcs, int y_dcs, Adaptive& tile);
+
+    /** Do a block's corners agree closely enough to fill it in?
+     * (Arguments as for subdivide().)
+     */
+    bool corners_agree(int x0, int y0, int x1, int y1,
+                       const Adaptive& tile) const;
+
+    /** Fill in the pixels of a block that haven't been cast (or
+     * filled in by a smaller block), from hits interpolated between
+     * its corners. (Arguments as for subdivide().)
+     */
+    void fill_block(int x0, int y0, int x1, int y1, Adaptive& tile);
+
+    /** Compute the color for one hit point, like shade(), with the
+     * lights that reach it already known (so no shadow rays are cast).
+     * @param V ray direction vector.
+     * @param hit The hit information.
+     * @param lit Bit i is set if light i reaches the hit point.
+     */
+    vec3 shade_lit(const vec3& V, const Hit& hit,
+                   unsigned long long lit) const;
+
+    /** Trace and shade one block of pixels as a ray packet.
+     * @param x0 DCS X coordinate of the block's first column.
+     * @param y0 DCS Y coordinate of the block's first row.
+     */
+    template <int SHADOWS, int NUM_LIGHTS, int MIX>
+    void render_packet(int x0, int y0);
+
+    /** What the wavefront renderer keeps for one tile,
+     * between its stages */
+    struct Wavefront {
+        /** The tile's primary rays */
+        Ray_Stream _primary;
+        /** Which of them hit something, grouped by material */
+        vector<int> _hits;
+        /** Shadow rays to one light, each owned by a hit (an index
+         * into _hits) */
+        Ray_Stream _shadows;
+        /** For each hit, for each light: unit vector towards it */
+        vector<vec3> _to_light;
+        /** ... and whether it lights the hit point */
+        vector<unsigned char> _lit;
+    };
+
+    /** Render every tile of a frame with the wavefront renderer
+     * (see set_wavefront()), on all the threads.
+     */
+    void render_wavefront(bool cast_rays);
+
+    /** Render one tile with the wavefront renderer, a stage at a time.
+     * @param order The frame's tiles and their order.
+     * @param tile Which tile.
+     * @param wave Where to keep the tile's rays and hits.
+     */
+    void render_wavefront_tile(const Pixel_Order& order, int tile,
+                               bool cast_rays, Wavefront& wave);
+
+    /** Stage 3: put the primary rays that hit something in wave._hits,
+     * grouped by material, and the background in the other pixels.
+     */
+    void sort_hits(Wavefront& wave);
+
+    /** Stage 4, for one light: work out which hits it lights, by
+     * tracing a stream of shadow rays towards it.
+     * @param light_index Which light.
+     */
+    void trace_shadow_stream(int light_index, Wavefront& wave);
+
+    /** Stage 5: shade every hit, like shade(), from what the
+     * earlier stages found.
+     */
+    void shade_stream(Wavefront& wave);
+
+    /** The rendering loop for the current settings and scene.
+     */
+    Render_Loop pick_render_loop() const;
+
+    /** The rendering loop for a light count and shape mix,
+     * given the shadows. */
+    template <int SHADOWS>
+    static Render_Loop loop_for_lights(int num_lights, int mix);
+
+    /** The rendering loop for a shape mix, given the rest. */
+    template <int SHADOWS, int NUM_LIGHTS>
+    static Render_Loop loop_for_mix(int mix);
+
+    /** Get one light's contribution to the color, like
+     * local_illumination(), from unit vectors, and tell the trace
+     * its terms.
+     */
+    template <class Trace>
+    vec3 unit_illumination(const vec3& V, const vec3& N,
+                           const vec3& L, const vec3& light_color,
+                           const Material& mat, Trace& trace) const;
+
+    /** Finds the first hit for a ray, like get_first_hit(), testing
+     * every shape with Shape::trace_hit().
+     */
+    bool trace_first_hit(const vec3& start, const vec3& direction,
+                         Hit& hit, Ray_Trace& trace) const;
+
+    /** Allocate the framebuffer for the image.
      * @param width Number of columns in the image.
      * @param height Number of rows in the image.
      */
     void allocate_image(int width, int height);
 
-    /** Destroy the image.
-     */
-    void deallocate_image();
-
-    /** Does a ray hit SOME object? (used for shadows).
+    /** Does a ray hit SOME object before it reaches a light? (used for shadows).
+     * Tests the shape that last blocked the same light (on this thread)
+     * first, and only then searches the scene.
      * @param start Ray's start point.
-     * @direction Ray's direction vector.
+     * @param direction Unit vector towards the light.
+     * @param light_distance Distance to the light; shapes beyond it don't count.
+     * @param from The hit the ray starts at. Its shape is never tested
+     *             (but the rest of its instance, if any, is).
+     * @param light_index Which light the ray goes to.
      * @return whether something was hit.
      */
-    bool hits_something(const vec3& start, const vec3& direction);
+    bool hits_something(const vec3& start, const vec3& direction,
+                        float light_distance, const Hit& from,
+                        int light_index) const;
+
+    /** Point on the near clipping plane, in world coordinates.
+     * @param x_dcs DCS X coordinate (pixel centers are at +0.5).
+     * @param y_dcs DCS Y coordinate.
+     * @return The point.
+     */
+    vec3 pixel_point(float x_dcs, float y_dcs) const;
+
+    /** Forget the primary hits, so that the next render casts rays.
+     */
+    void invalidate_primary_hits();
+
+    /** Store a pixel's color in the framebuffer.
+     * @param x_dcs DCS X coordinate (column) of the pixel.
+     * @param y_dcs DCS Y coordinate (row) of the pixel.
+     * @param color The pixel's RGB (which may be outside [0, 1]).
+     */
+    void store_pixel(int x_dcs, int y_dcs, const vec3& color);
+
+    /** (Re)build the accelerator over the scene's shapes,
+     * and report its stats.
+     */
+    void build_accelerator();
+
+    /** Report how much memory the scene's shapes and materials
+     * take up, per shape (for tuning), and how much their names do.
+     * @param os The stream.
+     */
+    void print_memory(ostream& os) const;
 
-    unsigned char *_pixels;
+    /** The colors of the last render, before they're turned into bytes */
+    Framebuffer _framebuffer;
     int _width, _height;
+    /** What output_image() multiplies colors by */
+    float _exposure;
+    /** Whether output_image() encodes colors as sRGB */
+    bool _srgb;
+    /** Whether output_image() dithers */
+    bool _dithering;
 
     vector <Shape*> _scene;
+    /** Names of the scene's named shapes, which they refer to by index */
+    vector<string> _shape_names;
+    /** The materials the scene's shapes (and hits) refer to */
+    Material_Table _materials;
+    /** nullptr when every shape is tested ("linear") */
+    SP_Accelerator _accelerator;
+    /** The scene's shapes by kind, tested when there's no accelerator */
+    Shape_Store _linear_shapes;
+    string _accelerator_name;
+    /** Changes whenever the scene is rebuilt (see hits_something). */
+    int _scene_id;
+    /** Renders the tiles (and builds the accelerator) */
+    SP_Thread_Pool _thread_pool;
+    /** What _thread_pool was made with */
+    int _num_threads;
+    bool _pin_threads;
+    /** Pixels along each side of a tile */
+    int _tile_size;
+    /** The order tiles and pixels are rendered in */
+    Pixel_Order::Order _pixel_order;
+    /** Whether render() uses the wavefront renderer */
+    bool _wavefront;
+    /** Whether frames that cast rays are rendered coarse to fine */
+    bool _progressive;
+    /** Pixels along each side of an adaptive frame's first blocks
+     * (0 when every pixel is cast), and how far apart their corners'
+     * colors can be */
+    int _adaptive_block;
+    float _adaptive_threshold;
+    /** Primary rays cast by the last frame */
+    std::atomic<long long> _rays_cast;
+    /** The render_async() job, and the thread it runs on (nullptr,
+     * and not joinable, when there isn't one) */
+    SP_Render_Job _job;
+    std::thread _render_thread;
+    /** Pixels along each side of a ray packet (1 means no packets) */
+    int _packet_size;
+    /** Whether render() uses the specialized shading loops */
+    bool _specialized;
+    /** Which kinds of shape the scene has (a Shape_Mix) */
+    int _shape_mix;
     vector <Light> _lights;
     mat4 _M_vcs_to_wcs;
     vec3 _background_color;
-    vector<Hit> _hit_list;
+    /** Each pixel's primary hit in the last render, row by row
+     * (a default Hit where the ray missed) */
+    vector<Hit> _primary_hits;
+    /** Whether _primary_hits is up to date */
+    bool _primary_hits_valid;
     float _pixel_width, _pixel_height;
     vec3 _ambient_light;
     bool _shadowing;
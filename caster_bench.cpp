@@ -0,0 +1,507 @@
+// Times the ray caster without opening a window.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include "caster.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::ofstream;
+using std::stringstream;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+// Uniform random number in [lo, hi).
+float random_float(float lo, float hi) {
+    return lo + (hi - lo) * (rand() / (RAND_MAX + 1.0f));
+}
+
+// Write a scene with a camera, some lights (two by default), one
+// material, and count randomly placed shapes of the given kind in a
+// 10x10x10 cube:
+// "triangles" and "spheres" are spread evenly through the cube,
+// "clusters" are spheres bunched up in a few small clumps,
+// "mixed" are spheres, triangles and cylinders in turn.
+// Return the name of the file.
+string generate_scene(const string& kind, int count, int num_lights) {
+    string file_name = "bench_" + kind + "_" + std::to_string(count);
+    if (num_lights != 2) {
+        file_name += "_" + std::to_string(num_lights) + "lights";
+    }
+    file_name += ".txt";
+    ofstream out(file_name);
+    out << "begin camera\neye 0 0 20\nlookat 0 0 0\nvup 0 1 0\n"
+        << "clip -1 1 -1 1 2.5\nambient_fraction 0.2\nend camera\n\n"
+        << "begin material\nname gray\nambient 0.3 0.3 0.3\n"
+        << "diffuse 0.6 0.6 0.6\nspecular 0.5 0.5 0.5\nshininess 40\n"
+        << "end material\n\n";
+
+    // White, red, green and blue, at the corners of a square above
+    // the shapes, then again, further up.
+    const char *colors[] = {"0.7 0.7 0.7", "0.7 0 0", "0 0.7 0", "0 0 0.7"};
+    const char *corners[] = {"10 10", "-10 10", "10 -10", "-10 -10"};
+    for (int i = 0; i < num_lights; i++) {
+        out << "begin light\ncolor " << colors[i % 4] << "\n"
+            << "position " << corners[i % 4] << " " << 10 + 5 * (i / 4)
+            << "\nend light\n\n";
+    }
+
+    srand(770);
+    vec3 clumps[8];
+    for (vec3& clump : clumps) {
+        clump = vec3(random_float(-4.5, 4.5), random_float(-4.5, 4.5),
+                     random_float(-4.5, 4.5));
+    }
+
+    for (int i = 0; i < count; i++) {
+        float x = random_float(-5, 5);
+        float y = random_float(-5, 5);
+        float z = random_float(-5, 5);
+        if (kind == "clusters") {
+            vec3 clump = clumps[i % 8];
+            x = clump.x + random_float(-0.5, 0.5);
+            y = clump.y + random_float(-0.5, 0.5);
+            z = clump.z + random_float(-0.5, 0.5);
+        }
+        int shape = (kind == "mixed") ? i % 3 : -1;
+        if (kind == "spheres" || kind == "clusters" || shape == 0) {
+            out << "begin sphere\ncenter " << x << " " << y << " " << z
+                << "\nradius 0.05\nmaterial gray\nend sphere\n";
+        } else if (shape == 2) {
+            out << "begin cylinder\ncenter " << x << " " << y << " " << z
+                << "\nheight 0.1\nradius 0.05\nmaterial gray\nend cylinder\n";
+        } else {
+            out << "begin triangle\n";
+            const char *corners[] = {"a", "b", "c"};
+            for (const char *corner : corners) {
+                out << corner << " " << x + random_float(-0.1, 0.1)
+                    << " " << y + random_float(-0.1, 0.1)
+                    << " " << z + random_float(-0.1, 0.1) << "\n";
+            }
+            out << "material gray\nend triangle\n";
+        }
+    }
+    return file_name;
+}
+
+// Time re-shading the same hits (no rays are cast after the first
+// frame), with the general shading loop and with the specialized
+// ones, with shadows on and off.
+void time_shading(Caster& caster, int width, int frames) {
+    caster.render();
+    double pixels = (double)width * width * frames;
+    for (int shadows = 1; shadows >= 0; shadows--) {
+        double rate[2];
+        for (int specialized = 0; specialized <= 1; specialized++) {
+            caster.set_specialized(specialized);
+            auto start = steady_clock::now();
+            for (int frame = 0; frame < frames; frame++) {
+                caster.render();
+            }
+            duration<double> time = steady_clock::now() - start;
+            rate[specialized] = pixels / time.count();
+        }
+        cout << "Shading, shadows " << (shadows ? "on" : "off")
+             << ": general " << rate[0] << ", specialized " << rate[1]
+             << " pixels/sec (" << rate[1] / rate[0] << "x)" << endl;
+        caster.toggle_shadowing();
+    }
+}
+
+// Time casting frames with 1, 2, 4 ... max_threads threads
+// (and max_threads itself), and how much faster each is than 1.
+void time_scaling(Caster& caster, int width, int frames, int max_threads) {
+    if (max_threads <= 0) {
+        max_threads = (int)std::thread::hardware_concurrency();
+    }
+    double rays = (double)width * width * frames;
+    double one_thread_rate = 0;
+    for (int threads = 1; ; threads = std::min(2 * threads, max_threads)) {
+        caster.set_threads(threads);
+        auto start = steady_clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            caster.camera_did_move();
+            caster.render();
+        }
+        duration<double> time = steady_clock::now() - start;
+        double rate = rays / time.count();
+        if (threads == 1) { one_thread_rate = rate; }
+        double speedup = rate / one_thread_rate;
+        cout << threads << " threads: " << rate << " primary rays/sec, "
+             << speedup << "x, " << 100 * speedup / threads
+             << "% efficiency" << endl;
+        if (threads == max_threads) { break; }
+    }
+}
+
+// Time casting frames with the per-pixel renderer and with the
+// wavefront one.
+void time_wavefront(Caster& caster, int width, int frames) {
+    double rays = (double)width * width * frames;
+    double rate[2];
+    for (int wavefront = 0; wavefront <= 1; wavefront++) {
+        caster.set_wavefront(wavefront);
+        auto start = steady_clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            caster.camera_did_move();
+            caster.render();
+        }
+        duration<double> time = steady_clock::now() - start;
+        rate[wavefront] = rays / time.count();
+    }
+    cout << "Per pixel " << rate[0] << ", wavefront " << rate[1]
+         << " primary rays/sec (" << rate[1] / rate[0] << "x)" << endl;
+}
+
+// Time a whole frame, and then how long it takes to abandon one
+// that's half done, compared with how long a tile takes.
+void time_cancel(Caster& caster, int width, int frames, int threads) {
+    if (threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    for (int frame = 0; frame < frames; frame++) {
+        caster.camera_did_move();
+        auto start = steady_clock::now();
+        SP_Render_Job job = caster.render_async(nullptr);
+        job->wait();
+        duration<double, std::milli> frame_time = steady_clock::now() - start;
+        double tile_time = frame_time.count() * threads / job->num_tiles();
+
+        caster.camera_did_move();
+        job = caster.render_async(nullptr);
+        while (job->num_tiles() == 0
+               || job->tiles_done() < job->num_tiles() / 2) {
+            std::this_thread::yield();
+        }
+        auto cancel_start = steady_clock::now();
+        caster.cancel_render();
+        duration<double, std::milli> cancel_time = steady_clock::now() - cancel_start;
+        cout << "Frame " << frame << ": " << frame_time.count() << " ms for "
+             << job->num_tiles() << " tiles (" << tile_time
+             << " ms per tile per thread); cancelled at "
+             << job->tiles_done() << " tiles in " << cancel_time.count()
+             << " ms" << endl;
+    }
+}
+
+// Time whole frames, then progressive ones: how long until the
+// first (coarse) pass's image is there, and until the frame's done.
+void time_progressive(Caster& caster, int frames) {
+    for (int progressive = 0; progressive <= 1; progressive++) {
+        caster.set_progressive(progressive);
+        double first_total = 0, frame_total = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            caster.camera_did_move();
+            auto start = steady_clock::now();
+            SP_Render_Job job = caster.render_async(nullptr);
+            while (progressive && job->passes_done() == 0 && !job->done()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            duration<double, std::milli> first_time = steady_clock::now() - start;
+            job->wait();
+            duration<double, std::milli> frame_time = steady_clock::now() - start;
+            first_total += progressive ? first_time.count() : frame_time.count();
+            frame_total += frame_time.count();
+        }
+        cout << (progressive ? "Progressive" : "Whole frames")
+             << ": first image in " << first_total / frames
+             << " ms, whole frame in " << frame_total / frames << " ms"
+             << endl;
+    }
+}
+
+// Compare an image with a reference one of the same size: the root
+// mean square difference of their bytes, the largest difference, and
+// the fraction of pixels where some byte is more than 8 off.
+void compare_images(const Image& image, const Image& reference,
+                    double& rms, int& max_error, double& bad_fraction) {
+    const vector<unsigned char>& a = image.get_pixels();
+    const vector<unsigned char>& b = reference.get_pixels();
+    int depth = image.get_depth();
+    double sum = 0;
+    long long bad = 0;
+    max_error = 0;
+    for (size_t i = 0; i < a.size(); i += depth) {
+        int worst = 0;
+        for (int c = 0; c < depth; c++) {
+            int error = abs((int)a[i + c] - (int)b[i + c]);
+            sum += (double)error * error;
+            worst = std::max(worst, error);
+        }
+        max_error = std::max(max_error, worst);
+        if (worst > 8) { bad++; }
+    }
+    rms = sqrt(sum / a.size());
+    bad_fraction = (double)bad * depth / a.size();
+}
+
+// Time casting every pixel, then adaptive frames with a few block
+// sizes and thresholds: how many rays each casts, how much faster it
+// is, and how far its image is from the full one.
+void time_adaptive(Caster& caster, int frames) {
+    caster.camera_did_move();
+    SP_Image reference = caster.render();
+    long long all_rays = caster.rays_cast();
+    auto start = steady_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        caster.camera_did_move();
+        caster.render();
+    }
+    duration<double> full_time = steady_clock::now() - start;
+    cout << "Every pixel: " << all_rays << " rays, "
+         << 1000 * full_time.count() / frames << " ms" << endl;
+
+    int block_sizes[] = { 4, 8, 16 };
+    float thresholds[] = { 0.01f, 0.05f, 0.2f };
+    for (int block_size : block_sizes) {
+        for (float threshold : thresholds) {
+            caster.set_adaptive(block_size, threshold);
+            SP_Image image = caster.render();
+            long long rays = caster.rays_cast();
+            start = steady_clock::now();
+            for (int frame = 0; frame < frames; frame++) {
+                caster.camera_did_move();
+                caster.render();
+            }
+            duration<double> time = steady_clock::now() - start;
+
+            double rms, bad_fraction;
+            int max_error;
+            compare_images(*image, *reference, rms, max_error, bad_fraction);
+            cout << "Blocks of " << block_size << ", threshold " << threshold
+                 << ": " << 100.0 * rays / all_rays << "% of the rays, "
+                 << full_time.count() / time.count() << "x as fast; RMS error "
+                 << rms << ", max " << max_error << ", "
+                 << 100 * bad_fraction << "% of pixels more than 8 off"
+                 << endl;
+        }
+    }
+    caster.set_adaptive(0, 0);
+}
+
+// Counts one kind of cache miss (L1 data cache reads, or the
+// last-level cache) on the calling thread, with the CPU's counters.
+// Only on Linux, where they're allowed: otherwise ok() is false.
+class Miss_Counter {
+ public:
+    Miss_Counter(bool last_level) {
+        _fd = -1;
+#if defined(__linux__)
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = (last_level ? PERF_COUNT_HW_CACHE_LL : PERF_COUNT_HW_CACHE_L1D)
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        _fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~Miss_Counter() {
+#if defined(__linux__)
+        if (_fd >= 0) { close(_fd); }
+#endif
+    }
+
+    bool ok() const { return _fd >= 0; }
+
+    void start() {
+#if defined(__linux__)
+        if (_fd < 0) { return; }
+        ioctl(_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(_fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    // Misses since start().
+    long long stop() {
+        long long count = 0;
+#if defined(__linux__)
+        if (_fd < 0) { return 0; }
+        ioctl(_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(_fd, &count, sizeof(count)) != sizeof(count)) { count = 0; }
+#endif
+        return count;
+    }
+
+ private:
+    int _fd;
+};
+
+// Time casting frames in each pixel order, with the framebuffer
+// in rows and in Morton tiles, on one thread (so the cache miss
+// counters see every ray).
+void time_orders(Caster& caster, int width, int frames) {
+    caster.set_threads(1);
+    Miss_Counter l1_misses(false);
+    Miss_Counter ll_misses(true);
+    if (!l1_misses.ok() || !ll_misses.ok()) {
+        cout << "(No cache miss counters here: they need Linux, a CPU that"
+             << " has them, and perf_event_paranoid <= 2)" << endl;
+    }
+
+    double rays = (double)width * width * frames;
+    const char *orders[] = { "scanline", "tiled", "morton", "hilbert" };
+    for (int morton_framebuffer = 0; morton_framebuffer <= 1; morton_framebuffer++) {
+        caster.set_morton_framebuffer(morton_framebuffer);
+        for (const char *order : orders) {
+            caster.set_pixel_order(order);
+            caster.camera_did_move();
+            caster.render(); // warm up
+            l1_misses.start();
+            ll_misses.start();
+            auto start = steady_clock::now();
+            for (int frame = 0; frame < frames; frame++) {
+                caster.camera_did_move();
+                caster.render();
+            }
+            duration<double> time = steady_clock::now() - start;
+            long long l1 = l1_misses.stop();
+            long long ll = ll_misses.stop();
+
+            cout << order << (morton_framebuffer ? ", Morton framebuffer: "
+                              : ", row framebuffer: ")
+                 << rays / time.count() << " primary rays/sec";
+            if (l1_misses.ok()) { cout << ", " << l1 / rays << " L1D misses/ray"; }
+            if (ll_misses.ok()) { cout << ", " << ll / rays << " LLC misses/ray"; }
+            cout << endl;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        cerr << "Usage:" << endl;
+        cerr << "   caster_bench <scene_file.txt> [width] [frames] [bvh|bvh4|bvh8|grid|linear] [threads] [packet] [cast|shading|scaling|orders|wavefront|cancel|progressive|adaptive] [tile] [pin] [order]"
+             << endl;
+        cerr << "   caster_bench triangles:<count>[:lights] [width] [frames] [bvh|bvh4|bvh8|grid|linear] [threads] [packet] [cast|shading|scaling|orders|wavefront|cancel|progressive|adaptive] [tile] [pin] [order]"
+             << endl;
+        cerr << "   caster_bench spheres:<count>[:lights] [width] [frames] [bvh|bvh4|bvh8|grid|linear] [threads] [packet] [cast|shading|scaling|orders|wavefront|cancel|progressive|adaptive] [tile] [pin] [order]"
+             << endl;
+        cerr << "   caster_bench clusters:<count>[:lights] [width] [frames] [bvh|bvh4|bvh8|grid|linear] [threads] [packet] [cast|shading|scaling|orders|wavefront|cancel|progressive|adaptive] [tile] [pin] [order]"
+             << endl;
+        cerr << "   caster_bench mixed:<count>[:lights] [width] [frames] [bvh|bvh4|bvh8|grid|linear] [threads] [packet] [cast|shading|scaling|orders|wavefront|cancel|progressive|adaptive] [tile] [pin] [order]"
+             << endl;
+        cerr << "\"shading\" times re-shading the first frame's hits, with and without"
+             << endl << "the specialized shading loops." << endl;
+        cerr << "\"scaling\" times casting with 1, 2, 4 ... [threads] threads (0 for"
+             << endl << "all of the hardware's), for a scaling curve. \"pin\" pins them to cores."
+             << endl;
+        cerr << "\"orders\" times casting in each pixel order (scanline, tiled, morton,"
+             << endl << "hilbert), with cache misses where the CPU counts them." << endl;
+        cerr << "\"wavefront\" times casting with the per-pixel and the wavefront renderers."
+             << endl;
+        cerr << "\"cancel\" times abandoning a half-done render_async() frame."
+             << endl;
+        cerr << "\"progressive\" times the first image and the whole frame, with and"
+             << endl << "without progressive rendering." << endl;
+        cerr << "\"adaptive\" times adaptive frames, and compares their rays and images"
+             << endl << "with casting every pixel." << endl;
+        exit(1);
+    }
+
+    string scene_file = argv[1];
+    int width = (argc > 2) ? atoi(argv[2]) : 200;
+    int frames = (argc > 3) ? atoi(argv[3]) : 3;
+    string accelerator = (argc > 4) ? argv[4] : "bvh";
+    int threads = (argc > 5) ? atoi(argv[5]) : 0;
+    int packet_size = (argc > 6) ? atoi(argv[6]) : 1;
+    string mode = (argc > 7) ? argv[7] : "cast";
+    int tile_size = (argc > 8) ? atoi(argv[8]) : 32;
+    bool pin = (argc > 9) && string(argv[9]) == "pin";
+    string pixel_order = (argc > 10) ? argv[10] : "tiled";
+
+    size_t colon = scene_file.find(':');
+    if (colon != string::npos) {
+        string count = scene_file.substr(colon + 1);
+        size_t lights_colon = count.find(':');
+        int num_lights = 2;
+        if (lights_colon != string::npos) {
+            num_lights = atoi(count.substr(lights_colon + 1).c_str());
+            count = count.substr(0, lights_colon);
+        }
+        scene_file = generate_scene(scene_file.substr(0, colon),
+                                    atoi(count.c_str()), num_lights);
+    }
+
+    Caster caster(width, width);
+    caster.set_thread_pinning(pin);
+    caster.set_threads(threads);
+    caster.set_tile_size(tile_size);
+    caster.set_pixel_order(pixel_order);
+    caster.set_packet_size(packet_size);
+    caster.set_accelerator(accelerator);
+
+    auto read_start = steady_clock::now();
+    caster.read_scene(scene_file);
+    duration<double> read_time = steady_clock::now() - read_start;
+    cout << "Read " << scene_file << " in " << read_time.count() << " s" << endl;
+
+    if (mode == "shading") {
+        time_shading(caster, width, frames);
+        return 0;
+    }
+    if (mode == "wavefront") {
+        time_wavefront(caster, width, frames);
+        return 0;
+    }
+    if (mode == "cancel") {
+        time_cancel(caster, width, frames, threads);
+        return 0;
+    }
+    if (mode == "progressive") {
+        time_progressive(caster, frames);
+        return 0;
+    }
+    if (mode == "adaptive") {
+        time_adaptive(caster, frames);
+        return 0;
+    }
+    if (mode == "orders") {
+        time_orders(caster, width, frames);
+        return 0;
+    }
+    if (mode == "scaling") {
+        time_scaling(caster, width, frames, threads);
+        return 0;
+    }
+
+    double total = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        // Otherwise every frame after the first would re-shade
+        // the first one's hits, without casting any rays.
+        caster.camera_did_move();
+        auto frame_start = steady_clock::now();
+        caster.render();
+        duration<double> frame_time = steady_clock::now() - frame_start;
+        total += frame_time.count();
+        cout << "Frame " << frame << ": " << frame_time.count() << " s" << endl;
+    }
+
+    double rays = (double)width * width * frames;
+    cout << accelerator << ": " << width << "x" << width << ", packets of "
+         << packet_size << "x" << packet_size << ", "
+         << rays / total << " primary rays/sec" << endl;
+    return 0;
+}
@@ -1,13 +1,27 @@
 #include "caster_controller.hpp"
 #include "log.hpp"
+#include "ray_trace.hpp"
 #include <glm/vec3.hpp>
 #include <glm/gtx/string_cast.hpp> // glm::to_string
 #include <iostream>
+#include <chrono>
+#include <cmath>
 
 using glm::vec3;
 using glm::to_string;
 using std::cout;
 using std::endl;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+
+// While a frame is rendering, how long to wait for input
+// before checking whether it's done.
+#define FRAME_POLL_SECONDS 0.005
+// With automatic resolution: how long a frame should take while the
+// camera moves (under the key repeat interval, so frames get finished
+// between repeats), and how long it has to stay still to count as idle.
+#define TARGET_FRAME_SECONDS 0.025
+#define IDLE_SECONDS 0.25
 
 namespace Caster_Controller {
 
@@ -26,13 +40,59 @@ namespace Caster_Controller {
     // and needs to be painted onto the screen again.
     bool _scene_changed;
 
+    // Rendering happens in the background, so that input never
+    // waits for it. Edits to the camera go into a copy of it, and
+    // only the latest one is rendered: the event loop starts a new
+    // frame with it, abandoning the one in flight, if any.
+    Camera _pending_camera;
+    // true if _pending_camera has moved since the last frame started.
+    bool _camera_moved;
+    // true if a new frame is needed (for whatever reason).
+    bool _render_pending;
+    // The frame being rendered, or nullptr.
+    SP_Render_Job _job;
+    // Whether frames are rendered coarse to fine, and how many of
+    // the frame in flight's coarse passes have been shown.
+    bool _progressive = false;
+    int _passes_shown;
+
     // Current mouse position
     int _mouse_x, _mouse_y;
 
     // Available image widths
     vector<int> _image_widths{20, 50, 100, 200, 300, 500, 800};
     int _current_image_width_index = 3;
+    // The width chosen with R / Shift-R (the full resolution).
     int _current_image_width;
+    // The width the renderer is set to (smaller than the full one
+    // while automatic resolution is holding the frame time down).
+    int _render_width = 0;
+
+    // Automatic resolution: while the camera moves, frames are
+    // rendered at whatever width should take TARGET_FRAME_SECONDS
+    // (but no wider than the full one), from how long the last frame
+    // took per pixel. Once it's been still for IDLE_SECONDS, a frame
+    // at the full width is rendered.
+    bool _auto_resolution = false;
+    // Rendering time per pixel, from the last frame that cast rays
+    // (0 if unknown).
+    double _seconds_per_pixel = 0;
+    // When the frame in flight started, and its width.
+    steady_clock::time_point _frame_start;
+    int _frame_width;
+    // Whether the frame in flight casts primary rays. Frames that
+    // only re-shade the last one's hits are much quicker, so they
+    // say nothing about the next camera move, and aren't timed.
+    bool _frame_casts_rays = false;
+    // When the camera last moved.
+    steady_clock::time_point _last_camera_move;
+
+    // Set the renderer's width (and height).
+    void set_render_width(int width) {
+        if (width == _render_width) { return; }
+        _render_width = width;
+        _renderer->update_image_dimensions(width, width);
+    }
 
     // Change the image resolution
     void update_resolution(int resolution_step) {
@@ -43,42 +103,141 @@ namespace Caster_Controller {
                       (int)_image_widths.size() - 1),
                   0);
         _current_image_width = _image_widths[_current_image_width_index];
-        _renderer->update_image_dimensions(_current_image_width,
-                                           _current_image_width);
+        set_render_width(_current_image_width);
+    }
+
+    // Seconds since a time.
+    double seconds_since(steady_clock::time_point time) {
+        duration<double> elapsed = steady_clock::now() - time;
+        return elapsed.count();
+    }
+
+    // Has the camera been still long enough to render at full width?
+    bool camera_idle() {
+        return seconds_since(_last_camera_move) >= IDLE_SECONDS;
     }
 
-    // The camera moved: cast a new image.
-    void rerender() {
-        _renderer->camera_did_move();
-        _image = _renderer->render();
-        //_image->write_pnm("scene.ppm");
+    // The width for the next frame, with automatic resolution.
+    int auto_width() {
+        if (camera_idle() || _seconds_per_pixel <= 0) {
+            return _current_image_width;
+        }
+        int width = (int)sqrt(TARGET_FRAME_SECONDS / _seconds_per_pixel);
+        return max(min(width, _current_image_width), _image_widths.front());
+    }
+
+    // Learn from the frame in flight, which is being abandoned:
+    // estimate what it would have taken from how much was done.
+    // (If no tile was done, count it as one: that gives a lower
+    // bound, so only use it if it's slower than the last estimate.)
+    void abandon_render() {
+        if (!_job || _job->done() || _job->num_tiles() == 0
+            || !_frame_casts_rays) {
+            return;
+        }
+        double done = max(_job->progress(), 1.0f / _job->num_tiles());
+        double seconds_per_pixel = seconds_since(_frame_start) / done
+            / ((double)_frame_width * _frame_width);
+        if (_job->tiles_done() > 0 || seconds_per_pixel > _seconds_per_pixel) {
+            _seconds_per_pixel = seconds_per_pixel;
+        }
+    }
+
+    // Start rendering the latest state, abandoning the frame that's
+    // in flight, if any.
+    void start_render() {
+        abandon_render();
+        _renderer->cancel_render();
+        if (_auto_resolution) { set_render_width(auto_width()); }
+        if (_camera_moved) {
+            _renderer->_camera = _pending_camera;
+            _renderer->camera_did_move();
+            _camera_moved = false;
+        }
+        _frame_start = steady_clock::now();
+        _frame_width = _render_width;
+        _frame_casts_rays = _renderer->casts_rays();
+        _job = _renderer->render_async(nullptr);
+        _passes_shown = 0;
+        _render_pending = false;
+    }
+
+    // Show the frame in flight, if it's done (or, if it's rendered
+    // coarse to fine, if it has a pass that hasn't been shown).
+    void collect_render() {
+        if (!_job) { return; }
+        if (!_job->done()) {
+            int passes = _job->passes_done();
+            if (passes > _passes_shown) {
+                _image = _job->pass_image();
+                _scene_changed = true;
+                _passes_shown = passes;
+            }
+            return;
+        }
+        SP_Image image = _job->wait();
+        if (image) {
+            _image = image;
+            _scene_changed = true;
+            if (_frame_casts_rays) {
+                _seconds_per_pixel = seconds_since(_frame_start)
+                    / ((double)_frame_width * _frame_width);
+            }
+            //_image->write_pnm("scene.ppm");
+        }
+        _job = nullptr;
+    }
+
+    // With automatic resolution, is the image smaller than the full
+    // width, and the camera still (so it's time for a full one)?
+    bool want_full_resolution() {
+        return _auto_resolution && !_job && !_render_pending
+            && _render_width != _current_image_width && camera_idle();
     }
 
     // Handle keyboard events.
     void key_callback(GLFWwindow* window, int key, int scancode,
                       int action, int mods)
     {
+        // Holding an arrow key keeps the camera moving. Each repeat
+        // only edits the pending camera, so however many arrive while
+        // a frame renders, just the last position gets rendered next.
+        if (action == GLFW_REPEAT
+            && (key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT
+                || key == GLFW_KEY_DOWN || key == GLFW_KEY_UP)) {
+            action = GLFW_PRESS;
+        }
+
         if (action == GLFW_PRESS) {
             if (key == GLFW_KEY_Q || key == GLFW_KEY_ESCAPE) {
                 glfwSetWindowShouldClose(window, true);
+                return;
             }
             else if (key == GLFW_KEY_LEFT) {
-                _renderer->_camera.orbit_left();
+                _pending_camera.orbit_left();
+                _camera_moved = true;
+                _last_camera_move = steady_clock::now();
             }
             else if (key == GLFW_KEY_RIGHT) {
-                _renderer->_camera.orbit_right();
+                _pending_camera.orbit_right();
+                _camera_moved = true;
+                _last_camera_move = steady_clock::now();
             }
             else if (key == GLFW_KEY_DOWN) {
                 if (mods & GLFW_MOD_SHIFT)
-                    _renderer->_camera.back();
+                    _pending_camera.back();
                 else
-                    _renderer->_camera.orbit_down();
+                    _pending_camera.orbit_down();
+                _camera_moved = true;
+                _last_camera_move = steady_clock::now();
             }
             else if (key == GLFW_KEY_UP) {
                 if (mods & GLFW_MOD_SHIFT)
-                    _renderer->_camera.forward();
+                    _pending_camera.forward();
                 else
-                    _renderer->_camera.orbit_up();
+                    _pending_camera.orbit_up();
+                _camera_moved = true;
+                _last_camera_move = steady_clock::now();
             }
             else if (key == GLFW_KEY_R) {
                 if (mods & GLFW_MOD_SHIFT)
@@ -86,22 +245,65 @@ namespace Caster_Controller {
                 else
                     update_resolution(-1);
             }
+            else if (key == GLFW_KEY_A) {
+                _auto_resolution = !_auto_resolution;
+                cout << "Automatic resolution: "
+                     << (_auto_resolution ? "on" : "off") << endl;
+                if (_auto_resolution) { return; }
+                // Back to the full width.
+                update_resolution(0);
+            }
             else if (key == GLFW_KEY_C) {
                 cout << "Camera: "
-                     << " eye=" << to_string(_renderer->_camera._eye)
-                     << " lookat=" << to_string(_renderer->_camera._lookat)
-                     << " up=" << to_string(_renderer->_camera._up) << endl;
+                     << " eye=" << to_string(_pending_camera._eye)
+                     << " lookat=" << to_string(_pending_camera._lookat)
+                     << " up=" << to_string(_pending_camera._up) << endl;
                 return;
             }
             else if (key == GLFW_KEY_I) {
-                _image->write_pnm("scene.ppm");
+                if (_image) { _image->write_pnm("scene.ppm"); }
+                return;
+            }
+            else if (key == GLFW_KEY_P) {
+                _progressive = !_progressive;
+                _renderer->set_progressive(_progressive);
+                cout << "Progressive rendering: "
+                     << (_progressive ? "on" : "off") << endl;
+                // That abandoned the frame in flight, if any.
+                if (!_job && !_render_pending) { return; }
             }
             else if (key == GLFW_KEY_S) {
+                // Only the lighting changed: the next frame re-shades
+                // the last hits (if the camera hasn't moved too).
                 _renderer->toggle_shadowing();
             }
+            else if (key == GLFW_KEY_E || key == GLFW_KEY_G
+                     || key == GLFW_KEY_D) {
+                // Only the output changed: re-quantize the last colors.
+                if (key == GLFW_KEY_E) {
+                    float exposure = _renderer->get_exposure();
+                    if (mods & GLFW_MOD_SHIFT)
+                        _renderer->set_exposure(exposure * 2);
+                    else
+                        _renderer->set_exposure(exposure / 2);
+                    cout << "Exposure: " << _renderer->get_exposure() << endl;
+                }
+                else if (key == GLFW_KEY_G) {
+                    _renderer->toggle_srgb();
+                }
+                else {
+                    _renderer->toggle_dithering();
+                }
+                // That abandoned the frame in flight, if any, so
+                // render it again; otherwise re-quantize the last one.
+                if (!_job && !_render_pending) {
+                    _image = _renderer->output_image();
+                    _scene_changed = true;
+                    return;
+                }
+            }
 
-            rerender();
-            _scene_changed = true;
+            _render_pending = true;
         }
     }
 
@@ -119,8 +321,8 @@ namespace Caster_Controller {
             // Convert the mouse (x y) to DCS coords.
             int window_width, window_height;
             glfwGetWindowSize(window, &window_width, &window_height);
-            int x_DCS = _mouse_x * _current_image_width / window_width;
-            int y_DCS = (window_height - _mouse_y - 1) * _current_image_width
+            int x_DCS = _mouse_x * _render_width / window_width;
+            int y_DCS = (window_height - _mouse_y - 1) * _render_width
                 / window_height;
 
             cout << "----------------------------" << endl;
@@ -129,16 +331,14 @@ namespace Caster_Controller {
             cout << "DCS point     at ("
                  << x_DCS << " " << y_DCS << ")" << endl;
 
-            // Cast one ray, with debugging on
-            Log::LEVEL = 1;
-            vec3 color = _renderer->ray_color(x_DCS, y_DCS);
+            // Cast one ray, recording everything that happens to it
+            Ray_Trace trace(_renderer->shape_names());
+            vec3 color = _renderer->trace_ray(x_DCS, y_DCS, trace);
+            trace.write_json(Log::os());
 
             // Report the resulting color
             cout << "Pixel (" << x_DCS << " " << y_DCS << ") has color "
                  << glm::to_string(color) << endl;
-
-            // And then disable debugging
-            Log::LEVEL = 0;
         }
         ; // we'll ignore mouse events
     }
@@ -162,11 +362,11 @@ namespace Caster_Controller {
         _current_image_width_index = 3;
         update_resolution(0);
 
-        // Render the initial image
-        _image = _renderer->render();
-        _scene_changed = true;
-
-        rerender();
+        // The event loop renders the initial image.
+        _pending_camera = _renderer->_camera;
+        _camera_moved = true;
+        _render_pending = true;
+        _scene_changed = false;
 
         glfwSetFramebufferSizeCallback(_GLFW_window, framebuffer_size_callback);
         glfwSetKeyCallback(window, key_callback);
@@ -178,7 +378,13 @@ namespace Caster_Controller {
     void event_loop() {
         while (!glfwWindowShouldClose(_GLFW_window))
         {
-            if (_scene_changed) {
+            // All the input since the last time round is in, so
+            // this is the latest state.
+            if (want_full_resolution()) { _render_pending = true; }
+            if (_render_pending) { start_render(); }
+            collect_render();
+
+            if (_scene_changed && _image) {
 
                 // cout << "Scene has changed.  Redraw" << endl;
 
@@ -190,10 +396,26 @@ namespace Caster_Controller {
 
             _scene_changed = false;
 
-            glfwWaitEvents();
+            // While a frame renders, look in on it now and then. With
+            // a small image, wake up when the camera's been still
+            // long enough for a full one.
+            if (_job) {
+                glfwWaitEventsTimeout(FRAME_POLL_SECONDS);
+            } else if (_auto_resolution
+                       && _render_width != _current_image_width) {
+                glfwWaitEventsTimeout(max(IDLE_SECONDS
+                                          - seconds_since(_last_camera_move),
+                                          FRAME_POLL_SECONDS));
+            } else {
+                glfwWaitEvents();
+            }
 
         }
 
+        // Don't leave a frame rendering.
+        _renderer->cancel_render();
+        _job = nullptr;
+
         // cout << "Event loop done. Window should be closed" << endl;
 
         return;
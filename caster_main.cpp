@@ -13,12 +13,13 @@ using std::cin;
 using std::cerr;
 using std::endl;
 using std::string;
+using std::invalid_argument;
 
 int main(int argc, char **argv)
 {
-    if (argc != 2) {
+    if (argc != 2 && argc != 3) {
         cerr << "Usage:" << endl;
-        cerr << "   caster <scene_file.txt>" << endl;
+        cerr << "   caster <scene_file.txt> [bvh|bvh4|bvh8|grid|linear]" << endl;
         cerr << " PRESS Control-C to exit program:";
         string line;
         getline(cin, line);
@@ -43,6 +44,15 @@ int main(int argc, char **argv)
 
     // Create a ray-casting renderer.
     Caster caster(image_width, image_height);
+    if (argc == 3) {
+        try {
+            caster.set_accelerator(argv[2]);
+        }
+        catch (invalid_argument& e) {
+            cerr << e.what() << endl;
+            exit(1);
+        }
+    }
     caster.read_scene(argv[1]);
 
     // Create a view to paint the image onto the screen.
@@ -1,5 +1,4 @@
 #include "cylinder.hpp"
-#include "log.hpp"
 #include <glm/geometric.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <vector>
@@ -14,73 +13,81 @@ using std::endl;
 
 Cylinder::Cylinder(const vec3& center, float radius,
                    float height,
-                   const Material& material,
-                   const string& name)
+                   int material,
+                   int name)
     : Shape(material, name), _center(center), _radius(radius), _height(height)
 {
     ; // all done
 }
 
 
-bool Cylinder::intersects(const vec3 &start, const vec3 &direction, Hit &hit) {
-    if (Log::LEVEL > 0) {
-        Log::os() << "Entering Cylinder::intersects. start=" << to_string(start)
-                  << " direction=" << to_string(direction) << endl;
-    }
+bool Cylinder::intersects(const vec3 &start, const vec3 &direction,
+                          Hit &hit) const {
+    Lazy_Hit lazy;
+    if (!find_hit(start, direction, lazy)) { return false; }
+    finalize_hit(start, direction, lazy, hit);
+    return true;
+}
 
-    vec3 center = _center;
-    float radius = _radius;
-    float rad2 = pow(radius, 2);
+bool Cylinder::find_hit(const vec3& start, const vec3& direction,
+                        Lazy_Hit& hit) const {
+    float t;
+    int part;
+    if (!record().intersect(start, direction, t, part) || !(t < hit._t)) {
+        return false;
+    }
+    hit.set(t, this, part);
+    return true;
+}
 
-    float cylinder_divide = _height / 2;
-    float a = direction.x * direction.x + direction.z * direction.z;
-    float b = 2.0f * (direction.x * (start.x - center.x) + direction.z * (start.z - center.z));
-    float c = (start.x - center.x) * (start.x - center.x) + (start.z - center.z) * (start.z - center.z) - rad2;
-    float d = b*b - 4*a*c;
-    float t1 = (-b + sqrt(d)) / (2.0f * a);
-    float t2 = (-b - sqrt(d)) / (2.0f * a);
-    float t = (t1 < t2) ? t1 : t2;
+void Cylinder::finalize_hit(const vec3& start, const vec3& direction,
+                            const Lazy_Hit& lazy, Hit& hit) const {
+    vec3 P_s_cylinder = start + lazy._t * direction;
+    hit.set(P_s_cylinder, _material,
+            record().normal(P_s_cylinder, lazy._part), lazy._t);
+    hit._shape = this;
+    hit._instance = nullptr;
+}
 
-   // vec3 Q_top = (center + glm::vec3(EPSILON, cylinder_divide, EPSILON));
-    vec3 Q_top = (center.y + vec3(EPSILON, cylinder_divide, EPSILON));
-    vec3 Q_bottom = (center - glm::vec3(0, cylinder_divide, 0));
+bool Cylinder::shadows_itself(const Hit& hit, const vec3& L) const {
+    const vec3& point = hit._position;
 
-    float y = start.y + t * direction.y; // calcuate the y-value for constraint-checking
-    //outside of the circle (the surrounding part of it between the top and bottom)
-    if (y >= center.y - cylinder_divide && y <= center.y + cylinder_divide) {
-        vec3 P_s_cylinder = start + t * direction;
-        vec3 N = normalize(vec3(P_s_cylinder.x, 0, P_s_cylinder.z));
-        hit.set(P_s_cylinder, &_material, N, t);
-        return true;
-    }
+    // Which parts of the cylinder is the point on? On the rim it's
+    // on two of them, and it's lit if it faces the light on either.
+    float half_height = _height / 2;
+    float y = point.y - _center.y;
+    vec3 outward(point.x - _center.x, 0, point.z - _center.z);
+    bool on_top = y >= half_height - EPSILON;
+    bool on_bottom = y <= -half_height + EPSILON;
+    bool on_side = length(outward) >= _radius - EPSILON
+        || (!on_top && !on_bottom);
 
+    if (on_top && L.y >= 0) { return false; }
+    if (on_bottom && L.y <= 0) { return false; }
+    if (on_side && dot(outward, L) >= 0) { return false; }
+    return true;
+}
 
-    float t_top = (center.y + cylinder_divide - start.y) / direction.y;
-    float x_calc = start.x + t_top * direction.x;
-    float z_calc = start.z + t_top * direction.z;
-    bool inside_circle = (x_calc * x_calc + z_calc * z_calc < rad2);
+Bounding_Box Cylinder::bounds() const {
+    vec3 half(_radius, _height / 2, _radius);
+    return Bounding_Box(_center - half, _center + half);
+}
 
-    if (inside_circle) {
-        vec3 P_s_cylinder = start + t_top * direction;
-        hit.set(P_s_cylinder, &_material, normalize(P_s_cylinder - Q_top), t_top);
-        return true;
-    }  
+void Cylinder::translate(const vec3& offset) {
+    _center += offset;
+}
 
-    
-    float t_bottom = (center.y - cylinder_divide - start.y) / direction.y;
-    x_calc = start.x + t_bottom * direction.x, z_calc = start.z + t_bottom * direction.z;
-    bool inside_circle_bottom  = ((x_calc * x_calc + z_calc * z_calc < rad2)); //inside the bottom part of the cylinder (bottom ring)0
-    if (inside_circle_bottom) {
-        vec3 P_s_cylinder = start + t_bottom * direction;
-        hit.set(P_s_cylinder, &_material, normalize(Q_bottom), t_bottom);
-        return true;
-    }
-    return false;
+Cylinder_Record Cylinder::record() const {
+    Cylinder_Record cylinder;
+    cylinder._center = _center;
+    cylinder._radius = _radius;
+    cylinder._height = _height;
+    return cylinder;
 }
 
 
 ostream& operator<<(ostream& os, const Cylinder& c) {
-    os << "Cylinder(\"" << c._name << "\"\n"
+    os << "Cylinder(name=" << c._name << "\n"
        << "         center=" << to_string(c._center) << "\n"
        << "         radius=" << c._radius <<  "\n"
        << "         height=" << c._height << "\n"
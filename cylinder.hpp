@@ -4,6 +4,7 @@
 #include <glm/vec3.hpp>
 #include "shape.hpp"
 #include "hit.hpp"
+#include "shape_records.hpp"
 #include <iostream>
 
 using std::ostream;
@@ -15,12 +16,13 @@ class Cylinder : public virtual Shape {
      * @param center Position of the cylinder's center.
      * @param radius Radius of the cylinder.
      * @param height The height of the cylinder.
-     * @param material Cylinder's material.
+     * @param material Index of the cylinder's material.
+     * @param name Index of the cylinder's name.
      */
     Cylinder(const vec3& center, float radius,
              float height,
-             const Material& material,
-             const string& name);
+             int material,
+             int name);
 
     /** Check if a ray intersects the cylinder.
      * If it does, return true, and set the hit parameter.
@@ -31,7 +33,48 @@ class Cylinder : public virtual Shape {
      * @return true if there is an intersection, false otherwise.
      */
     bool intersects(const vec3& start,
-                    const vec3& direction, Hit& hit);
+                    const vec3& direction, Hit& hit) const;
+
+    /** Check if a ray hits the cylinder closer than hit._t,
+     * without working out the point, normal or material.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if this one is closer.
+     * @return true if the ray hits the cylinder before hit._t.
+     */
+    bool find_hit(const vec3& start, const vec3& direction,
+                  Lazy_Hit& hit) const;
+
+    /** Fill in the hit that find_hit() found.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param lazy What find_hit() set.
+     * @param hit The hit to set.
+     */
+    void finalize_hit(const vec3& start, const vec3& direction,
+                      const Lazy_Hit& lazy, Hit& hit) const;
+
+    /** Get a box that contains the whole cylinder.
+     * @return The cylinder's bounds.
+     */
+    Bounding_Box bounds() const;
+
+    /** Move the cylinder.
+     * @param offset How far to move its center.
+     */
+    void translate(const vec3& offset);
+
+    /** Is the light behind the cylinder's surface at a hit point?
+     * @param hit A hit on the cylinder's surface.
+     * @param L Unit vector from the hit point towards the light.
+     * @return true if the point faces away from the light.
+     */
+    bool shadows_itself(const Hit& hit, const vec3& L) const;
+
+    /** Copy the cylinder's geometry, for accelerators to keep.
+     * @return The cylinder's center, radius and height.
+     */
+    Cylinder_Record record() const;
 
     /** Center of the cylinder */
     vec3 _center;
@@ -0,0 +1,144 @@
+#include "framebuffer.hpp"
+#include "lanes.hpp"
+
+#include <cmath>
+
+// Below this, sRGB is a straight line (12.92 * c), not a curve.
+#define SRGB_LINEAR_LIMIT 0.0031308f
+
+// The order in which the pixels of each 4x4 block round up,
+// as their fractions grow (an ordered dithering, or Bayer, matrix).
+static const int BAYER[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+/* Every channel goes through the same float operations, in the same
+ * order, whether it's in a SIMD lane or not, so it gets the same byte
+ * either way. The sRGB curve, 1.055 * c^(1/2.4) - 0.055, is approximated
+ * from c^(1/2), c^(1/4) and c^(1/8), which are just square roots.
+ */
+
+/** One channel, from its color to its byte. */
+static unsigned char quantize_one(float c, float scale, bool srgb,
+                                  float offset) {
+    c = c * scale;
+    c = (c > 0.0f) ? c : 0.0f;
+    c = (c < 1.0f) ? c : 1.0f;
+    if (srgb) {
+        float s1 = std::sqrt(c);
+        float s2 = std::sqrt(s1);
+        float s3 = std::sqrt(s2);
+        float curve = 0.662002687f * s1 + 0.684122060f * s2
+            - 0.323583601f * s3 - 0.0225411470f * c;
+        c = (c < SRGB_LINEAR_LIMIT) ? 12.92f * c : curve;
+    }
+    c = c * 255.0f + offset;
+    c = (c < 255.0f) ? c : 255.0f;
+    return (unsigned char)(int)c;
+}
+
+#ifdef KERNEL_LANES
+/** Lanes::WIDTH channels at once, like quantize_one(). */
+static void quantize_lanes(const float *in, float scale, bool srgb,
+                           const float *offset, unsigned char *out) {
+    typedef Lanes L;
+    L::F c = L::mul(L::load(in), L::set(scale));
+    c = L::max(c, L::set(0.0f));
+    c = L::min(c, L::set(1.0f));
+    if (srgb) {
+        L::F s1 = L::sqrt(c);
+        L::F s2 = L::sqrt(s1);
+        L::F s3 = L::sqrt(s2);
+        L::F curve = L::sub(L::sub(L::add(L::mul(L::set(0.662002687f), s1),
+                                          L::mul(L::set(0.684122060f), s2)),
+                                   L::mul(L::set(0.323583601f), s3)),
+                            L::mul(L::set(0.0225411470f), c));
+        c = L::select(L::lt(c, L::set(SRGB_LINEAR_LIMIT)),
+                      L::mul(L::set(12.92f), c), curve);
+    }
+    c = L::add(L::mul(c, L::set(255.0f)), L::load(offset));
+    c = L::min(c, L::set(255.0f));
+    L::store_bytes(out, c);
+}
+#endif
+
+Framebuffer::Framebuffer()
+{
+    _layout = ROWS;
+    resize(0, 0);
+}
+
+void Framebuffer::resize(int width, int height) {
+    _width = width;
+    _height = height;
+    int pixels = width * height;
+    _tiles_across = 0;
+    if (_layout == MORTON_TILES) {
+        int tile_size = 1 << FRAMEBUFFER_TILE_BITS;
+        _tiles_across = (width + tile_size - 1) / tile_size;
+        int tiles_down = (height + tile_size - 1) / tile_size;
+        pixels = _tiles_across * tiles_down * tile_size * tile_size;
+    }
+    _rgb.assign(3 * pixels, 0.0f);
+}
+
+void Framebuffer::set_layout(Layout layout) {
+    _layout = layout;
+    resize(_width, _height);
+}
+
+void Framebuffer::clear() {
+    _rgb.assign(_rgb.size(), 0.0f);
+}
+
+void Framebuffer::quantize(float scale, bool srgb, bool dither,
+                           unsigned char *out) const {
+    quantize(0, 0, _width, _height, scale, srgb, dither, out);
+}
+
+void Framebuffer::quantize(int x0, int y0, int x1, int y1, float scale,
+                           bool srgb, bool dither, unsigned char *out) const {
+    int row_size = 3 * (x1 - x0);
+
+    // What to add to each channel of a row, for each row of the
+    // pattern: a fraction of a step (or nothing, without dithering).
+    vector<float> offsets[4];
+    for (int row = 0; row < 4; row++) {
+        offsets[row].assign(row_size, 0.0f);
+        for (int i = 0; dither && i < row_size; i++) {
+            offsets[row][i] = (BAYER[row][(x0 + i / 3) % 4] + 0.5f) / 16.0f;
+        }
+    }
+
+    // With MORTON_TILES, each row is gathered up in here first.
+    vector<float> row;
+    if (_layout != ROWS) { row.resize(row_size); }
+
+    for (int y = y0; y < y1; y++) {
+        const float *in = row.data();
+        if (_layout == ROWS) {
+            in = &_rgb[3 * (y * _width + x0)];
+        } else {
+            for (int x = x0; x < x1; x++) {
+                const float *p = &_rgb[3 * index(x, y)];
+                row[3 * (x - x0)] = p[0];
+                row[3 * (x - x0) + 1] = p[1];
+                row[3 * (x - x0) + 2] = p[2];
+            }
+        }
+        const float *offset = offsets[y % 4].data();
+        unsigned char *row_out = out + (y - y0) * row_size;
+        int i = 0;
+#ifdef KERNEL_LANES
+        for (; i + Lanes::WIDTH <= row_size; i += Lanes::WIDTH) {
+            quantize_lanes(in + i, scale, srgb, offset + i, row_out + i);
+        }
+#endif
+        for (; i < row_size; i++) {
+            row_out[i] = quantize_one(in[i], scale, srgb, offset[i]);
+        }
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef _FRAMEBUFFER_HPP
+#define _FRAMEBUFFER_HPP
+
+#include <glm/vec3.hpp>
+#include <vector>
+
+using glm::vec3;
+using std::vector;
+
+// Morton-ordered framebuffer tiles are 2^this pixels on each side.
+#define FRAMEBUFFER_TILE_BITS 3
+
+class Framebuffer {
+    /** A float RGB image that rendering writes colors into, as they
+     * are, without clamping or rounding them (so it can hold colors
+     * brighter than white, and add up several samples per pixel).
+     * quantize() turns the whole image into 8-bit pixels at once,
+     * as a separate step.
+     */
+ public:
+    /** How the pixels are laid out in memory */
+    enum Layout {
+        /** A row at a time, from the bottom */
+        ROWS,
+        /** In 8x8 tiles, row by row, with each tile's pixels along a
+         * Z-order (Morton) curve, so a block of pixels is close
+         * together in memory, whichever way it's walked */
+        MORTON_TILES
+    };
+
+    /** Constructor.
+     * Makes an empty (0 x 0) image.
+     */
+    Framebuffer();
+
+    /** Change the image's size, and make every pixel black.
+     * @param width Number of columns.
+     * @param height Number of rows.
+     */
+    void resize(int width, int height);
+
+    /** Make every pixel black.
+     */
+    void clear();
+
+    /** Change how the pixels are laid out (ROWS by default),
+     * and make every pixel black.
+     * @param layout The layout.
+     */
+    void set_layout(Layout layout);
+
+    /** Set a pixel's color.
+     * @param x Column.
+     * @param y Row (0 is the bottom).
+     * @param color The color.
+     */
+    void set(int x, int y, const vec3& color) {
+        float *p = &_rgb[3 * index(x, y)];
+        p[0] = color.r;
+        p[1] = color.g;
+        p[2] = color.b;
+    }
+
+    /** Add a color to a pixel (one of several samples).
+     * @param x Column.
+     * @param y Row (0 is the bottom).
+     * @param color The color to add.
+     */
+    void add(int x, int y, const vec3& color) {
+        float *p = &_rgb[3 * index(x, y)];
+        p[0] += color.r;
+        p[1] += color.g;
+        p[2] += color.b;
+    }
+
+    /** Get a pixel's color.
+     * @param x Column.
+     * @param y Row (0 is the bottom).
+     * @return The color.
+     */
+    vec3 get(int x, int y) const {
+        const float *p = &_rgb[3 * index(x, y)];
+        return vec3(p[0], p[1], p[2]);
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    /** Convert the image to 8-bit RGB, several channels at a time
+     * with SIMD instructions (after putting each row back together,
+     * with MORTON_TILES). Each channel is:
+     *   multiplied by scale,
+     *   clamped to [0, 1],
+     *   encoded as sRGB, if srgb is set,
+     *   multiplied by 255,
+     *   dithered with a 4x4 ordered (Bayer) pattern, if dither is set,
+     *   and truncated to an integer.
+     * With scale 1 and no sRGB or dithering, a channel of c becomes
+     * int(c * 255), clamped to [0, 255].
+     * @param scale The exposure, divided by how many samples were
+     *              added into each pixel.
+     * @param srgb Whether to encode the colors as sRGB (with an
+     *             approximation that's within a quarter of a step).
+     * @param dither Whether to dither.
+     * @param out Where to put width * height * 3 bytes: R, G, B for
+     *            each pixel, a row at a time, from the bottom.
+     */
+    void quantize(float scale, bool srgb, bool dither,
+                  unsigned char *out) const;
+
+    /** Convert part of the image to 8-bit RGB, like quantize(), with
+     * the same dithering pattern as the whole image.
+     * @param x0 First column.
+     * @param y0 First row.
+     * @param x1 One past the last column.
+     * @param y1 One past the last row.
+     * @param out Where to put (x1 - x0) * (y1 - y0) * 3 bytes, a row
+     *            at a time, from the bottom.
+     */
+    void quantize(int x0, int y0, int x1, int y1, float scale, bool srgb,
+                  bool dither, unsigned char *out) const;
+
+ private:
+    /** Where a pixel is in the image, in pixels (see Layout).
+     * @param x Column.
+     * @param y Row.
+     * @return The index.
+     */
+    int index(int x, int y) const {
+        if (_layout == ROWS) { return y * _width + x; }
+        const int mask = (1 << FRAMEBUFFER_TILE_BITS) - 1;
+        int tile = (y >> FRAMEBUFFER_TILE_BITS) * _tiles_across
+            + (x >> FRAMEBUFFER_TILE_BITS);
+        return (tile << (2 * FRAMEBUFFER_TILE_BITS))
+            | spread_bits(x & mask) | (spread_bits(y & mask) << 1);
+    }
+
+    /** Spread a number's bits out to every other bit (0, 2, 4 ...). */
+    static int spread_bits(int v) {
+        int spread = 0;
+        for (int bit = 0; bit < FRAMEBUFFER_TILE_BITS; bit++) {
+            spread |= ((v >> bit) & 1) << (2 * bit);
+        }
+        return spread;
+    }
+
+    int _width;
+    int _height;
+    Layout _layout;
+    /** Tiles across the image (for MORTON_TILES) */
+    int _tiles_across;
+    /** R, G and B for each pixel, in the layout's order (with
+     * MORTON_TILES, the tiles on the edges are padded out) */
+    vector<float> _rgb;
+};
+
+#endif
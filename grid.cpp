@@ -0,0 +1,242 @@
+#include "grid.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+using std::numeric_limits;
+
+// The grid has about this many cells per shape...
+#define CELLS_PER_SHAPE 3
+// ...but never more than this many along one axis.
+#define MAX_RESOLUTION 128
+
+// Every grid gets its own id, so that the mailboxes
+// can tell when they're stale.
+static std::atomic<int> next_grid_id(0);
+
+// Which ray last tested each shape. Shapes that overlap several
+// cells are then only tested once per ray.
+// One per thread, so that threads never share it.
+struct Mailbox {
+    int _grid_id = -1;
+    unsigned _ray = 0;
+    vector<unsigned> _stamps;
+};
+static thread_local Mailbox mailbox;
+
+// Get this thread's mailbox ready for a new ray.
+static Mailbox& open_mailbox(int grid_id, int num_shapes) {
+    Mailbox& box = mailbox;
+    box._ray++;
+    if (box._grid_id != grid_id || box._ray == 0) {
+        box._grid_id = grid_id;
+        box._ray = 1;
+        box._stamps.assign(num_shapes, 0);
+    }
+    return box;
+}
+
+Grid::Grid() {
+    _resolution[0] = _resolution[1] = _resolution[2] = 0;
+    _id = next_grid_id++;
+}
+
+int Grid::cell_coordinate(float value, int axis) const {
+    int c = (int)((value - _box._min[axis]) / _cell_size[axis]);
+    return std::max(0, std::min(c, _resolution[axis] - 1));
+}
+
+int Grid::cell_index(const int cell[3]) const {
+    return (cell[2] * _resolution[1] + cell[1]) * _resolution[0] + cell[0];
+}
+
+void Grid::build(const vector<Shape*>& shapes) {
+    _id = next_grid_id++;
+    _shapes = shapes;
+    _cell_start.clear();
+    _cell_shapes.clear();
+    _box = Bounding_Box();
+    _resolution[0] = _resolution[1] = _resolution[2] = 0;
+    if (shapes.empty()) { return; }
+
+    vector<Bounding_Box> boxes(shapes.size());
+    for (int i = 0; i < (int)shapes.size(); i++) {
+        boxes[i] = shapes[i]->bounds();
+        _box.expand(boxes[i]);
+    }
+
+    // Give flat scenes some thickness, so no axis has zero-size cells.
+    vec3 extent = _box.extent();
+    float max_width = std::max(extent.x, std::max(extent.y, extent.z));
+    float min_width = (max_width > 0) ? 1e-4f * max_width : 1e-4f;
+    for (int axis = 0; axis < 3; axis++) {
+        if (extent[axis] < min_width) {
+            _box._min[axis] -= min_width;
+            _box._max[axis] += min_width;
+        }
+    }
+    extent = _box.extent();
+    max_width = std::max(extent.x, std::max(extent.y, extent.z));
+
+    float cells_per_unit = CELLS_PER_SHAPE
+        * std::cbrt((float)shapes.size()) / max_width;
+    int num_cells = 1;
+    for (int axis = 0; axis < 3; axis++) {
+        int res = (int)std::round(extent[axis] * cells_per_unit);
+        _resolution[axis] = std::max(1, std::min(res, MAX_RESOLUTION));
+        _cell_size[axis] = extent[axis] / _resolution[axis];
+        num_cells *= _resolution[axis];
+    }
+
+    // Count the shapes in each cell, turn the counts into
+    // starting positions, and then fill in the lists.
+    vector<int> lo(3 * shapes.size()), hi(3 * shapes.size());
+    _cell_start.assign(num_cells + 1, 0);
+    for (int i = 0; i < (int)shapes.size(); i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            lo[3 * i + axis] = cell_coordinate(boxes[i]._min[axis], axis);
+            hi[3 * i + axis] = cell_coordinate(boxes[i]._max[axis], axis);
+        }
+        int cell[3];
+        for (cell[2] = lo[3 * i + 2]; cell[2] <= hi[3 * i + 2]; cell[2]++)
+            for (cell[1] = lo[3 * i + 1]; cell[1] <= hi[3 * i + 1]; cell[1]++)
+                for (cell[0] = lo[3 * i]; cell[0] <= hi[3 * i]; cell[0]++)
+                    _cell_start[cell_index(cell) + 1]++;
+    }
+    for (int c = 0; c < num_cells; c++) {
+        _cell_start[c + 1] += _cell_start[c];
+    }
+
+    _cell_shapes.resize(_cell_start[num_cells]);
+    vector<int> fill(_cell_start.begin(), _cell_start.end() - 1);
+    for (int i = 0; i < (int)shapes.size(); i++) {
+        int cell[3];
+        for (cell[2] = lo[3 * i + 2]; cell[2] <= hi[3 * i + 2]; cell[2]++)
+            for (cell[1] = lo[3 * i + 1]; cell[1] <= hi[3 * i + 1]; cell[1]++)
+                for (cell[0] = lo[3 * i]; cell[0] <= hi[3 * i]; cell[0]++)
+                    _cell_shapes[fill[cell_index(cell)]++] = i;
+    }
+}
+
+bool Grid::begin_walk(const vec3& start, const vec3& direction,
+                      float t_max, Walk& walk) const {
+    if (_shapes.empty()) { return false; }
+
+    vec3 inv_direction = 1.0f / direction;
+    float t_enter;
+    if (!_box.intersects(start, inv_direction, t_max, t_enter)) {
+        return false;
+    }
+
+    vec3 entry = start + t_enter * direction;
+    float infinity = numeric_limits<float>::infinity();
+    for (int axis = 0; axis < 3; axis++) {
+        int c = cell_coordinate(entry[axis], axis);
+        walk._cell[axis] = c;
+        if (direction[axis] > 0) {
+            walk._step[axis] = 1;
+            float boundary = _box._min[axis] + (c + 1) * _cell_size[axis];
+            walk._t_next[axis] = (boundary - start[axis]) * inv_direction[axis];
+            walk._t_delta[axis] = _cell_size[axis] * inv_direction[axis];
+        } else if (direction[axis] < 0) {
+            walk._step[axis] = -1;
+            float boundary = _box._min[axis] + c * _cell_size[axis];
+            walk._t_next[axis] = (boundary - start[axis]) * inv_direction[axis];
+            walk._t_delta[axis] = -_cell_size[axis] * inv_direction[axis];
+        } else {
+            walk._step[axis] = 0;
+            walk._t_next[axis] = infinity;
+            walk._t_delta[axis] = infinity;
+        }
+    }
+    return true;
+}
+
+float Grid::cell_exit(const Walk& walk) const {
+    return std::min(walk._t_next[0],
+                    std::min(walk._t_next[1], walk._t_next[2]));
+}
+
+bool Grid::next_cell(Walk& walk) const {
+    int axis = 0;
+    if (walk._t_next[1] < walk._t_next[axis]) { axis = 1; }
+    if (walk._t_next[2] < walk._t_next[axis]) { axis = 2; }
+    if (walk._step[axis] == 0) { return false; }
+
+    walk._cell[axis] += walk._step[axis];
+    if (walk._cell[axis] < 0 || walk._cell[axis] >= _resolution[axis]) {
+        return false;
+    }
+    walk._t_next[axis] += walk._t_delta[axis];
+    return true;
+}
+
+bool Grid::first_hit(const vec3& start, const vec3& direction,
+                     float t_max, Hit& hit) const {
+    Walk walk;
+    if (!begin_walk(start, direction, t_max, walk)) { return false; }
+
+    Mailbox& box = open_mailbox(_id, (int)_shapes.size());
+    Lazy_Hit nearest(t_max);
+    bool found = false;
+    while (true) {
+        int cell = cell_index(walk._cell);
+        for (int k = _cell_start[cell]; k < _cell_start[cell + 1]; k++) {
+            int s = _cell_shapes[k];
+            if (box._stamps[s] == box._ray) { continue; }
+            box._stamps[s] = box._ray;
+
+            if (_shapes[s]->find_hit(start, direction, nearest)) {
+                found = true;
+            }
+        }
+
+        // A hit inside this cell is closer than anything in later cells.
+        // (Hits in later cells, from shapes that overlap this one, are
+        // already in nearest, so the mailboxes never lose them.)
+        if (nearest._t <= cell_exit(walk)) { break; }
+        if (!next_cell(walk)) { break; }
+    }
+    if (found) { nearest.finalize(start, direction, hit); }
+    return found;
+}
+
+Shape *Grid::any_hit(const vec3& start, const vec3& direction,
+                     float t_max, const Shape *skip) const {
+    Walk walk;
+    if (!begin_walk(start, direction, t_max, walk)) { return nullptr; }
+
+    Mailbox& box = open_mailbox(_id, (int)_shapes.size());
+    while (true) {
+        int cell = cell_index(walk._cell);
+        for (int k = _cell_start[cell]; k < _cell_start[cell + 1]; k++) {
+            int s = _cell_shapes[k];
+            if (box._stamps[s] == box._ray) { continue; }
+            box._stamps[s] = box._ray;
+
+            Shape *shape = _shapes[s];
+            if (shape != skip
+                && shape->occludes(start, direction, t_max, skip)) {
+                return shape;
+            }
+        }
+
+        if (t_max <= cell_exit(walk)) { break; }
+        if (!next_cell(walk)) { break; }
+    }
+    return nullptr;
+}
+
+void Grid::print_stats(ostream& os) const {
+    int num_cells = (int)_cell_start.size() - 1;
+    int empty = 0;
+    for (int c = 0; c < num_cells; c++) {
+        if (_cell_start[c] == _cell_start[c + 1]) { empty++; }
+    }
+    os << "Grid: " << _shapes.size() << " shapes, "
+       << _resolution[0] << "x" << _resolution[1] << "x" << _resolution[2]
+       << " cells (" << empty << " empty), "
+       << _cell_shapes.size() << " shape references";
+}
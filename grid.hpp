@@ -0,0 +1,113 @@
+#ifndef _GRID_HPP
+#define _GRID_HPP
+
+#include <glm/vec3.hpp>
+#include <vector>
+#include "accelerator.hpp"
+#include "bounding_box.hpp"
+#include "shape.hpp"
+#include "hit.hpp"
+
+using glm::vec3;
+using std::vector;
+
+class Grid : public Accelerator {
+    /** A uniform grid of cells over the scene.
+     * Each cell lists the shapes whose bounds overlap it, and rays
+     * step from cell to cell in the order they pass through them
+     * (3D-DDA). Cheap to build, and fast when the shapes are all
+     * about the same size and spread evenly through the scene.
+     */
+ public:
+    /** Constructor.
+     * Makes an empty grid, which nothing can hit.
+     */
+    Grid();
+
+    /** Build the grid, throwing away any previous one.
+     * @param shapes The shapes to put in the grid.
+     */
+    void build(const vector<Shape*>& shapes);
+
+    /** Finds the closest hit along a ray.
+     * Walks the cells front to back, and stops in the first cell
+     * that contains a hit. A shape that overlaps several cells is
+     * only tested once per ray ("mailboxing").
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits further than this don't count.
+     * @param hit Hit record, which will be set if there's a hit.
+     * @return true/false if the ray does/doesn't hit some Shape.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   float t_max, Hit& hit) const;
+
+    /** Finds some shape that blocks a ray (used for shadows).
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore (the one the ray starts on), or nullptr.
+     * @return The blocking shape, or nullptr if nothing blocks the ray.
+     */
+    Shape *any_hit(const vec3& start, const vec3& direction,
+                   float t_max, const Shape *skip) const;
+
+    /** Print the resolution and how full the cells are.
+     * @param os The stream.
+     */
+    void print_stats(ostream& os) const;
+
+ private:
+    struct Walk {
+        /** The current cell */
+        int _cell[3];
+        /** +1 or -1: which way the ray steps along each axis */
+        int _step[3];
+        /** Ray distance to the next cell boundary on each axis */
+        float _t_next[3];
+        /** Ray distance between cell boundaries on each axis */
+        float _t_delta[3];
+    };
+
+    /** Find the first cell a ray visits.
+     * @return false if the ray misses the grid before t_max.
+     */
+    bool begin_walk(const vec3& start, const vec3& direction,
+                    float t_max, Walk& walk) const;
+
+    /** Step to the next cell along the ray.
+     * @return false if the ray has left the grid.
+     */
+    bool next_cell(Walk& walk) const;
+
+    /** Ray distance where the ray leaves the current cell.
+     */
+    float cell_exit(const Walk& walk) const;
+
+    /** Index of the cell at (x, y, z), in _cell_start.
+     */
+    int cell_index(const int cell[3]) const;
+
+    /** Which cell (along one axis) contains a coordinate,
+     * clamped to the grid.
+     */
+    int cell_coordinate(float value, int axis) const;
+
+    /** Bounds of the whole grid */
+    Bounding_Box _box;
+    /** Number of cells along each axis */
+    int _resolution[3];
+    /** Size of one cell */
+    vec3 _cell_size;
+    /** The shapes in cell i are _cell_shapes[_cell_start[i]]
+     * up to (not including) _cell_shapes[_cell_start[i + 1]].
+     */
+    vector<int> _cell_start;
+    /** Indexes into _shapes, cell by cell */
+    vector<int> _cell_shapes;
+    vector<Shape*> _shapes;
+    /** Tells the per-thread mailboxes which grid they belong to */
+    int _id;
+};
+
+#endif
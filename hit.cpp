@@ -1,15 +1,35 @@
 #include "hit.hpp"
 
 Hit::Hit()
-    : _t(-1)
+    : _material(NO_MATERIAL), _t(-1), _shape(nullptr), _instance(nullptr)
 {
     ;
 }
 
-void Hit::set(const vec3& position, const Material *material,
+void Hit::set(const vec3& position, int material,
               const vec3& normal, float t) {
     _position = position;
     _material = material;
     _normal = normal;
     _t = t;
 }
+
+Lazy_Hit::Lazy_Hit(float t_max)
+    : _t(t_max), _shape(nullptr), _part(0), _instance(nullptr)
+{
+    ;
+}
+
+void Lazy_Hit::set(float t, const Shape *shape, int part) {
+    _t = t;
+    _shape = shape;
+    _part = part;
+    _instance = nullptr;
+}
+
+void Lazy_Hit::finalize(const vec3& start, const vec3& direction,
+                        Hit& hit) const {
+    // An instance works out the hit on its prototype's shape itself.
+    const Shape *shape = (_instance != nullptr) ? _instance : _shape;
+    shape->finalize_hit(start, direction, *this, hit);
+}
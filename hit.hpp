@@ -3,6 +3,7 @@
 
 #include "shape.hpp"
 #include "material.hpp"
+#include <limits>
 
 using glm::vec3;
 
@@ -16,21 +17,63 @@ class Hit {
 
     /** Store information.
      * @param position Intersection point.
-     * @param material Material of the intersection.
+     * @param material Index of the intersection's material.
      * @param normal Surface normal at the intersection.
      * @param t Ray distance at the intersection.
      */
-    void set(const vec3& position, const Material *material,
+    void set(const vec3& position, int material,
              const vec3& normal, float t);
 
     /** Intersection point */
     vec3 _position;
     /** Surface normal */
     vec3 _normal;
-    /** Material of the intersection */
-    const Material *_material;
+    /** Index of the intersection's material, in the scene's
+     * Material_Table (NO_MATERIAL if there's no hit) */
+    int _material;
     /** Ray distance */
     float _t;
+    /** The shape that was hit (inside an instance: the prototype's shape) */
+    const Shape *_shape;
+    /** The instance that _shape belongs to, or nullptr */
+    const Shape *_instance;
+};
+
+class Lazy_Hit {
+    /** The closest hit found so far along a ray, while searching:
+     * just how far away it is, and what was hit. The rest of the
+     * Hit (the point, normal and material) is only worked out once,
+     * by finalize(), for the hit that ends up closest.
+     */
+ public:
+    /** Constructor.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     */
+    Lazy_Hit(float t_max = std::numeric_limits<float>::infinity());
+
+    /** Store a closer hit, on a shape that isn't in an instance.
+     * @param t Ray distance at the intersection.
+     * @param shape The shape that was hit.
+     * @param part Which part of the shape was hit.
+     */
+    void set(float t, const Shape *shape, int part);
+
+    /** Fill in the whole hit, with Shape::finalize_hit().
+     * Only call this if some shape has set the hit.
+     * @param start The ray's starting point, as the search used.
+     * @param direction The ray's direction vector, as the search used.
+     * @param hit The hit to set.
+     */
+    void finalize(const vec3& start, const vec3& direction, Hit& hit) const;
+
+    /** Ray distance: of the closest hit, or t_max until there is one */
+    float _t;
+    /** The shape that was hit (inside an instance: the prototype's shape) */
+    const Shape *_shape;
+    /** Which part of the shape was hit (for shapes with several surfaces) */
+    int _part;
+    /** The instance that _shape belongs to, or nullptr */
+    const Shape *_instance;
 };
 
 #endif
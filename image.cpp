@@ -6,6 +6,7 @@
 #include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <utility>
 
 using std::cout;
 using std::endl;
@@ -27,16 +28,6 @@ Image::Image(const string& file_name) {
     std::copy(data, data + num_pixels, _pixels.begin());
 }
 
-Image::Image(GLFWwindow *window) {
-    glfwGetFramebufferSize(window, &_width, &_height);
-    _depth = 3;
-    _pixels = vector<unsigned char>();
-    int num_pixels = _width * _height * _depth;
-    _pixels.reserve(num_pixels);
-    glReadPixels(0, 0, _width, _height, GL_RGB, GL_UNSIGNED_BYTE,
-                 _pixels.data());
-}
-
 Image::Image(const vector<unsigned char>& pixels,
              int width, int height, int depth,
              const string& name)
@@ -50,6 +41,14 @@ Image::Image(const vector<unsigned char>& pixels,
     //           << std::endl;
 }
 
+Image::Image(vector<unsigned char>&& pixels,
+             int width, int height, int depth,
+             const string& name)
+    : _pixels(std::move(pixels)), _width(width), _height(height),
+      _depth(depth), _name(name) {
+    ;
+}
+
 Image::~Image() {
     ; // nothing to do.  _pixels will auto-delete its buffer
 }
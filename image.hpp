@@ -30,6 +30,16 @@ class Image {
     Image(const vector<unsigned char>& pixels, int width, int height, int depth,
           const string& name);
 
+    /** Construct from pixels, taking them over instead of copying them.
+     * @param pixels The pixels, a one-dimensional array (left empty).
+     * @param width Width of the image.
+     * @param height Height of the image.
+     * @param depth Number of values per pixel.
+     * @param name Name of the image (for debugging)
+     */
+    Image(vector<unsigned char>&& pixels, int width, int height, int depth,
+          const string& name);
+
     /** Construct from pixels on the default framebuffer.
      * @param window The window whose pixels we'll read.
      */
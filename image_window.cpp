@@ -0,0 +1,13 @@
+// The one Image constructor that needs OpenGL, kept apart so that
+// programs that only write images (caster_bench) don't link GL.
+#include "image.hpp"
+
+Image::Image(GLFWwindow *window) {
+    glfwGetFramebufferSize(window, &_width, &_height);
+    _depth = 3;
+    _pixels = vector<unsigned char>();
+    int num_pixels = _width * _height * _depth;
+    _pixels.reserve(num_pixels);
+    glReadPixels(0, 0, _width, _height, GL_RGB, GL_UNSIGNED_BYTE,
+                 _pixels.data());
+}
@@ -0,0 +1,117 @@
+#include "instance.hpp"
+#include "ray_trace.hpp"
+#include <glm/vec4.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtx/string_cast.hpp>
+
+using glm::vec4;
+using glm::inverse;
+using glm::transpose;
+using glm::normalize;
+using glm::to_string;
+using std::endl;
+
+Instance::Instance(const SP_Prototype& prototype, const mat4& object_to_world,
+                   int name)
+    : Shape(NO_MATERIAL, name), _prototype(prototype),
+      _object_to_world(object_to_world)
+{
+    _world_to_object = inverse(object_to_world);
+    _direction_to_object = mat3(_world_to_object);
+    _normal_to_world = transpose(_direction_to_object);
+}
+
+bool Instance::intersects(const vec3& start, const vec3& direction,
+                          Hit& hit) const {
+    Lazy_Hit lazy;
+    if (!find_hit(start, direction, lazy)) { return false; }
+    finalize_hit(start, direction, lazy, hit);
+    return true;
+}
+
+bool Instance::find_hit(const vec3& start, const vec3& direction,
+                        Lazy_Hit& hit) const {
+    // The direction isn't re-normalized, so t is the same in both spaces.
+    vec3 object_start = vec3(_world_to_object * vec4(start, 1));
+    vec3 object_direction = _direction_to_object * direction;
+
+    if (!_prototype->first_hit(object_start, object_direction, hit)) {
+        return false;
+    }
+    hit._instance = this;
+    return true;
+}
+
+void Instance::finalize_hit(const vec3& start, const vec3& direction,
+                            const Lazy_Hit& lazy, Hit& hit) const {
+    vec3 object_start = vec3(_world_to_object * vec4(start, 1));
+    vec3 object_direction = _direction_to_object * direction;
+
+    Lazy_Hit object_lazy = lazy;
+    object_lazy._instance = nullptr;
+    Hit object_hit;
+    object_lazy.finalize(object_start, object_direction, object_hit);
+
+    float t = lazy._t;
+    hit.set(start + t * direction, object_hit._material,
+            normalize(_normal_to_world * object_hit._normal), t);
+    hit._shape = object_hit._shape;
+    hit._instance = this;
+}
+
+bool Instance::trace_hit(const vec3& start, const vec3& direction,
+                         Lazy_Hit& hit, Ray_Trace& trace) const {
+    vec3 object_start = vec3(_world_to_object * vec4(start, 1));
+    vec3 object_direction = _direction_to_object * direction;
+
+    trace.enter(this);
+    bool found = _prototype->trace_hit(object_start, object_direction,
+                                       hit, trace);
+    trace.leave();
+    if (!found) { return false; }
+    hit._instance = this;
+    return true;
+}
+
+bool Instance::occludes(const vec3& start, const vec3& direction, float t_max,
+                        const Shape *skip) const {
+    vec3 object_start = vec3(_world_to_object * vec4(start, 1));
+    vec3 object_direction = _direction_to_object * direction;
+    return _prototype->any_hit(object_start, object_direction,
+                               t_max, skip) != nullptr;
+}
+
+bool Instance::shadows_itself(const Hit& hit, const vec3& L) const {
+    Hit object_hit = hit;
+    object_hit._position = vec3(_world_to_object * vec4(hit._position, 1));
+    object_hit._instance = nullptr;
+    vec3 object_L = normalize(_direction_to_object * L);
+    return hit._shape->shadows_itself(object_hit, object_L);
+}
+
+Bounding_Box Instance::bounds() const {
+    Bounding_Box object_box = _prototype->bounds();
+    Bounding_Box box;
+    if (object_box.is_empty()) { return box; }
+    for (int corner = 0; corner < 8; corner++) {
+        vec3 p((corner & 1) ? object_box._max.x : object_box._min.x,
+               (corner & 2) ? object_box._max.y : object_box._min.y,
+               (corner & 4) ? object_box._max.z : object_box._min.z);
+        box.expand(vec3(_object_to_world * vec4(p, 1)));
+    }
+    return box;
+}
+
+void Instance::translate(const vec3& offset) {
+    // Only the translation changes, so the direction and normal matrices stay.
+    _object_to_world[3] += vec4(offset, 0);
+    _world_to_object = inverse(_object_to_world);
+}
+
+ostream& operator<<(ostream& os, const Instance& i) {
+    os << "Instance(name=" << i._name << "\n"
+       << "         prototype=" << i._prototype->_name
+       << " (" << i._prototype->size() << " shapes)\n"
+       << "         transform=" << to_string(i._object_to_world) << ")";
+    return os;
+}
@@ -0,0 +1,122 @@
+#ifndef _INSTANCE_HPP
+#define _INSTANCE_HPP
+
+#include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
+#include <glm/mat4x4.hpp>
+#include <iostream>
+#include "shape.hpp"
+#include "hit.hpp"
+#include "prototype.hpp"
+
+using glm::vec3;
+using glm::mat3;
+using glm::mat4;
+using std::ostream;
+
+class Instance : public virtual Shape {
+    /** A Prototype placed in the scene by an affine transform.
+     * Rays are transformed into the prototype's object coordinates,
+     * and searched for in the prototype's own BVH. Many instances
+     * can share one prototype, and the transform can rotate, so
+     * this also gives cylinders that aren't lined up with the Y axis.
+     */
+ public:
+    /** Constructor.
+     * @param prototype The shapes to place.
+     * @param object_to_world Transform from the prototype's
+     *                        coordinates to world coordinates.
+     * @param name Index of the instance's name.
+     */
+    Instance(const SP_Prototype& prototype, const mat4& object_to_world,
+             int name);
+
+    /** Check if a ray intersects one of the prototype's shapes.
+     * If it does, return true, and set the hit parameter,
+     * in world coordinates. Its _shape is the prototype's shape,
+     * and its _instance is this instance.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit A Hit object. Call its .set() method if there's an intersection
+     * @return true if there is an intersection, false otherwise.
+     */
+    bool intersects(const vec3& start,
+                    const vec3& direction, Hit& hit) const;
+
+    /** Check if a ray hits one of the prototype's shapes closer than
+     * hit._t, without working out the point, normal or material.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far. If this one is closer, its
+     *            _shape is set to the prototype's shape, and its
+     *            _instance to this instance.
+     * @return true if the ray hits the instance before hit._t.
+     */
+    bool find_hit(const vec3& start, const vec3& direction,
+                  Lazy_Hit& hit) const;
+
+    /** Fill in the hit that find_hit() found, in world coordinates.
+     * The prototype's shape fills it in, in object coordinates.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param lazy What find_hit() set.
+     * @param hit The hit to set.
+     */
+    void finalize_hit(const vec3& start, const vec3& direction,
+                      const Lazy_Hit& lazy, Hit& hit) const;
+
+    /** Same as find_hit(), tracing each of the prototype's shapes
+     * (in object coordinates), between the trace's enter() and leave().
+     */
+    bool trace_hit(const vec3& start, const vec3& direction,
+                   Lazy_Hit& hit, Ray_Trace& trace) const;
+
+    /** Get a box that contains the whole transformed prototype.
+     * @return The instance's bounds, in world coordinates.
+     */
+    Bounding_Box bounds() const;
+
+    /** Move the instance, in world coordinates.
+     * @param offset How far to move it.
+     */
+    void translate(const vec3& offset);
+
+    /** Does one of the prototype's shapes block the ray before t_max?
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A prototype shape to ignore (the one the ray starts on).
+     * @return true if the ray hits the instance before t_max.
+     */
+    bool occludes(const vec3& start, const vec3& direction, float t_max,
+                  const Shape *skip) const;
+
+    /** Does the prototype's shape that was hit shadow itself?
+     * @param hit A hit on this instance.
+     * @param L Unit vector from the hit point towards the light.
+     * @return true if the hit shape faces away from the light.
+     */
+    bool shadows_itself(const Hit& hit, const vec3& L) const;
+
+    /** The shapes being placed */
+    SP_Prototype _prototype;
+    /** Prototype coordinates to world coordinates */
+    mat4 _object_to_world;
+
+    /** Output to stream (for debugging).
+     * @param os The stream
+     * @param i An Instance
+     * @return the stream, after output.
+     */
+    friend ostream& operator<<(ostream& os, const Instance& i);
+
+ private:
+    /** World coordinates to prototype coordinates */
+    mat4 _world_to_object;
+    /** The 3x3 part of _world_to_object, for directions */
+    mat3 _direction_to_object;
+    /** Transforms prototype normals to world normals */
+    mat3 _normal_to_world;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef _LANES_HPP
+#define _LANES_HPP
+
+#include <cstring>
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* "Lanes": one float per item (a primitive, say, or a pixel's channel),
+ * as many items as fit in a SIMD register. Each instruction set gets
+ * the same small set of operations, and SIMD code is written once, in
+ * terms of them. KERNEL_LANES names the instruction set; without one,
+ * it isn't defined, and there is no Lanes.
+ *
+ * min(a, b) and max(a, b) give b where a is a NaN, like the scalar
+ * (a < b) ? a : b and (a > b) ? a : b.
+ * store_bytes() truncates each lane to an integer, and stores it as
+ * one byte; lanes must already be in [0, 255].
+ */
+
+#if defined(__AVX512F__)
+#define KERNEL_LANES "avx512"
+struct Lanes {
+    static const int WIDTH = 16;
+    typedef __m512 F;
+    typedef __mmask16 Mask;
+    static F set(float x) { return _mm512_set1_ps(x); }
+    static F load(const float *p) { return _mm512_loadu_ps(p); }
+    static void store(float *p, F a) { _mm512_storeu_ps(p, a); }
+    static F add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+    static F min(F a, F b) { return _mm512_min_ps(a, b); }
+    static F max(F a, F b) { return _mm512_max_ps(a, b); }
+    static F neg(F a) {
+        return _mm512_castsi512_ps(_mm512_xor_si512(
+            _mm512_castps_si512(a), _mm512_set1_epi32((int)0x80000000)));
+    }
+    static Mask ge(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+    static Mask le(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+    static Mask lt(F a, F b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+    static Mask both(Mask a, Mask b) { return a & b; }
+    static Mask either(Mask a, Mask b) { return a | b; }
+    static F select(Mask m, F a, F b) { return _mm512_mask_blend_ps(m, b, a); }
+    static int bits(Mask m) { return (int)m; }
+    static void store_bytes(unsigned char *p, F a) {
+        __m128i bytes = _mm512_cvtusepi32_epi8(_mm512_cvttps_epi32(a));
+        _mm_storeu_si128((__m128i*)p, bytes);
+    }
+};
+#elif defined(__AVX__)
+#define KERNEL_LANES "avx"
+struct Lanes {
+    static const int WIDTH = 8;
+    typedef __m256 F;
+    typedef __m256 Mask;
+    static F set(float x) { return _mm256_set1_ps(x); }
+    static F load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, F a) { _mm256_storeu_ps(p, a); }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+    static F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static F neg(F a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+    static Mask ge(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static Mask le(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static Mask lt(F a, F b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+    static Mask both(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+    static Mask either(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+    static F select(Mask m, F a, F b) { return _mm256_blendv_ps(b, a, m); }
+    static int bits(Mask m) { return _mm256_movemask_ps(m); }
+    static void store_bytes(unsigned char *p, F a) {
+        // AVX has no 256-bit integer packing, so pack the two halves.
+        __m256i ints = _mm256_cvttps_epi32(a);
+        __m128i shorts = _mm_packs_epi32(_mm256_castsi256_si128(ints),
+                                         _mm256_extractf128_si256(ints, 1));
+        _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(shorts, shorts));
+    }
+};
+#elif defined(__SSE2__)
+#define KERNEL_LANES "sse2"
+struct Lanes {
+    static const int WIDTH = 4;
+    typedef __m128 F;
+    typedef __m128 Mask;
+    static F set(float x) { return _mm_set1_ps(x); }
+    static F load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, F a) { _mm_storeu_ps(p, a); }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F sqrt(F a) { return _mm_sqrt_ps(a); }
+    static F min(F a, F b) { return _mm_min_ps(a, b); }
+    static F max(F a, F b) { return _mm_max_ps(a, b); }
+    static F neg(F a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    // These compares are false if either side is a NaN.
+    static Mask ge(F a, F b) { return _mm_cmpge_ps(a, b); }
+    static Mask le(F a, F b) { return _mm_cmple_ps(a, b); }
+    static Mask lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+    static Mask both(Mask a, Mask b) { return _mm_and_ps(a, b); }
+    static Mask either(Mask a, Mask b) { return _mm_or_ps(a, b); }
+    static F select(Mask m, F a, F b) {
+        return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+    }
+    static int bits(Mask m) { return _mm_movemask_ps(m); }
+    static void store_bytes(unsigned char *p, F a) {
+        __m128i ints = _mm_cvttps_epi32(a);
+        __m128i shorts = _mm_packs_epi32(ints, ints);
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(shorts, shorts));
+        std::memcpy(p, &bytes, sizeof(bytes));
+    }
+};
+#endif
+
+#endif
@@ -9,7 +9,11 @@ c_files = $(LOCAL_ROOT)/deps/glad.c
 INCLUDES = -I$(glad_inc) -I/usr/local/include -I$(LOCAL_ROOT)/include
 
 CFLAGS = -Wall -ggdb -g $(INCLUDES)
-CXXFLAGS = -Wall -ggdb -g $(INCLUDES)
+# The SIMD shape kernels give the same answers as the scalar code
+# only if multiplies and adds aren't fused.
+CXXFLAGS = -Wall -ggdb -g -ffp-contract=off $(INCLUDES)
 
 LIBRARIES = -L$(LOCAL_ROOT)/lib
-LDFLAGS = $(LIBRARIES) -lglfw3dll -lopengl32
+LDFLAGS = $(LIBRARIES) -lglfw3dll -lopengl32 -pthread
+# caster_bench never opens a window, so it doesn't link GLFW or OpenGL.
+BENCH_LDFLAGS = -pthread
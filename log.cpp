@@ -1,6 +1,5 @@
 #include "log.hpp"
 
-int Log::LEVEL = 0;
 std::ostream *Log::stream = &std::cout;
 
 void Log::set_output(std::ostream& stream) {
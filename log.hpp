@@ -6,8 +6,6 @@
 class Log {
     /** An extremely simple logging system. */
  public:
-    /** Log level.  Typically if LEVEL > 0, you should output something. */
-    static int LEVEL;
     /** Pointer to the stream where output should go.*/
     static std::ostream *stream;
     /** Redefine the output stream */
@@ -8,14 +8,53 @@ Material::Material() {
     _diffuse_reflectance = vec3(0.5, 0.5, 0.5);
     _specular_reflectance = vec3(0.5, 0.5, 0.5);
     _shininess = 10;
-    _name = "NO NAME";
+}
+
+bool Material::operator==(const Material& other) const {
+    return _ambient_reflectance == other._ambient_reflectance
+        && _diffuse_reflectance == other._diffuse_reflectance
+        && _specular_reflectance == other._specular_reflectance
+        && _shininess == other._shininess;
 }
 
 ostream& operator<<(ostream& os, const Material& mat) {
-    os << "Material(\"" << mat._name << "\"\n"
-       << "         ka=" << to_string(mat._ambient_reflectance) << "\n"
+    os << "Material(ka=" << to_string(mat._ambient_reflectance) << "\n"
        << "         kd=" << to_string(mat._diffuse_reflectance) << "\n"
        << "         ks=" << to_string(mat._specular_reflectance) << "\n"
        << "         n=" << mat._shininess << ")";
     return os;
 }
+
+Material_Table::Material_Table() {
+    add(Material(), "NO NAME");
+}
+
+int Material_Table::add(const Material& material, const string& name) {
+    // Scenes have few materials, so a search is quick enough.
+    for (int i = 0; i < (int)_materials.size(); i++) {
+        if (_materials[i] == material) { return i; }
+    }
+    _materials.push_back(material);
+    _names.push_back(name);
+    return (int)_materials.size() - 1;
+}
+
+const string& Material_Table::name(int index) const {
+    return _names[index];
+}
+
+int Material_Table::size() const {
+    return (int)_materials.size();
+}
+
+size_t Material_Table::material_bytes() const {
+    return _materials.capacity() * sizeof(Material);
+}
+
+size_t Material_Table::name_bytes() const {
+    size_t bytes = _names.capacity() * sizeof(string);
+    for (const string& name : _names) {
+        bytes += name.capacity();
+    }
+    return bytes;
+}
@@ -3,12 +3,20 @@
 
 #include <glm/vec3.hpp>
 #include <string>
+#include <vector>
 #include <iostream>
 
 using glm::vec3;
 using std::string;
+using std::vector;
 using std::ostream;
 
+// Index of the material that shapes get if the scene doesn't give
+// them one. Every Material_Table starts with it.
+#define DEFAULT_MATERIAL 0
+// Material index of a Hit that hasn't hit anything.
+#define NO_MATERIAL -1
+
 struct Material {
     /** A material used for the Phong lighting model.
      */
@@ -25,8 +33,12 @@ struct Material {
     vec3 _specular_reflectance;
     /** The shininess exponent */
     float _shininess;
-    /** The name (for debugging) */
-    string _name;
+
+    /** Do two materials look exactly the same?
+     * @param other The other material.
+     * @return true if every reflectance, and the shininess, are equal.
+     */
+    bool operator==(const Material& other) const;
 
     /** Output to stream (for debugging).
      * @param os The stream
@@ -36,4 +48,59 @@ struct Material {
     friend ostream& operator<<(ostream& os, const Material& mat);
 };
 
+class Material_Table {
+    /** A scene's materials, each one stored once. Shapes and hits
+     * refer to them by their index in the table, which is much
+     * smaller than a copy. A material's name is only for the scene
+     * file and for debugging, so the names are kept in an array of
+     * their own, apart from the materials that shading reads.
+     */
+ public:
+    /** Constructor.
+     * Makes a table with just the default material in it.
+     */
+    Material_Table();
+
+    /** Add a material, unless an identical one is there already.
+     * @param material The material.
+     * @param name Its name (kept if the material is a new one).
+     * @return Index of the material in the table.
+     */
+    int add(const Material& material, const string& name);
+
+    /** A material.
+     * @param index Its index, which add() returned.
+     * @return The material.
+     */
+    const Material& operator[](int index) const {
+        return _materials[index];
+    }
+
+    /** The name a material was first added with (for debugging).
+     * @param index Its index.
+     * @return The name.
+     */
+    const string& name(int index) const;
+
+    /** Number of materials.
+     * @return The material count.
+     */
+    int size() const;
+
+    /** Bytes of memory the materials take up.
+     * @return The materials' size.
+     */
+    size_t material_bytes() const;
+
+    /** Bytes of memory the names take up.
+     * @return The names' size.
+     */
+    size_t name_bytes() const;
+
+ private:
+    vector<Material> _materials;
+    /** Each material's name, by index */
+    vector<string> _names;
+};
+
 #endif
@@ -0,0 +1,111 @@
+#include "pixel_order.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using std::invalid_argument;
+
+/** Every other bit of a Morton index: bits 0, 2, 4 ... packed together. */
+static int compact_bits(int i) {
+    int v = 0;
+    for (int bit = 0; (i >> (2 * bit)) != 0; bit++) {
+        v |= ((i >> (2 * bit)) & 1) << bit;
+    }
+    return v;
+}
+
+/** Cell number d along a Hilbert curve that fills a side x side
+ * square (side is a power of 2). */
+static Pixel_Order::Cell hilbert_cell(int side, int d) {
+    Pixel_Order::Cell cell;
+    cell._x = cell._y = 0;
+    for (int s = 1; s < side; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        // Turn the quadrant so the curve joins up with the last one.
+        if (ry == 0) {
+            if (rx == 1) {
+                cell._x = s - 1 - cell._x;
+                cell._y = s - 1 - cell._y;
+            }
+            std::swap(cell._x, cell._y);
+        }
+        cell._x += s * rx;
+        cell._y += s * ry;
+        d /= 4;
+    }
+    return cell;
+}
+
+Pixel_Order::Pixel_Order(Order order, int width, int height, int tile_size,
+                         int cell_size)
+{
+    _width = width;
+    _height = height;
+    if (order == SCANLINE) {
+        // Strips a cell high, so packets still fit.
+        _tile_width = std::max(width, 1);
+        _tile_height = cell_size;
+    } else {
+        _tile_width = _tile_height = tile_size;
+    }
+
+    int tiles_across = (width + _tile_width - 1) / _tile_width;
+    int tiles_down = (height + _tile_height - 1) / _tile_height;
+    order_grid(order, tiles_across, tiles_down, _tiles);
+
+    int cells_across = (_tile_width + cell_size - 1) / cell_size;
+    int cells_down = (_tile_height + cell_size - 1) / cell_size;
+    order_grid(order, cells_across, cells_down, _cells);
+    for (Cell& cell : _cells) {
+        cell._x *= cell_size;
+        cell._y *= cell_size;
+    }
+}
+
+Pixel_Order::Order Pixel_Order::named(const string& name) {
+    if (name == "scanline") { return SCANLINE; }
+    if (name == "tiled") { return TILED; }
+    if (name == "morton") { return MORTON; }
+    if (name == "hilbert") { return HILBERT; }
+    throw invalid_argument("Unknown pixel order \"" + name + "\"");
+}
+
+void Pixel_Order::tile(int i, int& x0, int& y0, int& x1, int& y1) const {
+    x0 = _tiles[i]._x * _tile_width;
+    y0 = _tiles[i]._y * _tile_height;
+    x1 = std::min(x0 + _tile_width, _width);
+    y1 = std::min(y0 + _tile_height, _height);
+}
+
+void Pixel_Order::order_grid(Order order, int width, int height,
+                             vector<Cell>& cells) {
+    cells.clear();
+    if (width <= 0 || height <= 0) { return; }
+    if (order == SCANLINE || order == TILED) {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                Cell cell = { x, y };
+                cells.push_back(cell);
+            }
+        }
+        return;
+    }
+
+    // The curves fill a square with a power of 2 on each side, so
+    // follow one that covers the grid, and skip the cells outside it.
+    int side = 1;
+    while (side < width || side < height) { side *= 2; }
+    for (int d = 0; d < side * side; d++) {
+        Cell cell;
+        if (order == MORTON) {
+            cell._x = compact_bits(d);
+            cell._y = compact_bits(d >> 1);
+        } else {
+            cell = hilbert_cell(side, d);
+        }
+        if (cell._x < width && cell._y < height) {
+            cells.push_back(cell);
+        }
+    }
+}
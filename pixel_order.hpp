@@ -0,0 +1,92 @@
+#ifndef _PIXEL_ORDER_HPP
+#define _PIXEL_ORDER_HPP
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+class Pixel_Order {
+    /** How a frame is cut into tiles (which are what the threads
+     * take turns at), and the order the tiles, and the cells in each
+     * tile, are rendered in. A cell is a pixel, or a packet's block
+     * of pixels. The orders are:
+     *   SCANLINE  each tile is a strip the width of the image,
+     *             and its cells go left to right,
+     *   TILED     square tiles, row by row, with their cells
+     *             row by row too,
+     *   MORTON    square tiles, and their cells, along a Z-order
+     *             (Morton) curve,
+     *   HILBERT   square tiles, and their cells, along a Hilbert curve.
+     * Along the curves, cells that are rendered one after the other
+     * are close together in the image, so their rays tend to go
+     * through the same parts of the accelerator.
+     */
+ public:
+    enum Order { SCANLINE, TILED, MORTON, HILBERT };
+
+    /** A cell, or a tile, as its position in a grid */
+    struct Cell {
+        int _x;
+        int _y;
+    };
+
+    /** Constructor.
+     * @param order Which order.
+     * @param width Pixels across the image.
+     * @param height Pixels up-down.
+     * @param tile_size Pixels along each side of a square tile (a
+     *                  multiple of cell_size).
+     * @param cell_size Pixels along each side of a cell.
+     */
+    Pixel_Order(Order order, int width, int height, int tile_size,
+                int cell_size);
+
+    /** Look up an order by name: "scanline", "tiled", "morton"
+     * or "hilbert".
+     * Throws an invalid_argument if it isn't one of those.
+     * @param name The name.
+     * @return The order.
+     */
+    static Order named(const string& name);
+
+    /** How many tiles there are.
+     * @return The tile count.
+     */
+    int num_tiles() const { return (int)_tiles.size(); }
+
+    /** Get a tile's pixels (cut off at the edges of the image).
+     * @param i Which tile, in order.
+     * @param x0 First column.
+     * @param y0 First row.
+     * @param x1 One past the last column.
+     * @param y1 One past the last row.
+     */
+    void tile(int i, int& x0, int& y0, int& x1, int& y1) const;
+
+    /** The cells of a whole tile, in order, as pixel offsets from
+     * the tile's first column and row. (A tile at the edge of the
+     * image only has the ones that are inside it.)
+     * @return The offsets.
+     */
+    const vector<Cell>& cells() const { return _cells; }
+
+ private:
+    /** The cells of a width x height grid, in an order.
+     * @param order Which order (SCANLINE and TILED are row by row).
+     * @param width Columns in the grid.
+     * @param height Rows in the grid.
+     * @param cells Where to put them.
+     */
+    static void order_grid(Order order, int width, int height,
+                           vector<Cell>& cells);
+
+    int _width, _height;
+    int _tile_width, _tile_height;
+    /** Each tile's column and row, in tiles, in order */
+    vector<Cell> _tiles;
+    vector<Cell> _cells;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "prototype.hpp"
+
+Prototype::Prototype(const string& name)
+    : _name(name)
+{
+    ; // nothing left to do
+}
+
+Prototype::~Prototype() {
+    for (Shape *shape : _shapes) {
+        delete shape;
+    }
+}
+
+void Prototype::add(Shape *shape) {
+    _shapes.push_back(shape);
+}
+
+void Prototype::build() {
+    _bvh.build(_shapes);
+}
+
+bool Prototype::first_hit(const vec3& start, const vec3& direction,
+                          float t_max, Hit& hit) const {
+    return _bvh.first_hit(start, direction, t_max, hit);
+}
+
+bool Prototype::first_hit(const vec3& start, const vec3& direction,
+                          Lazy_Hit& hit) const {
+    return _bvh.first_hit(start, direction, hit);
+}
+
+bool Prototype::trace_hit(const vec3& start, const vec3& direction,
+                          Lazy_Hit& hit, Ray_Trace& trace) const {
+    bool found = false;
+    for (Shape *shape : _shapes) {
+        if (shape->trace_hit(start, direction, hit, trace)) {
+            found = true;
+        }
+    }
+    return found;
+}
+
+Shape *Prototype::any_hit(const vec3& start, const vec3& direction,
+                          float t_max, const Shape *skip) const {
+    return _bvh.any_hit(start, direction, t_max, skip);
+}
+
+Bounding_Box Prototype::bounds() const {
+    return _bvh.bounds();
+}
+
+int Prototype::size() const {
+    return (int)_shapes.size();
+}
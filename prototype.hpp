@@ -0,0 +1,108 @@
+#ifndef _PROTOTYPE_HPP
+#define _PROTOTYPE_HPP
+
+#include <glm/vec3.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include "shape.hpp"
+#include "hit.hpp"
+#include "bvh.hpp"
+
+using glm::vec3;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+class Prototype {
+    /** A group of shapes, in their own object coordinates,
+     * that Instances place in the scene. However many instances
+     * there are, the shapes and their BVH are only stored once.
+     */
+ public:
+    /** Constructor.
+     * @param name The prototype's name, which instances refer to it by.
+     */
+    Prototype(const string& name);
+
+    /** Destructor. Deletes the prototype's shapes.
+     */
+    ~Prototype();
+
+    /** Add a shape. The prototype takes ownership of it.
+     * Call build() after the last one.
+     * @param shape The shape, in object coordinates.
+     */
+    void add(Shape *shape);
+
+    /** Build the prototype's own BVH over its shapes.
+     */
+    void build();
+
+    /** Finds the closest hit along a ray (in object coordinates).
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits further than this don't count.
+     * @param hit Hit record, which will be set if there's a hit.
+     * @return true/false if the ray does/doesn't hit some Shape.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   float t_max, Hit& hit) const;
+
+    /** Finds the closest hit along a ray (in object coordinates),
+     * without working out the hit's point, normal or material.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if there's a closer one.
+     * @return true if some Shape is hit before hit._t.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   Lazy_Hit& hit) const;
+
+    /** Finds the closest hit along a ray (in object coordinates),
+     * like the first_hit() above, testing every shape one at a time
+     * with Shape::trace_hit() (for debugging a ray).
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if there's a closer one.
+     * @param trace The trace, told about every shape tested.
+     * @return true if some Shape is hit before hit._t.
+     */
+    bool trace_hit(const vec3& start, const vec3& direction,
+                   Lazy_Hit& hit, Ray_Trace& trace) const;
+
+    /** Finds some shape that blocks a ray (in object coordinates).
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore (the one the ray starts on), or nullptr.
+     * @return The blocking shape, or nullptr if nothing blocks the ray.
+     */
+    Shape *any_hit(const vec3& start, const vec3& direction,
+                   float t_max, const Shape *skip) const;
+
+    /** Bounds of all the shapes, in object coordinates.
+     * @return The bounds.
+     */
+    Bounding_Box bounds() const;
+
+    /** Number of shapes.
+     * @return The shape count.
+     */
+    int size() const;
+
+    /** The prototype's name */
+    string _name;
+
+ private:
+    // Owns its shapes, so it can't be copied.
+    Prototype(const Prototype&);
+    Prototype& operator=(const Prototype&);
+
+    vector<Shape*> _shapes;
+    BVH _bvh;
+};
+
+typedef shared_ptr<Prototype> SP_Prototype;
+
+#endif
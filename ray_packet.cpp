@@ -0,0 +1,43 @@
+#include "ray_packet.hpp"
+
+#include <glm/geometric.hpp>
+
+using glm::cross;
+using glm::dot;
+
+Ray_Packet::Ray_Packet()
+    : _count(0), _has_frustum(false)
+{
+    ; // nothing left to do
+}
+
+void Ray_Packet::add(const vec3& start, const vec3& direction) {
+    _starts[_count] = start;
+    _directions[_count] = direction;
+    _inv_directions[_count] = 1.0f / direction;
+    _found[_count] = false;
+    _count++;
+}
+
+void Ray_Packet::set_frustum(const vec3& apex, const vec3 corners[4]) {
+    vec3 center = 0.25f * (corners[0] + corners[1] + corners[2] + corners[3]);
+    for (int i = 0; i < 4; i++) {
+        vec3 n = cross(corners[i] - apex, corners[(i + 1) % 4] - apex);
+        _normals[i] = (dot(n, center - apex) < 0) ? -n : n;
+    }
+    _apex = apex;
+    _has_frustum = true;
+}
+
+bool Ray_Packet::frustum_misses(const Bounding_Box& box) const {
+    if (!_has_frustum) { return false; }
+    for (int i = 0; i < 4; i++) {
+        // The box corner furthest inside this plane.
+        const vec3& n = _normals[i];
+        vec3 p(n.x > 0 ? box._max.x : box._min.x,
+               n.y > 0 ? box._max.y : box._min.y,
+               n.z > 0 ? box._max.z : box._min.z);
+        if (dot(n, p - _apex) < 0) { return true; }
+    }
+    return false;
+}
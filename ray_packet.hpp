@@ -0,0 +1,61 @@
+#ifndef _RAY_PACKET_HPP
+#define _RAY_PACKET_HPP
+
+#include <glm/vec3.hpp>
+#include "bounding_box.hpp"
+#include "hit.hpp"
+
+using glm::vec3;
+
+// Enough for an 8x8 block of pixels.
+#define MAX_PACKET_SIZE 64
+
+struct Ray_Packet {
+    /** A block of primary rays that are traced together.
+     * The rays all lie on lines through one point (the eye), inside
+     * a frustum, so a whole packet can skip a box that is outside it.
+     */
+
+    /** Constructor.
+     * Makes an empty packet, with no frustum.
+     */
+    Ray_Packet();
+
+    /** Add a ray to the packet.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     */
+    void add(const vec3& start, const vec3& direction);
+
+    /** Set the frustum that all the rays lie in.
+     * @param apex The point that every ray's line passes through.
+     * @param corners Four points, in order around the frustum's edge.
+     */
+    void set_frustum(const vec3& apex, const vec3 corners[4]);
+
+    /** Is a box wholly outside the frustum (so no ray can hit it)?
+     * The test is conservative: it may miss boxes that are outside.
+     * @param box The box.
+     * @return true if no ray in the packet can hit the box.
+     */
+    bool frustum_misses(const Bounding_Box& box) const;
+
+    /** Number of rays */
+    int _count;
+    vec3 _starts[MAX_PACKET_SIZE];
+    vec3 _directions[MAX_PACKET_SIZE];
+    /** 1 / direction, per component */
+    vec3 _inv_directions[MAX_PACKET_SIZE];
+
+    /** Whether set_frustum() has been called */
+    bool _has_frustum;
+    vec3 _apex;
+    /** Normals of the frustum's side planes, pointing inwards */
+    vec3 _normals[4];
+
+    /** Results: each ray's closest hit, if _found */
+    Hit _hits[MAX_PACKET_SIZE];
+    bool _found[MAX_PACKET_SIZE];
+};
+
+#endif
@@ -0,0 +1,29 @@
+#include "ray_stream.hpp"
+
+Ray_Stream::Ray_Stream()
+{
+    ; // nothing to do: no rays yet.
+}
+
+void Ray_Stream::clear() {
+    _start_x.clear();
+    _start_y.clear();
+    _start_z.clear();
+    _direction_x.clear();
+    _direction_y.clear();
+    _direction_z.clear();
+    _t_max.clear();
+    _owners.clear();
+}
+
+void Ray_Stream::add(const vec3& start, const vec3& direction, float t_max,
+                     int owner) {
+    _start_x.push_back(start.x);
+    _start_y.push_back(start.y);
+    _start_z.push_back(start.z);
+    _direction_x.push_back(direction.x);
+    _direction_y.push_back(direction.y);
+    _direction_z.push_back(direction.z);
+    _t_max.push_back(t_max);
+    _owners.push_back(owner);
+}
@@ -0,0 +1,57 @@
+#ifndef _RAY_STREAM_HPP
+#define _RAY_STREAM_HPP
+
+#include <glm/vec3.hpp>
+#include <vector>
+
+using glm::vec3;
+using std::vector;
+
+struct Ray_Stream {
+    /** A batch of rays of one kind (primary rays, or shadow rays to
+     * one light) that a stage of the wavefront renderer goes through
+     * in one loop. Each coordinate has its own array, so a stage
+     * only reads what it needs, and a SIMD loop can load several
+     * rays' coordinates at once.
+     */
+
+    /** Constructor.
+     * Makes an empty stream.
+     */
+    Ray_Stream();
+
+    /** Remove all the rays (keeping the memory for the next ones).
+     */
+    void clear();
+
+    /** Add a ray to the stream.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max How far along the ray to look.
+     * @param owner What the ray is for (see _owners).
+     */
+    void add(const vec3& start, const vec3& direction, float t_max,
+             int owner);
+
+    /** Number of rays */
+    int size() const { return (int)_owners.size(); }
+
+    /** A ray's starting point. */
+    vec3 start(int i) const {
+        return vec3(_start_x[i], _start_y[i], _start_z[i]);
+    }
+
+    /** A ray's direction vector. */
+    vec3 direction(int i) const {
+        return vec3(_direction_x[i], _direction_y[i], _direction_z[i]);
+    }
+
+    vector<float> _start_x, _start_y, _start_z;
+    vector<float> _direction_x, _direction_y, _direction_z;
+    vector<float> _t_max;
+    /** What each ray is for: its pixel, for a primary ray, or the hit
+     * it starts at, for a shadow ray */
+    vector<int> _owners;
+};
+
+#endif
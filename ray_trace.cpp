@@ -0,0 +1,193 @@
+#include "ray_trace.hpp"
+#include "shape.hpp"
+#include "hit.hpp"
+#include <cmath>
+#include <cstdio>
+
+// Digits to write floats with, so they read back the same.
+#define JSON_PRECISION 9
+
+/** Write a string as a JSON string, quoted and escaped. */
+static void write_string(ostream& os, const string& s) {
+    os << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+            os << code;
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+/** Write a float as a JSON number (null, if it's infinite or NaN). */
+static void write_number(ostream& os, float x) {
+    if (std::isfinite(x)) { os << x; }
+    else { os << "null"; }
+}
+
+static void write_vec3(ostream& os, const vec3& v) {
+    os << "[";
+    write_number(os, v.x);
+    os << ", ";
+    write_number(os, v.y);
+    os << ", ";
+    write_number(os, v.z);
+    os << "]";
+}
+
+static void write_bool(ostream& os, bool b) {
+    os << (b ? "true" : "false");
+}
+
+Ray_Trace::Ray_Trace(const vector<string>& shape_names)
+    : _shape_names(shape_names)
+{
+    ray(0, 0, vec3(0, 0, 0), vec3(0, 0, 0));
+}
+
+void Ray_Trace::ray(int x_dcs, int y_dcs, const vec3& start,
+                    const vec3& direction) {
+    _x_dcs = x_dcs;
+    _y_dcs = y_dcs;
+    _start = start;
+    _direction = direction;
+    _inside.clear();
+    _tests.clear();
+    _found = false;
+    _t = 0;
+    _material = NO_MATERIAL;
+    _shape.clear();
+    _instance.clear();
+    _lights.clear();
+    _color = vec3(0, 0, 0);
+}
+
+void Ray_Trace::enter(const Shape *instance) {
+    _inside.push_back(instance->name(_shape_names));
+}
+
+void Ray_Trace::leave() {
+    _inside.pop_back();
+}
+
+void Ray_Trace::tested(const Shape *shape, bool hit, float t) {
+    Test test;
+    test._shape = shape->name(_shape_names);
+    test._instance = _inside.empty() ? "" : _inside.back();
+    test._hit = hit;
+    test._t = t;
+    _tests.push_back(test);
+}
+
+void Ray_Trace::found(const Hit& hit) {
+    _found = true;
+    _position = hit._position;
+    _normal = hit._normal;
+    _t = hit._t;
+    _material = hit._material;
+    _shape = hit._shape ? hit._shape->name(_shape_names) : "";
+    _instance = hit._instance ? hit._instance->name(_shape_names) : "";
+}
+
+void Ray_Trace::light(int index, const vec3& L, bool self_shadowed,
+                      bool blocked) {
+    Light_Step step;
+    step._index = index;
+    step._L = L;
+    step._self_shadowed = self_shadowed;
+    step._blocked = blocked;
+    step._ambient = step._diffuse = step._specular = vec3(0, 0, 0);
+    _lights.push_back(step);
+}
+
+void Ray_Trace::terms(const vec3& ambient, const vec3& diffuse,
+                      const vec3& specular) {
+    if (_lights.empty()) { return; }
+    Light_Step& step = _lights.back();
+    step._ambient = ambient;
+    step._diffuse = diffuse;
+    step._specular = specular;
+}
+
+void Ray_Trace::color(const vec3& color) {
+    _color = color;
+}
+
+void Ray_Trace::write_json(ostream& os) const {
+    std::streamsize old_precision = os.precision(JSON_PRECISION);
+
+    os << "{\n  \"pixel\": [" << _x_dcs << ", " << _y_dcs << "],\n";
+    os << "  \"start\": ";
+    write_vec3(os, _start);
+    os << ",\n  \"direction\": ";
+    write_vec3(os, _direction);
+
+    os << ",\n  \"tests\": [";
+    for (size_t i = 0; i < _tests.size(); i++) {
+        const Test& test = _tests[i];
+        os << (i ? ",\n" : "\n") << "    {\"shape\": ";
+        write_string(os, test._shape);
+        if (!test._instance.empty()) {
+            os << ", \"instance\": ";
+            write_string(os, test._instance);
+        }
+        os << ", \"hit\": ";
+        write_bool(os, test._hit);
+        if (test._hit) {
+            os << ", \"t\": ";
+            write_number(os, test._t);
+        }
+        os << "}";
+    }
+    os << (_tests.empty() ? "]" : "\n  ]");
+
+    os << ",\n  \"hit\": ";
+    if (_found) {
+        os << "{\"shape\": ";
+        write_string(os, _shape);
+        if (!_instance.empty()) {
+            os << ", \"instance\": ";
+            write_string(os, _instance);
+        }
+        os << ", \"t\": ";
+        write_number(os, _t);
+        os << ", \"position\": ";
+        write_vec3(os, _position);
+        os << ", \"normal\": ";
+        write_vec3(os, _normal);
+        os << ", \"material\": " << _material << "}";
+    } else {
+        os << "null";
+    }
+
+    os << ",\n  \"lights\": [";
+    for (size_t i = 0; i < _lights.size(); i++) {
+        const Light_Step& step = _lights[i];
+        os << (i ? ",\n" : "\n") << "    {\"light\": " << step._index
+           << ", \"L\": ";
+        write_vec3(os, step._L);
+        os << ", \"self_shadowed\": ";
+        write_bool(os, step._self_shadowed);
+        os << ", \"blocked\": ";
+        write_bool(os, step._blocked);
+        os << ", \"ambient\": ";
+        write_vec3(os, step._ambient);
+        os << ", \"diffuse\": ";
+        write_vec3(os, step._diffuse);
+        os << ", \"specular\": ";
+        write_vec3(os, step._specular);
+        os << "}";
+    }
+    os << (_lights.empty() ? "]" : "\n  ]");
+
+    os << ",\n  \"color\": ";
+    write_vec3(os, _color);
+    os << "\n}\n";
+
+    os.precision(old_precision);
+}
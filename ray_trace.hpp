@@ -0,0 +1,176 @@
+#ifndef _RAY_TRACE_HPP
+#define _RAY_TRACE_HPP
+
+#include <glm/vec3.hpp>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class Shape;
+class Hit;
+
+using glm::vec3;
+using std::ostream;
+using std::string;
+using std::vector;
+
+/* Debugging policies. The code that shades a hit is a template over
+ * one of these, and tells it about each step it takes. No_Trace does
+ * nothing with them, so normal rendering compiles them away. Ray_Trace
+ * keeps them all, for the one ray that's being debugged. Light_Mask
+ * only keeps which lights reach the hit (for adaptive rendering).
+ *
+ * Every policy has the same functions:
+ *   ray(x_dcs, y_dcs, start, direction)  a new ray starts
+ *   enter(instance), leave()             the ray goes in/out of an instance
+ *   tested(shape, hit, t)                the ray was tested against a shape
+ *   found(hit)                           the closest hit
+ *   light(index, L, self_shadowed, blocked)  a light, at the hit point
+ *   terms(ambient, diffuse, specular)    what the light just named adds
+ *   color(color)                         the ray's final color
+ */
+
+class No_Trace {
+    /** The policy for normal rendering: remembers nothing. */
+ public:
+    void ray(int x_dcs, int y_dcs, const vec3& start,
+             const vec3& direction) {}
+    void enter(const Shape *instance) {}
+    void leave() {}
+    void tested(const Shape *shape, bool hit, float t) {}
+    void found(const Hit& hit) {}
+    void light(int index, const vec3& L, bool self_shadowed, bool blocked) {}
+    void terms(const vec3& ambient, const vec3& diffuse,
+               const vec3& specular) {}
+    void color(const vec3& color) {}
+};
+
+class Light_Mask {
+    /** The policy for adaptive rendering: remembers which lights
+     * reach the hit point (the first 64 of them).
+     */
+ public:
+    /** Bit i is set if light i isn't shadowed */
+    unsigned long long _lit = 0;
+
+    void ray(int x_dcs, int y_dcs, const vec3& start,
+             const vec3& direction) {}
+    void enter(const Shape *instance) {}
+    void leave() {}
+    void tested(const Shape *shape, bool hit, float t) {}
+    void found(const Hit& hit) {}
+    void light(int index, const vec3& L, bool self_shadowed, bool blocked) {
+        if (index < 64 && !self_shadowed && !blocked) {
+            _lit |= 1ULL << index;
+        }
+    }
+    void terms(const vec3& ambient, const vec3& diffuse,
+               const vec3& specular) {}
+    void color(const vec3& color) {}
+};
+
+class Ray_Trace {
+    /** The policy for debugging one ray: remembers every shape it was
+     * tested against, what it hit, and what each light added to its
+     * color, and writes all that out as JSON.
+     */
+ public:
+    /** Constructor.
+     * Makes an empty trace.
+     * @param shape_names The scene's shape names, which the trace
+     *                    reports shapes by.
+     */
+    Ray_Trace(const vector<string>& shape_names);
+
+    /** Forget the last ray, and start on a new one.
+     * @param x_dcs DCS X coordinate of the ray's pixel.
+     * @param y_dcs DCS Y coordinate of the ray's pixel.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     */
+    void ray(int x_dcs, int y_dcs, const vec3& start, const vec3& direction);
+
+    /** The ray goes into an instance: tests until leave() are of
+     * its prototype's shapes, in object coordinates.
+     * @param instance The instance.
+     */
+    void enter(const Shape *instance);
+
+    /** The ray comes back out of the last instance it entered.
+     */
+    void leave();
+
+    /** The ray was tested against a shape.
+     * @param shape The shape.
+     * @param hit Whether the ray hits it (nearer hits or not).
+     * @param t Ray distance to the hit, if there is one.
+     */
+    void tested(const Shape *shape, bool hit, float t);
+
+    /** The closest hit, which is the one that gets shaded.
+     * @param hit The hit.
+     */
+    void found(const Hit& hit);
+
+    /** A light, as seen from the hit point.
+     * @param index Which light.
+     * @param L Unit vector from the hit point towards the light.
+     * @param self_shadowed Whether the shape shadows itself there.
+     * @param blocked Whether something else is in the way.
+     */
+    void light(int index, const vec3& L, bool self_shadowed, bool blocked);
+
+    /** What the last light adds to the color.
+     * @param ambient Its ambient term.
+     * @param diffuse Its diffuse term.
+     * @param specular Its specular term.
+     */
+    void terms(const vec3& ambient, const vec3& diffuse, const vec3& specular);
+
+    /** The ray's final color.
+     * @param color The color.
+     */
+    void color(const vec3& color);
+
+    /** Write the trace as one JSON object.
+     * @param os The stream.
+     */
+    void write_json(ostream& os) const;
+
+ private:
+    struct Test {
+        /** Name of the shape tested */
+        string _shape;
+        /** Name of the instance it's in, or "" */
+        string _instance;
+        bool _hit;
+        float _t;
+    };
+
+    struct Light_Step {
+        int _index;
+        vec3 _L;
+        bool _self_shadowed;
+        bool _blocked;
+        /** The terms (which stay 0 if the light is shadowed) */
+        vec3 _ambient, _diffuse, _specular;
+    };
+
+    /** The scene's shape names */
+    const vector<string>& _shape_names;
+    int _x_dcs, _y_dcs;
+    vec3 _start, _direction;
+    /** Names of the instances the ray is in, outermost first */
+    vector<string> _inside;
+    vector<Test> _tests;
+    /** Whether there's a hit, and if so, where and on what */
+    bool _found;
+    vec3 _position, _normal;
+    float _t;
+    int _material;
+    string _shape, _instance;
+    vector<Light_Step> _lights;
+    vec3 _color;
+};
+
+#endif
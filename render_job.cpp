@@ -0,0 +1,83 @@
+#include "render_job.hpp"
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+Render_Job::Render_Job(const Tile_Callback& on_tile)
+    : _on_tile(on_tile), _cancelled(false), _num_tiles(0), _tiles_done(0),
+      _done(false), _passes_done(0)
+{
+    ; // nothing left to do
+}
+
+void Render_Job::cancel() {
+    _cancelled = true;
+}
+
+bool Render_Job::cancelled() const {
+    return _cancelled;
+}
+
+bool Render_Job::done() const {
+    lock_guard<mutex> lock(_mutex);
+    return _done;
+}
+
+int Render_Job::num_tiles() const {
+    return _num_tiles;
+}
+
+int Render_Job::tiles_done() const {
+    return _tiles_done;
+}
+
+float Render_Job::progress() const {
+    int num_tiles = _num_tiles;
+    if (num_tiles == 0) { return 0.0f; }
+    return (float)_tiles_done / num_tiles;
+}
+
+int Render_Job::passes_done() const {
+    lock_guard<mutex> lock(_mutex);
+    return _passes_done;
+}
+
+SP_Image Render_Job::pass_image() const {
+    lock_guard<mutex> lock(_mutex);
+    return _pass_image;
+}
+
+SP_Image Render_Job::wait() {
+    unique_lock<mutex> lock(_mutex);
+    while (!_done) {
+        _finished.wait(lock);
+    }
+    return _image;
+}
+
+void Render_Job::start(int num_tiles) {
+    _tiles_done = 0;
+    _num_tiles = num_tiles;
+}
+
+void Render_Job::finish_tile(const Tile& tile) {
+    lock_guard<mutex> lock(_tile_mutex);
+    if (_on_tile) { _on_tile(tile); }
+    _tiles_done++;
+}
+
+void Render_Job::finish_pass(SP_Image image) {
+    lock_guard<mutex> lock(_mutex);
+    _pass_image = image;
+    _passes_done++;
+}
+
+void Render_Job::finish(SP_Image image) {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _image = image;
+        _done = true;
+    }
+    _finished.notify_all();
+}
@@ -0,0 +1,134 @@
+#ifndef _RENDER_JOB_HPP
+#define _RENDER_JOB_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "image.hpp"
+
+using std::function;
+using std::shared_ptr;
+using std::vector;
+
+class Render_Job {
+    /** A frame that's being rendered in the background (see
+     * Caster::render_async()). The caller can watch its tiles
+     * finish, stop it, or wait for the image.
+     */
+ public:
+    /** A finished tile of the image */
+    struct Tile {
+        /** Its first column and row, and one past its last ones */
+        int _x0, _y0, _x1, _y1;
+        /** Its pixels as 8-bit RGB, a row at a time, from the bottom
+         * (quantized like the whole image would be) */
+        vector<unsigned char> _pixels;
+    };
+
+    /** What's told about each tile as it's finished. It's called on
+     * whichever thread rendered the tile, but never for two tiles
+     * at once. */
+    typedef function<void(const Tile& tile)> Tile_Callback;
+
+    /** Constructor.
+     * @param on_tile Told about each tile, or nullptr.
+     */
+    Render_Job(const Tile_Callback& on_tile);
+
+    /** Stop rendering. Tiles that have been started are finished
+     * (and handed to the callback), but no more are started, and
+     * there's no image.
+     */
+    void cancel();
+
+    /** Was cancel() called?
+     * @return true if it was.
+     */
+    bool cancelled() const;
+
+    /** Has the job stopped, because it's done or it was cancelled?
+     * @return true if it has.
+     */
+    bool done() const;
+
+    /** How many tiles the frame has (0 until rendering starts).
+     * @return The tile count.
+     */
+    int num_tiles() const;
+
+    /** How many of them are finished.
+     * @return The count.
+     */
+    int tiles_done() const;
+
+    /** How much of the frame is finished (counting the tiles of
+     * every pass, for a progressive frame).
+     * @return From 0 to 1.
+     */
+    float progress() const;
+
+    /** How many of a progressive frame's coarse passes are finished
+     * (see Caster::set_progressive()). The last pass isn't counted:
+     * its image is the one wait() returns.
+     * @return The count.
+     */
+    int passes_done() const;
+
+    /** The image as of the last coarse pass.
+     * @return The image, or nullptr before the first one is done.
+     */
+    SP_Image pass_image() const;
+
+    /** Wait for the job to stop.
+     * @return The image, or nullptr if the job was cancelled.
+     */
+    SP_Image wait();
+
+ private:
+    friend class Caster;
+
+    /** Rendering is starting.
+     * @param num_tiles How many tiles the frame has.
+     */
+    void start(int num_tiles);
+
+    /** A tile is finished: tell the callback.
+     * @param tile The tile.
+     */
+    void finish_tile(const Tile& tile);
+
+    /** A coarse pass is finished.
+     * @param image The image so far.
+     */
+    void finish_pass(SP_Image image);
+
+    /** The job has stopped.
+     * @param image The image, or nullptr if it was cancelled.
+     */
+    void finish(SP_Image image);
+
+    // Not copyable: threads are looking at it.
+    Render_Job(const Render_Job&);
+    Render_Job& operator=(const Render_Job&);
+
+    Tile_Callback _on_tile;
+    std::atomic<bool> _cancelled;
+    std::atomic<int> _num_tiles;
+    std::atomic<int> _tiles_done;
+    /** Keeps the callback to one tile at a time */
+    std::mutex _tile_mutex;
+    /** Guards _done, _image, _passes_done and _pass_image */
+    mutable std::mutex _mutex;
+    std::condition_variable _finished;
+    bool _done;
+    SP_Image _image;
+    int _passes_done;
+    SP_Image _pass_image;
+};
+
+typedef shared_ptr<Render_Job> SP_Render_Job;
+
+#endif
@@ -1,8 +1,11 @@
 #include "scene_reader.hpp"
 #include <iostream>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/matrix_transform.hpp> // glm::translate, rotate, scale
 
 using std::cout;
 using std::endl;
+using glm::mat4;
 
 Scene_Reader::Scene_Reader() {
 }
@@ -14,11 +17,13 @@ vec3 Scene_Reader::read_vec3(Tokenizer& tokens) {
     return vec3(x, y, z);
 }
 
-Sphere *Scene_Reader::read_sphere(Tokenizer& tokens, vector<Material>& materials) {
+Sphere *Scene_Reader::read_sphere(Tokenizer& tokens,
+                                  const Material_Names& materials,
+                                  vector<string>& names) {
     vec3 center(0,0,0);
     float radius=1;
     string name = "NO NAME";
-    Material mat;
+    int mat = DEFAULT_MATERIAL;
     string token;
     while ((token = tokens.next_string()) != "end") {
         if (token == "center")
@@ -31,15 +36,17 @@ Sphere *Scene_Reader::read_sphere(Tokenizer& tokens, vector<Material>& materials
             mat = find_named_material(tokens.next_string(), materials);
     }
     match("sphere", tokens);
-    return new Sphere(center, radius, mat, name);
+    return new Sphere(center, radius, mat, add_name(name, names));
 }
 
-Triangle* Scene_Reader::read_triangle(Tokenizer& tokens, vector<Material>& materials) {
+Triangle* Scene_Reader::read_triangle(Tokenizer& tokens,
+                                      const Material_Names& materials,
+                                      vector<string>& names) {
     vec3 A(0,0,0);
     vec3 B(1,0,0);
     vec3 C(0,2,0);
     string name = "NO NAME";
-    Material mat;
+    int mat = DEFAULT_MATERIAL;
     string token;
     while ((token = tokens.next_string()) != "end") {
         if (token == "end")
@@ -57,15 +64,17 @@ Triangle* Scene_Reader::read_triangle(Tokenizer& tokens, vector<Material>& mater
     }
 
     match("triangle", tokens);
-    return new Triangle(A, B, C, mat, name);
+    return new Triangle(A, B, C, mat, add_name(name, names));
 }
 
-Cylinder* Scene_Reader::read_cylinder(Tokenizer& tokens, vector<Material>& materials) {
+Cylinder* Scene_Reader::read_cylinder(Tokenizer& tokens,
+                                      const Material_Names& materials,
+                                      vector<string>& names) {
     vec3 center(0,0,0);
     float radius=1;
     float height=2;
     string name = "NO NAME";
-    Material mat;
+    int mat = DEFAULT_MATERIAL;
     string token;
     while ((token = tokens.next_string()) != "end") {
         if (token == "center")
@@ -81,7 +90,99 @@ Cylinder* Scene_Reader::read_cylinder(Tokenizer& tokens, vector<Material>& mater
     }
 
     match("cylinder", tokens);
-    return new Cylinder(center, radius, height, mat, name);
+    return new Cylinder(center, radius, height, mat,
+                        add_name(name, names));
+}
+
+// A prototype is a group of shapes, which instances place in the scene:
+//   begin prototype
+//   name snowman
+//   begin sphere ... end sphere
+//   begin triangle ... end triangle
+//   end prototype
+SP_Prototype Scene_Reader::read_prototype(Tokenizer& tokens,
+                                          const Material_Names& materials,
+                                          vector<string>& names) {
+    SP_Prototype prototype(new Prototype("NO NAME"));
+    string token;
+    while ((token = tokens.next_string()) != "end") {
+        if (token == "name")
+            prototype->_name = tokens.next_string();
+        else if (token == "begin") {
+            string kind = tokens.next_string();
+            if (kind == "triangle")
+                prototype->add(read_triangle(tokens, materials, names));
+            else if (kind == "sphere")
+                prototype->add(read_sphere(tokens, materials, names));
+            else if (kind == "cylinder")
+                prototype->add(read_cylinder(tokens, materials, names));
+            else
+                throw invalid_argument("Can't put a \"" + kind
+                                       + "\" in a prototype "
+                                       + tokens.file_position());
+        }
+    }
+    match("prototype", tokens);
+    prototype->build();
+    return prototype;
+}
+
+// An instance places a prototype, transformed in the order listed:
+//   begin instance
+//   name left_snowman
+//   prototype snowman
+//   scale 2 2 2
+//   rotate 45 0 1 0      (degrees, then the axis)
+//   translate -3 0 0
+//   end instance
+Instance* Scene_Reader::read_instance(Tokenizer& tokens,
+                                      const vector<SP_Prototype>& prototypes,
+                                      vector<string>& names) {
+    SP_Prototype prototype;
+    mat4 transform(1.0f);
+    string name = "NO NAME";
+    string token;
+    while ((token = tokens.next_string()) != "end") {
+        if (token == "prototype")
+            prototype = find_named_prototype(tokens.next_string(), prototypes);
+        else if (token == "name")
+            name = tokens.next_string();
+        else if (token == "translate")
+            transform = glm::translate(mat4(1.0f), read_vec3(tokens))
+                * transform;
+        else if (token == "rotate") {
+            float degrees = tokens.next_number();
+            vec3 axis = read_vec3(tokens);
+            transform = glm::rotate(mat4(1.0f), glm::radians(degrees), axis)
+                * transform;
+        }
+        else if (token == "scale")
+            transform = glm::scale(mat4(1.0f), read_vec3(tokens)) * transform;
+    }
+    match("instance", tokens);
+    if (!prototype) {
+        throw invalid_argument("Instance \"" + name + "\" has no prototype "
+                               + tokens.file_position());
+    }
+    return new Instance(prototype, transform, add_name(name, names));
+}
+
+// Generated scenes leave most shapes unnamed, and those don't get a
+// name of their own.
+int Scene_Reader::add_name(const string& name, vector<string>& names) {
+    if (name == "NO NAME")
+        return NO_NAME;
+    names.push_back(name);
+    return (int)names.size() - 1;
+}
+
+SP_Prototype Scene_Reader::find_named_prototype(
+    const string name, const vector<SP_Prototype>& prototypes) {
+    for (const SP_Prototype& prototype : prototypes) {
+        if (prototype->_name == name)
+            return prototype;
+    }
+    throw invalid_argument("Can't find prototype named \"" + name + "\"");
 }
 
 Light Scene_Reader::read_light(Tokenizer& tokens) {
@@ -101,17 +202,17 @@ Light Scene_Reader::read_light(Tokenizer& tokens) {
     return light;
 }
 
-Material Scene_Reader::find_named_material(const string name,
-                                           const vector<Material>& materials) {
-    for (const Material& mat : materials) {
-        if (mat._name == name)
-            return mat;
-    }
+int Scene_Reader::find_named_material(const string name,
+                                      const Material_Names& materials) {
+    Material_Names::const_iterator found = materials.find(name);
+    if (found != materials.end())
+        return found->second;
     throw invalid_argument("Can't find material named \"" + name + "\"");
 }
 
-Material Scene_Reader::read_material(Tokenizer& tokens) {
+Material Scene_Reader::read_material(Tokenizer& tokens, string& name) {
     Material mat;
+    name = "NO NAME";
     string token;
     while ((token = tokens.next_string()) != "end") {
         if (token == "ambient")
@@ -123,7 +224,7 @@ Material Scene_Reader::read_material(Tokenizer& tokens) {
         else if (token == "shininess")
             mat._shininess = tokens.next_number();
         else if (token == "name")
-            mat._name = tokens.next_string();
+            name = tokens.next_string();
     }
     match("material", tokens);
     return mat;
@@ -166,28 +267,43 @@ void Scene_Reader::match(const string& expected, Tokenizer& tokens) {
 
 void Scene_Reader::read_scene(const string& file_name,
                               vector<Shape*>& shapes,
+                              vector<string>& shape_names,
+                              Material_Table& material_table,
                               Camera& camera,
                               vector<Light>& lights) {
     Tokenizer tokens(file_name);
-    vector<Material> materials;
+    Material_Names materials;
+    vector<SP_Prototype> prototypes;
     while (!tokens.eof()) {
         string token = tokens.next_string();
         if (tokens.eof())
             break;
         if (token == "begin") {
             string kind = tokens.next_string();
-            if (kind == "material")
-                materials.push_back(read_material(tokens));
+            if (kind == "material") {
+                // Materials that look the same share one table entry.
+                // If a name is used twice, the first one counts.
+                string name;
+                Material mat = read_material(tokens, name);
+                materials.insert(Material_Names::value_type(
+                    name, material_table.add(mat, name)));
+            }
             else if (kind == "camera")
                 camera = read_camera(tokens);
             else if (kind == "light")
                 lights.push_back(read_light(tokens));
             else if (kind == "triangle")
-                shapes.push_back(read_triangle(tokens, materials));
+                shapes.push_back(read_triangle(tokens, materials, shape_names));
             else if (kind == "sphere")
-                shapes.push_back(read_sphere(tokens, materials));
+                shapes.push_back(read_sphere(tokens, materials, shape_names));
             else if (kind == "cylinder")
-                shapes.push_back(read_cylinder(tokens, materials));
+                shapes.push_back(read_cylinder(tokens, materials, shape_names));
+            else if (kind == "prototype")
+                prototypes.push_back(read_prototype(tokens, materials,
+                                                    shape_names));
+            else if (kind == "instance")
+                shapes.push_back(read_instance(tokens, prototypes,
+                                               shape_names));
         }
         else {
             throw invalid_argument("Expected \"begin\", got \""
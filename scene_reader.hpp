@@ -8,33 +8,54 @@
 #include "triangle.hpp"
 #include "sphere.hpp"
 #include "cylinder.hpp"
+#include "prototype.hpp"
+#include "instance.hpp"
+#include <map>
 #include <vector>
 #include <string>
 #include <exception>
 #include <glm/vec3.hpp>
 
+using std::map;
 using std::string;
 using std::invalid_argument;
 using std::vector;
 using glm::vec3;
 
+/** Index in the Material_Table of each material the file names */
+typedef map<string, int> Material_Names;
+
 class Scene_Reader {
  public:
     Scene_Reader();
     void read_scene(const string& file_name,
                     vector<Shape*>& shapes,
+                    vector<string>& shape_names,
+                    Material_Table& materials,
                     Camera& camera,
                     vector<Light>& lights);
 
  private:
-    Sphere *read_sphere(Tokenizer& tokens, vector<Material>& materials);
-    Triangle *read_triangle(Tokenizer& tokens, vector<Material>& materials);
-    Cylinder *read_cylinder(Tokenizer& tokens, vector<Material>& materials);
+    Sphere *read_sphere(Tokenizer& tokens, const Material_Names& materials,
+                        vector<string>& names);
+    Triangle *read_triangle(Tokenizer& tokens, const Material_Names& materials,
+                            vector<string>& names);
+    Cylinder *read_cylinder(Tokenizer& tokens, const Material_Names& materials,
+                            vector<string>& names);
+    SP_Prototype read_prototype(Tokenizer& tokens,
+                                const Material_Names& materials,
+                                vector<string>& names);
+    Instance *read_instance(Tokenizer& tokens,
+                            const vector<SP_Prototype>& prototypes,
+                            vector<string>& names);
+    int add_name(const string& name, vector<string>& names);
+    SP_Prototype find_named_prototype(const string name,
+                                      const vector<SP_Prototype>& prototypes);
     Light read_light(Tokenizer& tokens);
-    Material find_named_material(const string name,
-                                 const vector<Material>& materials);
+    int find_named_material(const string name,
+                            const Material_Names& materials);
     vec3 read_vec3(Tokenizer& tokens);
-    Material read_material(Tokenizer& tokens);
+    Material read_material(Tokenizer& tokens, string& name);
     Camera read_camera(Tokenizer& tokens);
     void match(const string& expected, Tokenizer& tokens);
 };
@@ -1,12 +1,58 @@
 #include "shape.hpp"
+#include "hit.hpp"
+#include "ray_trace.hpp"
 
-Shape::Shape(const Material& mat,
-             const string& name)
+Shape::Shape(int mat,
+             int name)
     : _material(mat), _name(name)
 {
     ; // nothing left to do.
 }
 
+Shape::~Shape() {
+    ; // nothing to do.
+}
+
+const string& Shape::name(const vector<string>& names) const {
+    static const string no_name("NO NAME");
+    return (_name != NO_NAME) ? names[_name] : no_name;
+}
+
+bool Shape::find_hit(const vec3& start, const vec3& direction,
+                     Lazy_Hit& hit) const {
+    Hit full;
+    if (!intersects(start, direction, full) || !(full._t < hit._t)) {
+        return false;
+    }
+    hit.set(full._t, (full._shape != nullptr) ? full._shape : this, 0);
+    hit._instance = full._instance;
+    return true;
+}
 
+void Shape::finalize_hit(const vec3& start, const vec3& direction,
+                         const Lazy_Hit& lazy, Hit& hit) const {
+    intersects(start, direction, hit);
+    if (hit._shape == nullptr) { hit._shape = this; }
+}
 
+bool Shape::trace_hit(const vec3& start, const vec3& direction,
+                      Lazy_Hit& hit, Ray_Trace& trace) const {
+    // Test against this shape alone, so the trace gets its t
+    // even when something closer was hit already.
+    Lazy_Hit own;
+    bool hits = find_hit(start, direction, own);
+    trace.tested(this, hits, own._t);
+    if (!hits || !(own._t < hit._t)) { return false; }
+    hit = own;
+    return true;
+}
 
+bool Shape::occludes(const vec3& start, const vec3& direction, float t_max,
+                     const Shape *skip) const {
+    Hit hit;
+    return intersects(start, direction, hit) && hit._t < t_max;
+}
+
+bool Shape::shadows_itself(const Hit& hit, const vec3& L) const {
+    return false;
+}
@@ -2,12 +2,20 @@
 #define _SHAPE_HPP
 
 #include "material.hpp"
+#include "bounding_box.hpp"
 
 class Hit;
+class Lazy_Hit;
+class Ray_Trace;
 
 #include <string>
+#include <vector>
 using glm::vec3;
 using std::string;
+using std::vector;
+
+// Name index of a shape that wasn't given a name.
+#define NO_NAME -1
 
 class Shape {
     /** A 3D shape.
@@ -16,11 +24,17 @@ class Shape {
      */
  public:
     /** Constructor.
-     * @param material The Material of the shape.
-     * @param name The shape's name.
+     * @param material Index of the shape's material, in the scene's
+     *                 Material_Table (NO_MATERIAL if it has none).
+     * @param name Index of the shape's name, in the scene's shape
+     *             names (NO_NAME if it has none).
+     */
+    Shape(int material,
+          int name);
+
+    /** Destructor.
      */
-    Shape(const Material& material,
-          const string& name);
+    virtual ~Shape();
 
     /** Check if a ray intersects the shape.
      * THIS METHOD IS ABSTRACT, so child classes MUST implement it.
@@ -32,12 +46,93 @@ class Shape {
      * @return true if there is an intersection, false otherwise.
      */
     virtual bool intersects(const vec3& start,
-                            const vec3& direction, Hit& hit) = 0;
+                            const vec3& direction, Hit& hit) const = 0;
+
+    /** Check if a ray hits the shape closer than a hit found already,
+     * without working out the hit's point, normal or material.
+     * Accelerators use this while they search, and call
+     * finalize_hit() just once, on the closest shape.
+     * The default calls intersects(); child classes may do
+     * something cheaper.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far. If the ray hits the shape
+     *            before hit._t, set its _t, _shape and _part.
+     * @return true if the ray hits the shape before hit._t.
+     */
+    virtual bool find_hit(const vec3& start, const vec3& direction,
+                          Lazy_Hit& hit) const;
+
+    /** Fill in a whole hit, from what find_hit() found.
+     * The default calls intersects() again.
+     * @param start Ray's starting point, as find_hit() got it.
+     * @param direction Ray's direction vector, as find_hit() got it.
+     * @param lazy What find_hit() set.
+     * @param hit The hit to set, _shape included.
+     */
+    virtual void finalize_hit(const vec3& start, const vec3& direction,
+                              const Lazy_Hit& lazy, Hit& hit) const;
+
+    /** Same as find_hit(), but also tell a trace about the test
+     * (for debugging a ray). The default calls find_hit(); shapes
+     * made of other shapes trace those too.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if this one is closer.
+     * @param trace The trace.
+     * @return true if the ray hits the shape before hit._t.
+     */
+    virtual bool trace_hit(const vec3& start, const vec3& direction,
+                           Lazy_Hit& hit, Ray_Trace& trace) const;
+
+    /** Get a box that contains the whole shape.
+     * THIS METHOD IS ABSTRACT, so child classes MUST implement it.
+     * @return The shape's bounds.
+     */
+    virtual Bounding_Box bounds() const = 0;
+
+    /** Move the shape (for animation).
+     * THIS METHOD IS ABSTRACT, so child classes MUST implement it.
+     * @param offset How far to move it.
+     */
+    virtual void translate(const vec3& offset) = 0;
+
+    /** Does the shape block a ray before it goes a given distance?
+     * Used for shadows, so it only needs a yes/no answer.
+     * The default calls intersects(); child classes may do
+     * something cheaper.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore. Callers check it against this shape
+     *             themselves; shapes made of other shapes pass it on.
+     * @return true if the ray hits the shape before t_max.
+     */
+    virtual bool occludes(const vec3& start, const vec3& direction,
+                          float t_max, const Shape *skip) const;
+
+    /** Does the shape shadow itself at a hit point?
+     * Shadow rays skip the shape they start on, so curved shapes use
+     * this to darken the side that faces away from the light.
+     * The default is false, which is right for flat shapes.
+     * @param hit A hit on the shape's surface.
+     * @param L Unit vector from the hit point towards the light.
+     * @return true if the light is behind the surface at the point.
+     */
+    virtual bool shadows_itself(const Hit& hit, const vec3& L) const;
+
+    /** The shape's name (for debugging).
+     * The scene keeps its shapes' names in an array of their own,
+     * so that a shape's memory holds only what rays need.
+     * @param names The scene's shape names.
+     * @return The name.
+     */
+    const string& name(const vector<string>& names) const;
 
-    /** The shape's material */
-    Material _material;
-    /** The shape's name (for debugging) */
-    string _name;
+    /** Index of the shape's material, in the scene's Material_Table */
+    int _material;
+    /** Index of the shape's name, in the scene's shape names */
+    int _name;
 };
 
 #endif
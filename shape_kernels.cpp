@@ -0,0 +1,402 @@
+#include "shape_kernels.hpp"
+#include "lanes.hpp"
+
+#include <cmath>
+#include <glm/geometric.hpp>
+
+/* The kernels below work on lanes (see lanes.hpp): one float per
+ * primitive, as many primitives as fit in a SIMD register.
+ *
+ * Every lane does the same float operations, in the same order, as
+ * the records in shape_records.hpp do for one primitive. SIMD add,
+ * multiply, divide and square root round exactly like scalar ones, so
+ * the answers are the same, bit for bit. (That needs the compiler not
+ * to fuse multiplies and adds, see -ffp-contract in local.mak.)
+ */
+
+// Clear out the values of a field, keeping the padding.
+static void reset(vector<float>& field) {
+    field.assign(KERNEL_PADDING, 0.0f);
+}
+
+// Add a value to a field, before the padding.
+static void append(vector<float>& field, int count, float value) {
+    field[count] = value;
+    field.push_back(0.0f);
+}
+
+Sphere_Arrays::Sphere_Arrays()
+{
+    clear();
+}
+
+void Sphere_Arrays::clear() {
+    _count = 0;
+    reset(_x);
+    reset(_y);
+    reset(_z);
+    reset(_radius);
+    _records.clear();
+}
+
+void Sphere_Arrays::push_back(const Sphere_Record& sphere) {
+    append(_x, _count, sphere._center.x);
+    append(_y, _count, sphere._center.y);
+    append(_z, _count, sphere._center.z);
+    append(_radius, _count, sphere._radius);
+    _records.push_back(sphere);
+    _count++;
+}
+
+void Sphere_Arrays::set(int i, const Sphere_Record& sphere) {
+    _x[i] = sphere._center.x;
+    _y[i] = sphere._center.y;
+    _z[i] = sphere._center.z;
+    _radius[i] = sphere._radius;
+    _records[i] = sphere;
+}
+
+Cylinder_Arrays::Cylinder_Arrays()
+{
+    clear();
+}
+
+void Cylinder_Arrays::clear() {
+    _count = 0;
+    reset(_x);
+    reset(_y);
+    reset(_z);
+    reset(_radius);
+    reset(_height);
+    _records.clear();
+}
+
+void Cylinder_Arrays::push_back(const Cylinder_Record& cylinder) {
+    append(_x, _count, cylinder._center.x);
+    append(_y, _count, cylinder._center.y);
+    append(_z, _count, cylinder._center.z);
+    append(_radius, _count, cylinder._radius);
+    append(_height, _count, cylinder._height);
+    _records.push_back(cylinder);
+    _count++;
+}
+
+void Cylinder_Arrays::set(int i, const Cylinder_Record& cylinder) {
+    _x[i] = cylinder._center.x;
+    _y[i] = cylinder._center.y;
+    _z[i] = cylinder._center.z;
+    _radius[i] = cylinder._radius;
+    _height[i] = cylinder._height;
+    _records[i] = cylinder;
+}
+
+Triangle_Arrays::Triangle_Arrays()
+{
+    clear();
+}
+
+void Triangle_Arrays::clear() {
+    _count = 0;
+    vector<float> *fields[] = {&_ax, &_ay, &_az, &_e1x, &_e1y, &_e1z,
+                               &_e2x, &_e2y, &_e2z};
+    for (vector<float> *field : fields) {
+        reset(*field);
+    }
+    _records.clear();
+}
+
+void Triangle_Arrays::push_back(const Triangle_Record& triangle) {
+    _count++;
+    vector<float> *fields[] = {&_ax, &_ay, &_az, &_e1x, &_e1y, &_e1z,
+                               &_e2x, &_e2y, &_e2z};
+    for (vector<float> *field : fields) {
+        field->push_back(0.0f);
+    }
+    _records.push_back(triangle);
+    set(_count - 1, triangle);
+}
+
+void Triangle_Arrays::set(int i, const Triangle_Record& triangle) {
+    _ax[i] = triangle._A.x;
+    _ay[i] = triangle._A.y;
+    _az[i] = triangle._A.z;
+    _e1x[i] = triangle._E1.x;
+    _e1y[i] = triangle._E1.y;
+    _e1z[i] = triangle._E1.z;
+    _e2x[i] = triangle._E2.x;
+    _e2y[i] = triangle._E2.y;
+    _e2z[i] = triangle._E2.z;
+    _records[i] = triangle;
+}
+
+int nearest_sphere_scalar(const Sphere_Arrays& spheres, int begin, int end,
+                          const vec3& start, const vec3& direction, float& t) {
+    int nearest = -1;
+    for (int i = begin; i < end; i++) {
+        float t_hit;
+        int part;
+        if (spheres.get(i).intersect(start, direction, t_hit, part)
+            && t_hit < t) {
+            t = t_hit;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+int nearest_cylinder_scalar(const Cylinder_Arrays& cylinders, int begin,
+                            int end, const vec3& start, const vec3& direction,
+                            float& t) {
+    int nearest = -1;
+    for (int i = begin; i < end; i++) {
+        float t_hit;
+        int part;
+        if (cylinders.get(i).intersect(start, direction, t_hit, part)
+            && t_hit < t) {
+            t = t_hit;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+int nearest_triangle_scalar(const Triangle_Arrays& triangles, int begin,
+                            int end, const vec3& start, const vec3& direction,
+                            float& t) {
+    int nearest = -1;
+    for (int i = begin; i < end; i++) {
+        float t_hit;
+        int part;
+        if (triangles.get(i).intersect(start, direction, t_hit, part)
+            && t_hit < t) {
+            t = t_hit;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+#ifdef KERNEL_LANES
+
+// The records compare floats with the double RECORD_EPSILON.
+// For a float t, t >= RECORD_EPSILON just when t >= this.
+static float lane_epsilon() {
+    float epsilon = (float)RECORD_EPSILON;
+    if ((double)epsilon < RECORD_EPSILON) {
+        epsilon = std::nextafter(epsilon, 1.0f);
+    }
+    return epsilon;
+}
+
+// Bits for the lanes that hold primitives, when count are left.
+static int live_lanes(int count) {
+    return (count >= Lanes::WIDTH) ? (1 << Lanes::WIDTH) - 1
+        : (1 << count) - 1;
+}
+
+// Of the lanes in hits, pick the nearest one that is nearer than t
+// (the lowest lane, if some tie), and update t and nearest.
+static void keep_nearest(int hits, Lanes::F t_hit, int first,
+                         float& t, int& nearest) {
+    float t_lanes[Lanes::WIDTH];
+    Lanes::store(t_lanes, t_hit);
+    for (; hits != 0; hits &= hits - 1) {
+        int lane = __builtin_ctz(hits);
+        if (t_lanes[lane] < t) {
+            t = t_lanes[lane];
+            nearest = first + lane;
+        }
+    }
+}
+
+int nearest_sphere(const Sphere_Arrays& spheres, int begin, int end,
+                   const vec3& start, const vec3& direction, float& t) {
+    typedef Lanes L;
+    // The same for every sphere. 2a and 4a are exact.
+    float a = glm::dot(direction, direction);
+    L::F two_a = L::set(2 * a);
+    L::F four_a = L::set(4 * a);
+    L::F two = L::set(2);
+    L::F epsilon = L::set(lane_epsilon());
+    L::F dx = L::set(direction.x), dy = L::set(direction.y), dz = L::set(direction.z);
+    L::F sx = L::set(start.x), sy = L::set(start.y), sz = L::set(start.z);
+
+    int nearest = -1;
+    for (int i = begin; i < end; i += L::WIDTH) {
+        L::F ox = L::sub(sx, L::load(&spheres._x[i]));
+        L::F oy = L::sub(sy, L::load(&spheres._y[i]));
+        L::F oz = L::sub(sz, L::load(&spheres._z[i]));
+        L::F r = L::load(&spheres._radius[i]);
+
+        L::F b = L::mul(two, L::add(L::add(L::mul(dx, ox), L::mul(dy, oy)),
+                                    L::mul(dz, oz)));
+        L::F c = L::sub(L::add(L::add(L::mul(ox, ox), L::mul(oy, oy)),
+                               L::mul(oz, oz)),
+                        L::mul(r, r));
+        L::F d = L::sub(L::mul(b, b), L::mul(four_a, c));
+        // A NaN where d < 0, which fails every compare below.
+        L::F root = L::sqrt(d);
+        L::F minus_b = L::neg(b);
+        L::F t1 = L::div(L::sub(minus_b, root), two_a);
+        L::F t2 = L::div(L::add(minus_b, root), two_a);
+
+        L::Mask use_t1 = L::ge(t1, epsilon);
+        L::F t_hit = L::select(use_t1, t1, t2);
+        L::Mask valid = L::either(use_t1, L::ge(t2, epsilon));
+        int hits = L::bits(L::both(valid, L::lt(t_hit, L::set(t))))
+            & live_lanes(end - i);
+        if (hits != 0) { keep_nearest(hits, t_hit, i, t, nearest); }
+    }
+    return nearest;
+}
+
+int nearest_cylinder(const Cylinder_Arrays& cylinders, int begin, int end,
+                     const vec3& start, const vec3& direction, float& t) {
+    typedef Lanes L;
+    // The side is a circle in the xz plane; a is the same for every one.
+    float a = direction.x * direction.x + direction.z * direction.z;
+    L::F two_a = L::set(2.0f * a);
+    L::F four_a = L::set(4 * a);
+    L::F two = L::set(2);
+    L::F epsilon = L::set(lane_epsilon());
+    L::F dx = L::set(direction.x), dy = L::set(direction.y), dz = L::set(direction.z);
+    L::F sx = L::set(start.x), sy = L::set(start.y), sz = L::set(start.z);
+
+    int nearest = -1;
+    for (int i = begin; i < end; i += L::WIDTH) {
+        L::F cx = L::load(&cylinders._x[i]);
+        L::F cy = L::load(&cylinders._y[i]);
+        L::F cz = L::load(&cylinders._z[i]);
+        L::F r = L::load(&cylinders._radius[i]);
+        L::F half = L::div(L::load(&cylinders._height[i]), two);
+        L::F rad2 = L::mul(r, r);
+        L::F ox = L::sub(sx, cx);
+        L::F oz = L::sub(sz, cz);
+
+        // The side...
+        L::F b = L::mul(two, L::add(L::mul(dx, ox), L::mul(dz, oz)));
+        L::F c = L::sub(L::add(L::mul(ox, ox), L::mul(oz, oz)), rad2);
+        L::F d = L::sub(L::mul(b, b), L::mul(four_a, c));
+        L::F root = L::sqrt(d);
+        L::F minus_b = L::neg(b);
+        L::F t1 = L::div(L::add(minus_b, root), two_a);
+        L::F t2 = L::div(L::sub(minus_b, root), two_a);
+        L::F t_side = L::select(L::lt(t1, t2), t1, t2);
+        L::F y = L::add(sy, L::mul(t_side, dy));
+        L::Mask side = L::both(L::ge(t_side, epsilon),
+                               L::both(L::ge(y, L::sub(cy, half)),
+                                       L::le(y, L::add(cy, half))));
+
+        // ...then the top...
+        L::F t_top = L::div(L::sub(L::add(cy, half), sy), dy);
+        L::F x = L::sub(L::add(sx, L::mul(t_top, dx)), cx);
+        L::F z = L::sub(L::add(sz, L::mul(t_top, dz)), cz);
+        L::Mask top = L::both(L::ge(t_top, epsilon),
+                              L::lt(L::add(L::mul(x, x), L::mul(z, z)), rad2));
+
+        // ...then the bottom, as Cylinder_Record::intersect() does.
+        L::F t_bottom = L::div(L::sub(L::sub(cy, half), sy), dy);
+        x = L::sub(L::add(sx, L::mul(t_bottom, dx)), cx);
+        z = L::sub(L::add(sz, L::mul(t_bottom, dz)), cz);
+        L::Mask bottom = L::both(L::ge(t_bottom, epsilon),
+                                 L::lt(L::add(L::mul(x, x), L::mul(z, z)), rad2));
+
+        L::F t_hit = L::select(side, t_side, L::select(top, t_top, t_bottom));
+        L::Mask valid = L::either(side, L::either(top, bottom));
+        int hits = L::bits(L::both(valid, L::lt(t_hit, L::set(t))))
+            & live_lanes(end - i);
+        if (hits != 0) { keep_nearest(hits, t_hit, i, t, nearest); }
+    }
+    return nearest;
+}
+
+int nearest_triangle(const Triangle_Arrays& triangles, int begin, int end,
+                     const vec3& start, const vec3& direction, float& t) {
+    typedef Lanes L;
+    L::F one = L::set(1);
+    L::F zero = L::set(0);
+    L::F epsilon = L::set(lane_epsilon());
+    L::F dx = L::set(direction.x), dy = L::set(direction.y), dz = L::set(direction.z);
+    L::F sx = L::set(start.x), sy = L::set(start.y), sz = L::set(start.z);
+
+    int nearest = -1;
+    for (int i = begin; i < end; i += L::WIDTH) {
+        L::F e1x = L::load(&triangles._e1x[i]);
+        L::F e1y = L::load(&triangles._e1y[i]);
+        L::F e1z = L::load(&triangles._e1z[i]);
+        L::F e2x = L::load(&triangles._e2x[i]);
+        L::F e2y = L::load(&triangles._e2y[i]);
+        L::F e2z = L::load(&triangles._e2z[i]);
+
+        // P = cross(direction, E2), det = dot(E1, P)
+        L::F px = L::sub(L::mul(dy, e2z), L::mul(dz, e2y));
+        L::F py = L::sub(L::mul(dz, e2x), L::mul(dx, e2z));
+        L::F pz = L::sub(L::mul(dx, e2y), L::mul(dy, e2x));
+        L::F det = L::add(L::add(L::mul(e1x, px), L::mul(e1y, py)),
+                          L::mul(e1z, pz));
+        L::F inv_det = L::div(one, det);
+
+        // T = start - A, u = dot(T, P) / det
+        L::F tx = L::sub(sx, L::load(&triangles._ax[i]));
+        L::F ty = L::sub(sy, L::load(&triangles._ay[i]));
+        L::F tz = L::sub(sz, L::load(&triangles._az[i]));
+        L::F u = L::mul(L::add(L::add(L::mul(tx, px), L::mul(ty, py)),
+                               L::mul(tz, pz)),
+                        inv_det);
+
+        // Q = cross(T, E1), v = dot(direction, Q) / det, t = dot(E2, Q) / det
+        L::F qx = L::sub(L::mul(ty, e1z), L::mul(tz, e1y));
+        L::F qy = L::sub(L::mul(tz, e1x), L::mul(tx, e1z));
+        L::F qz = L::sub(L::mul(tx, e1y), L::mul(ty, e1x));
+        L::F v = L::mul(L::add(L::add(L::mul(dx, qx), L::mul(dy, qy)),
+                               L::mul(dz, qz)),
+                        inv_det);
+        L::F t_hit = L::mul(L::add(L::add(L::mul(e2x, qx), L::mul(e2y, qy)),
+                                   L::mul(e2z, qz)),
+                            inv_det);
+
+        L::Mask valid = L::both(L::both(L::ge(u, zero), L::le(u, one)),
+                                L::both(L::ge(v, zero),
+                                        L::le(L::add(u, v), one)));
+        valid = L::both(valid, L::ge(t_hit, epsilon));
+        int hits = L::bits(L::both(valid, L::lt(t_hit, L::set(t))))
+            & live_lanes(end - i);
+        if (hits != 0) { keep_nearest(hits, t_hit, i, t, nearest); }
+    }
+    return nearest;
+}
+
+const char *kernel_isa() {
+    return KERNEL_LANES;
+}
+
+int kernel_width() {
+    return Lanes::WIDTH;
+}
+
+#else
+
+int nearest_sphere(const Sphere_Arrays& spheres, int begin, int end,
+                   const vec3& start, const vec3& direction, float& t) {
+    return nearest_sphere_scalar(spheres, begin, end, start, direction, t);
+}
+
+int nearest_cylinder(const Cylinder_Arrays& cylinders, int begin, int end,
+                     const vec3& start, const vec3& direction, float& t) {
+    return nearest_cylinder_scalar(cylinders, begin, end, start, direction, t);
+}
+
+int nearest_triangle(const Triangle_Arrays& triangles, int begin, int end,
+                     const vec3& start, const vec3& direction, float& t) {
+    return nearest_triangle_scalar(triangles, begin, end, start, direction, t);
+}
+
+const char *kernel_isa() {
+    return "scalar";
+}
+
+int kernel_width() {
+    return 1;
+}
+
+#endif
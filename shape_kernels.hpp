@@ -0,0 +1,142 @@
+#ifndef _SHAPE_KERNELS_HPP
+#define _SHAPE_KERNELS_HPP
+
+#include <glm/vec3.hpp>
+#include <vector>
+#include "shape_records.hpp"
+
+using glm::vec3;
+using std::vector;
+
+// The most primitives a kernel tests at once (16 floats with AVX-512).
+// The arrays below have this many unused entries at the end, so a
+// kernel can load a whole batch starting at any primitive.
+#define KERNEL_PADDING 16
+
+struct Sphere_Arrays {
+    /** Spheres, as one array per field (structure of arrays),
+     * for the kernels to load several at a time.
+     */
+
+    /** Constructor.
+     * Makes an empty list.
+     */
+    Sphere_Arrays();
+
+    void clear();
+    void push_back(const Sphere_Record& sphere);
+    void set(int i, const Sphere_Record& sphere);
+    const Sphere_Record& get(int i) const { return _records[i]; }
+
+    /** Number of spheres */
+    int _count;
+    vector<float> _x, _y, _z, _radius;
+    /** The same spheres, a whole record each, for testing one at a time
+     * (which would touch a cache line per field above)
+     */
+    vector<Sphere_Record> _records;
+};
+
+struct Cylinder_Arrays {
+    /** Upright cylinders, as one array per field. */
+
+    /** Constructor.
+     * Makes an empty list.
+     */
+    Cylinder_Arrays();
+
+    void clear();
+    void push_back(const Cylinder_Record& cylinder);
+    void set(int i, const Cylinder_Record& cylinder);
+    const Cylinder_Record& get(int i) const { return _records[i]; }
+
+    /** Number of cylinders */
+    int _count;
+    vector<float> _x, _y, _z, _radius, _height;
+    /** The same cylinders, a whole record each */
+    vector<Cylinder_Record> _records;
+};
+
+struct Triangle_Arrays {
+    /** Triangles, as one array per field: a corner,
+     * and the two edges from it.
+     */
+
+    /** Constructor.
+     * Makes an empty list.
+     */
+    Triangle_Arrays();
+
+    void clear();
+    void push_back(const Triangle_Record& triangle);
+    void set(int i, const Triangle_Record& triangle);
+    const Triangle_Record& get(int i) const { return _records[i]; }
+
+    /** Number of triangles */
+    int _count;
+    vector<float> _ax, _ay, _az;
+    vector<float> _e1x, _e1y, _e1z;
+    vector<float> _e2x, _e2y, _e2z;
+    /** The same triangles, a whole record each (with the normal,
+     * which only a hit needs)
+     */
+    vector<Triangle_Record> _records;
+};
+
+/** Finds the nearest of spheres [begin, end) that a ray hits.
+ * Tests kernel_width() spheres at a time with SIMD instructions,
+ * and gives exactly the same answer as nearest_sphere_scalar().
+ * @param start Ray's starting point.
+ * @param direction Ray's direction vector.
+ * @param t Hits at or beyond this distance don't count.
+ *          Set to the nearest hit's distance, if there is one.
+ * @return Index of the nearest sphere hit (the first one, if some
+ *         tie), or -1 if none is.
+ */
+int nearest_sphere(const Sphere_Arrays& spheres, int begin, int end,
+                   const vec3& start, const vec3& direction, float& t);
+
+/** Same as nearest_sphere(), one sphere at a time, using
+ * Sphere_Record::intersect() (which Sphere::intersects() uses too).
+ */
+int nearest_sphere_scalar(const Sphere_Arrays& spheres, int begin, int end,
+                          const vec3& start, const vec3& direction, float& t);
+
+/** Finds the nearest of cylinders [begin, end) that a ray hits.
+ * Like nearest_sphere(), and exactly the same as
+ * nearest_cylinder_scalar().
+ */
+int nearest_cylinder(const Cylinder_Arrays& cylinders, int begin, int end,
+                     const vec3& start, const vec3& direction, float& t);
+
+/** Same as nearest_cylinder(), one cylinder at a time, using
+ * Cylinder_Record::intersect().
+ */
+int nearest_cylinder_scalar(const Cylinder_Arrays& cylinders, int begin,
+                            int end, const vec3& start, const vec3& direction,
+                            float& t);
+
+/** Finds the nearest of triangles [begin, end) that a ray hits.
+ * Like nearest_sphere(), and exactly the same as
+ * nearest_triangle_scalar().
+ */
+int nearest_triangle(const Triangle_Arrays& triangles, int begin, int end,
+                     const vec3& start, const vec3& direction, float& t);
+
+/** Same as nearest_triangle(), one triangle at a time, using
+ * Triangle_Record::intersect().
+ */
+int nearest_triangle_scalar(const Triangle_Arrays& triangles, int begin,
+                            int end, const vec3& start, const vec3& direction,
+                            float& t);
+
+/** The instruction set the kernels were compiled for:
+ * "avx512", "avx", "sse2" or "scalar".
+ */
+const char *kernel_isa();
+
+/** How many primitives the kernels test at once.
+ */
+int kernel_width();
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef _SHAPE_RECORDS_HPP
+#define _SHAPE_RECORDS_HPP
+
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+#include <cmath>
+
+using glm::vec3;
+
+// Hits closer than this to the ray's start don't count
+// (so that a ray doesn't hit the surface it starts on).
+#define RECORD_EPSILON 0.001
+
+// Which part of a cylinder a ray hit.
+#define CYLINDER_SIDE 0
+#define CYLINDER_TOP 1
+#define CYLINDER_BOTTOM 2
+
+/* Plain copies of the geometry of the built-in shapes, with the
+ * intersection math that the shapes themselves use. Accelerators keep
+ * them in arrays, one per kind of shape, and test rays against them
+ * without a virtual call, or a trip to the shape and its material.
+ *
+ * Every record has the same two functions:
+ *   bool intersect(start, direction, float& t, int& part) const
+ *       Sets t (and which part of the shape was hit) if the ray hits.
+ *   vec3 normal(point, part) const
+ *       The surface normal at a point that intersect() found.
+ */
+
+struct Sphere_Record {
+    vec3 _center;
+    float _radius;
+
+    bool intersect(const vec3& start, const vec3& direction,
+                   float& t, int& part) const {
+        float a = glm::dot(direction, direction);
+        float b = 2.0 * glm::dot(direction, start - _center);
+        float c = glm::dot(start - _center, start - _center) - _radius * _radius;
+        float d = b * b - 4 * a * c;
+        if (d < 0) { return false; }
+        float root = std::sqrt(d);
+        float t1 = (-b - root) / (2 * a);
+        float t2 = (-b + root) / (2 * a);
+        t = (t1 >= RECORD_EPSILON) ? t1 : (t2 >= RECORD_EPSILON) ? t2 : -1.0;
+        part = 0;
+        return t >= 0;
+    }
+
+    vec3 normal(const vec3& point, int part) const {
+        return glm::normalize(point - _center);
+    }
+
+    /** Does the sphere block the ray before t_max?
+     * Cheaper than intersect(), as it needn't tell which root is nearer.
+     */
+    bool occludes(const vec3& start, const vec3& direction, float t_max) const {
+        vec3 to_start = start - _center;
+        float a = glm::dot(direction, direction);
+        float half_b = glm::dot(direction, to_start);
+        float c = glm::dot(to_start, to_start) - _radius * _radius;
+        float d = half_b * half_b - a * c;
+        if (d < 0) { return false; }
+        float root = std::sqrt(d);
+        float t1 = (-half_b - root) / a;
+        float t2 = (-half_b + root) / a;
+        float t = (t1 >= RECORD_EPSILON) ? t1 : t2;
+        return t >= RECORD_EPSILON && t < t_max;
+    }
+};
+
+struct Triangle_Record {
+    /** First corner, the edges from it to the other two,
+     * and the unit normal of the plane through them
+     */
+    vec3 _A, _E1, _E2;
+    vec3 _normal;
+
+    bool intersect(const vec3& start, const vec3& direction,
+                   float& t, int& part) const {
+        // Moller-Trumbore: solve start + t * direction = A + u * E1 + v * E2.
+        // A ray parallel to the triangle has det == 0, which makes u
+        // infinite or NaN, so it fails the test on u.
+        vec3 P = glm::cross(direction, _E2);
+        float det = glm::dot(_E1, P);
+        float inv_det = 1 / det;
+        vec3 T = start - _A;
+        float u = glm::dot(T, P) * inv_det;
+        if (!(u >= 0 && u <= 1)) { return false; }
+        vec3 Q = glm::cross(T, _E1);
+        float v = glm::dot(direction, Q) * inv_det;
+        if (!(v >= 0 && u + v <= 1)) { return false; }
+        float t_hit = glm::dot(_E2, Q) * inv_det;
+        if (!(t_hit >= RECORD_EPSILON)) { return false; }
+        t = t_hit;
+        part = 0;
+        return true;
+    }
+
+    vec3 normal(const vec3& point, int part) const {
+        return _normal;
+    }
+};
+
+struct Cylinder_Record {
+    /** An upright cylinder, capped at both ends */
+    vec3 _center;
+    float _radius;
+    float _height;
+
+    bool intersect(const vec3& start, const vec3& direction,
+                   float& t, int& part) const {
+        const vec3& center = _center;
+        float rad2 = _radius * _radius;
+        float cylinder_divide = _height / 2;
+
+        // The side: a circle, in the xz plane.
+        float a = direction.x * direction.x + direction.z * direction.z;
+        float b = 2.0f * (direction.x * (start.x - center.x) + direction.z * (start.z - center.z));
+        float c = (start.x - center.x) * (start.x - center.x) + (start.z - center.z) * (start.z - center.z) - rad2;
+        float d = b*b - 4*a*c;
+        float root = std::sqrt(d);
+        float t1 = (-b + root) / (2.0f * a);
+        float t2 = (-b - root) / (2.0f * a);
+        float t_side = (t1 < t2) ? t1 : t2;
+        float y = start.y + t_side * direction.y;
+        if (t_side >= RECORD_EPSILON
+            && y >= center.y - cylinder_divide && y <= center.y + cylinder_divide) {
+            t = t_side;
+            part = CYLINDER_SIDE;
+            return true;
+        }
+
+        float t_top = (center.y + cylinder_divide - start.y) / direction.y;
+        float x_calc = start.x + t_top * direction.x - center.x;
+        float z_calc = start.z + t_top * direction.z - center.z;
+        if (t_top >= RECORD_EPSILON && x_calc * x_calc + z_calc * z_calc < rad2) {
+            t = t_top;
+            part = CYLINDER_TOP;
+            return true;
+        }
+
+        float t_bottom = (center.y - cylinder_divide - start.y) / direction.y;
+        x_calc = start.x + t_bottom * direction.x - center.x;
+        z_calc = start.z + t_bottom * direction.z - center.z;
+        if (t_bottom >= RECORD_EPSILON && x_calc * x_calc + z_calc * z_calc < rad2) {
+            t = t_bottom;
+            part = CYLINDER_BOTTOM;
+            return true;
+        }
+        return false;
+    }
+
+    vec3 normal(const vec3& point, int part) const {
+        float cylinder_divide = _height / 2;
+        if (part == CYLINDER_SIDE) {
+            return glm::normalize(vec3(point.x, 0, point.z));
+        } else if (part == CYLINDER_TOP) {
+            vec3 Q_top = (_center.y + vec3(RECORD_EPSILON, cylinder_divide, RECORD_EPSILON));
+            return glm::normalize(point - Q_top);
+        }
+        vec3 Q_bottom = (_center - glm::vec3(0, cylinder_divide, 0));
+        return glm::normalize(Q_bottom);
+    }
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "shape_store.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "cylinder.hpp"
+
+Shape_Store::Shape_Store()
+{
+    ; // nothing to do: no shapes yet.
+}
+
+void Shape_Store::clear() {
+    _spheres.clear();
+    _triangles.clear();
+    _cylinders.clear();
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        _owners[kind].clear();
+    }
+}
+
+Shape_Store::Ref Shape_Store::add(Shape *shape) {
+    Ref ref;
+    if (Sphere *sphere = dynamic_cast<Sphere*>(shape)) {
+        ref._kind = SPHERE;
+        ref._index = _spheres._count;
+        _spheres.push_back(sphere->record());
+    } else if (Triangle *triangle = dynamic_cast<Triangle*>(shape)) {
+        ref._kind = TRIANGLE;
+        ref._index = _triangles._count;
+        _triangles.push_back(triangle->record());
+    } else if (Cylinder *cylinder = dynamic_cast<Cylinder*>(shape)) {
+        ref._kind = CYLINDER;
+        ref._index = _cylinders._count;
+        _cylinders.push_back(cylinder->record());
+    } else {
+        ref._kind = OTHER;
+        ref._index = (int)_owners[OTHER].size();
+    }
+    _owners[ref._kind].push_back(shape);
+    return ref;
+}
+
+void Shape_Store::build(const vector<Shape*>& shapes) {
+    clear();
+    for (Shape *shape : shapes) {
+        add(shape);
+    }
+}
+
+void Shape_Store::update(const Ref& ref) {
+    Shape *owner = shape(ref);
+    switch (ref._kind) {
+    case SPHERE:
+        _spheres.set(ref._index, dynamic_cast<Sphere*>(owner)->record());
+        break;
+    case TRIANGLE:
+        _triangles.set(ref._index, dynamic_cast<Triangle*>(owner)->record());
+        break;
+    case CYLINDER:
+        _cylinders.set(ref._index, dynamic_cast<Cylinder*>(owner)->record());
+        break;
+    default:
+        break; // other shapes are used as they are
+    }
+}
+
+bool Shape_Store::first_hit(const vec3& start, const vec3& direction,
+                            float t_max, Hit& hit) const {
+    Lazy_Hit nearest(t_max);
+    bool found = false;
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        if (first_hit_in_range(kind, 0, (int)_owners[kind].size(),
+                               start, direction, nearest)) {
+            found = true;
+        }
+    }
+    if (found) { nearest.finalize(start, direction, hit); }
+    return found;
+}
+
+bool Shape_Store::first_hit(const Ref *refs, int count, const vec3& start,
+                            const vec3& direction, Lazy_Hit& hit) const {
+    bool found = false;
+    int i = 0;
+    while (i < count) {
+        // The longest run of one kind, side by side in its array.
+        int run = 1;
+        while (i + run < count && refs[i + run]._kind == refs[i]._kind
+               && refs[i + run]._index == refs[i]._index + run) {
+            run++;
+        }
+        if (first_hit_in_range(refs[i]._kind, refs[i]._index, run,
+                               start, direction, hit)) {
+            found = true;
+        }
+        i += run;
+    }
+    return found;
+}
+
+bool Shape_Store::first_hit_in_range(int kind, int first, int count,
+                                     const vec3& start, const vec3& direction,
+                                     Lazy_Hit& hit) const {
+    Ref ref;
+    ref._kind = kind;
+    if (count > 1 && kind != OTHER) {
+        float t = hit._t;
+        int last = first + count;
+        if (kind == SPHERE) {
+            ref._index = nearest_sphere(_spheres, first, last, start, direction, t);
+        } else if (kind == TRIANGLE) {
+            ref._index = nearest_triangle(_triangles, first, last, start, direction, t);
+        } else {
+            ref._index = nearest_cylinder(_cylinders, first, last, start, direction, t);
+        }
+        if (ref._index < 0) { return false; }
+        // The kernels don't say which part was hit, so test the
+        // nearest one again (they give exactly the same t).
+        return find_hit(ref, start, direction, hit);
+    }
+
+    bool found = false;
+    for (ref._index = first; ref._index < first + count; ref._index++) {
+        if (find_hit(ref, start, direction, hit)) {
+            found = true;
+        }
+    }
+    return found;
+}
+
+Shape *Shape_Store::any_hit(const vec3& start, const vec3& direction,
+                            float t_max, const Shape *skip) const {
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        Ref ref;
+        ref._kind = kind;
+        for (ref._index = 0; ref._index < (int)_owners[kind].size(); ref._index++) {
+            Shape *s = shape(ref);
+            if (s != skip && occludes(ref, start, direction, t_max, skip)) {
+                return s;
+            }
+        }
+    }
+    return nullptr;
+}
+
+int Shape_Store::size() const {
+    int count = 0;
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        count += (int)_owners[kind].size();
+    }
+    return count;
+}
+
+void Shape_Store::print_stats(ostream& os) const {
+    os << _spheres._count << " spheres, " << _triangles._count
+       << " triangles, " << _cylinders._count << " cylinders, "
+       << _owners[OTHER].size() << " other shapes, "
+       << kernel_isa() << " kernels";
+}
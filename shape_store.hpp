@@ -0,0 +1,200 @@
+#ifndef _SHAPE_STORE_HPP
+#define _SHAPE_STORE_HPP
+
+#include <glm/vec3.hpp>
+#include <iostream>
+#include <vector>
+#include "shape.hpp"
+#include "shape_records.hpp"
+#include "shape_kernels.hpp"
+#include "hit.hpp"
+
+using glm::vec3;
+using std::ostream;
+using std::vector;
+
+class Shape_Store {
+    /** The scene's shapes, sorted into one array per kind of shape.
+     * Spheres, triangles and cylinders are kept as plain records
+     * (see shape_records.hpp), and tested with a switch on their kind
+     * instead of a virtual call. Anything else (instances, say) is
+     * kept as a Shape*, and goes through its virtual functions.
+     * Each kind is stored a field per array, so that the kernels
+     * in shape_kernels.hpp can test several shapes at once.
+     * Each record also remembers the Shape it came from, for its
+     * material, and for debugging.
+     */
+ public:
+    /** Kinds of shape, each with its own array */
+    enum Kind { SPHERE, TRIANGLE, CYLINDER, OTHER, NUM_KINDS };
+
+    struct Ref {
+        /** Which array the shape is in */
+        int _kind;
+        /** Where it is in that array */
+        int _index;
+    };
+
+    /** Constructor.
+     * Makes an empty store.
+     */
+    Shape_Store();
+
+    /** Throw away all the shapes.
+     */
+    void clear();
+
+    /** Copy a shape into the array for its kind.
+     * Shapes added one after the other sit side by side, so an
+     * accelerator that adds its shapes in leaf order gets each
+     * leaf's records together.
+     * @param shape The shape.
+     * @return Where its record is.
+     */
+    Ref add(Shape *shape);
+
+    /** Throw away all the shapes, and add these ones.
+     * @param shapes The shapes.
+     */
+    void build(const vector<Shape*>& shapes);
+
+    /** Copy a shape's geometry again, after it has moved.
+     * @param ref Where its record is.
+     */
+    void update(const Ref& ref);
+
+    /** The shape a record came from.
+     * @param ref Where the record is.
+     * @return The shape.
+     */
+    Shape *shape(const Ref& ref) const {
+        return _owners[ref._kind][ref._index];
+    }
+
+    /** Check if a ray hits one shape closer than hit._t,
+     * like Shape::find_hit().
+     * @param ref Where the shape's record is.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if this one is closer.
+     * @return true if the ray hits the shape before hit._t.
+     */
+    bool find_hit(const Ref& ref, const vec3& start,
+                  const vec3& direction, Lazy_Hit& hit) const {
+        if (ref._kind == OTHER) {
+            return shape(ref)->find_hit(start, direction, hit);
+        }
+        switch (ref._kind) {
+        case SPHERE:
+            return record_hit(_spheres.get(ref._index), ref, start, direction, hit);
+        case TRIANGLE:
+            return record_hit(_triangles.get(ref._index), ref, start, direction, hit);
+        default:
+            return record_hit(_cylinders.get(ref._index), ref, start, direction, hit);
+        }
+    }
+
+    /** Does one shape block a ray before it goes t_max?
+     * Like Shape::occludes().
+     * @param ref Where the shape's record is.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore, passed on to other shapes.
+     * @return true if the ray hits the shape before t_max.
+     */
+    bool occludes(const Ref& ref, const vec3& start, const vec3& direction,
+                  float t_max, const Shape *skip) const {
+        float t;
+        int part;
+        switch (ref._kind) {
+        case SPHERE:
+            return _spheres.get(ref._index).occludes(start, direction, t_max);
+        case TRIANGLE:
+            return _triangles.get(ref._index).intersect(start, direction, t, part)
+                && t < t_max;
+        case CYLINDER:
+            return _cylinders.get(ref._index).intersect(start, direction, t, part)
+                && t < t_max;
+        default:
+            return shape(ref)->occludes(start, direction, t_max, skip);
+        }
+    }
+
+    /** Finds the closest hit along a ray, testing every shape,
+     * one kind after the other.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits further than this don't count.
+     * @param hit Hit record, which will be set if there's a hit.
+     * @return true/false if the ray does/doesn't hit some Shape.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   float t_max, Hit& hit) const;
+
+    /** Finds the closest hit along a ray among some of the shapes
+     * (a leaf's, say). Runs of one kind that sit side by side
+     * in their array are tested together, by the kernels.
+     * Only keeps the distance and which shape was hit; call
+     * Lazy_Hit::finalize() for the rest, once the search is over.
+     * @param refs Where the shapes' records are.
+     * @param count Number of refs.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if there's a closer one.
+     * @return true if there was a hit closer than hit._t.
+     */
+    bool first_hit(const Ref *refs, int count, const vec3& start,
+                   const vec3& direction, Lazy_Hit& hit) const;
+
+    /** Finds some shape that blocks a ray (used for shadows).
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore (the one the ray starts on), or nullptr.
+     * @return The blocking shape, or nullptr if nothing blocks the ray.
+     */
+    Shape *any_hit(const vec3& start, const vec3& direction,
+                   float t_max, const Shape *skip) const;
+
+    /** Number of shapes, of all kinds.
+     * @return The shape count.
+     */
+    int size() const;
+
+    /** Print how many shapes there are of each kind,
+     * and which instruction set the kernels use.
+     * @param os The stream.
+     */
+    void print_stats(ostream& os) const;
+
+ private:
+    template <class Record>
+    bool record_hit(const Record& record, const Ref& ref, const vec3& start,
+                    const vec3& direction, Lazy_Hit& hit) const {
+        float t;
+        int part;
+        if (!record.intersect(start, direction, t, part) || !(t < hit._t)) {
+            return false;
+        }
+        hit.set(t, shape(ref), part);
+        return true;
+    }
+
+    /** Test the shapes in [first, first + count) of one kind's array,
+     * and keep the closest hit, as first_hit() does.
+     */
+    bool first_hit_in_range(int kind, int first, int count,
+                            const vec3& start, const vec3& direction,
+                            Lazy_Hit& hit) const;
+
+    Sphere_Arrays _spheres;
+    Triangle_Arrays _triangles;
+    Cylinder_Arrays _cylinders;
+    /** The shape each record came from, by kind; for OTHER,
+     * the shapes themselves.
+     */
+    vector<Shape*> _owners[NUM_KINDS];
+};
+
+#endif
@@ -1,6 +1,4 @@
 #include "sphere.hpp"
-#include "log.hpp"
-#include <math.h>
 #include <glm/vec3.hpp>
 #include <glm/gtx/string_cast.hpp>
 
@@ -10,44 +8,70 @@ using std::cout;
 using std::endl;
 using glm::to_string;
 
-#define EPSILON 0.001
-
 Sphere::Sphere(const vec3& center, float radius,
-               const Material& material,
-               const string& name)
+               int material,
+               int name)
     : Shape(material, name), _center(center), _radius(radius)
 {
     ; // nothing left to do
 }
 
 
-bool Sphere::intersects(const vec3& start, const vec3& direction, Hit& hit) {
-    if (Log::LEVEL > 0) {
-        Log::os() << "sphere::intersect. ray.P: " << to_string(start)
-                  << " ray.V:" << to_string(direction) << endl;
-    }
+bool Sphere::intersects(const vec3& start, const vec3& direction,
+                        Hit& hit) const {
+    Lazy_Hit lazy;
+    if (!find_hit(start, direction, lazy)) { return false; }
+    finalize_hit(start, direction, lazy, hit);
+    return true;
+}
 
-    Material* sphere_material = new Material();
-    
-    float a = dot(direction, direction);
-    float b = 2.0 * dot(direction, start - _center);
-    float c = dot(start - _center, start - _center) - _radius * _radius;
-    float d = b * b - 4 * a * c;
-    if (d < 0) { return false; }; 
-    float t1 = (-b - sqrt(d)) / (2 * a);
-    float t2 = (-b + sqrt(d)) / (2 * a);
-    float t = (t1 >= EPSILON) ? t1 : (t2 >= EPSILON) ? t2 : -1.0; 
-    if (t < 0) { return false; }
-
-    vec3 P_s = start + t * direction;
-    vec3 N = normalize(P_s - _center);
-    hit.set(P_s, &_material, N, t);
+bool Sphere::find_hit(const vec3& start, const vec3& direction,
+                      Lazy_Hit& hit) const {
+    float t;
+    int part;
+    if (!record().intersect(start, direction, t, part) || !(t < hit._t)) {
+        return false;
+    }
+    hit.set(t, this, part);
     return true;
 }
 
+void Sphere::finalize_hit(const vec3& start, const vec3& direction,
+                          const Lazy_Hit& lazy, Hit& hit) const {
+    vec3 P_s = start + lazy._t * direction;
+    hit.set(P_s, _material, record().normal(P_s, lazy._part), lazy._t);
+    hit._shape = this;
+    hit._instance = nullptr;
+}
+
+bool Sphere::occludes(const vec3& start, const vec3& direction, float t_max,
+                      const Shape *skip) const {
+    return record().occludes(start, direction, t_max);
+}
+
+bool Sphere::shadows_itself(const Hit& hit, const vec3& L) const {
+    return dot(hit._position - _center, L) < 0;
+}
+
+Bounding_Box Sphere::bounds() const {
+    vec3 r(_radius, _radius, _radius);
+    return Bounding_Box(_center - r, _center + r);
+}
+
+void Sphere::translate(const vec3& offset) {
+    _center += offset;
+}
+
+Sphere_Record Sphere::record() const {
+    Sphere_Record sphere;
+    sphere._center = _center;
+    sphere._radius = _radius;
+    return sphere;
+}
+
 
 ostream& operator<<(ostream& os, const Sphere& s) {
-    os << "Sphere(\"" << s._name << "\"\n"
+    os << "Sphere(name=" << s._name << "\n"
        << "       center=" << to_string(s._center) << "\n"
        << "       radius=" << s._radius << "\n"
        << "       material=" << s._material << ")";
@@ -4,6 +4,7 @@
 #include <glm/vec3.hpp>
 #include "shape.hpp"
 #include "hit.hpp"
+#include "shape_records.hpp"
 #include <iostream>
 
 using std::ostream;
@@ -14,11 +15,12 @@ class Sphere : public virtual Shape {
     /** Constructor.
      * @param center Position of the sphere's center.
      * @param radius Radius of the sphere.
-     * @param material Sphere's material.
+     * @param material Index of the sphere's material.
+     * @param name Index of the sphere's name.
      */
     Sphere(const vec3& center, float radius,
-           const Material& material,
-           const string& name);
+           int material,
+           int name);
 
     /** Check if a ray intersects the sphere.
      * If it does, return true, and set the hit parameter.
@@ -29,7 +31,58 @@ class Sphere : public virtual Shape {
      * @return true if there is an intersection, false otherwise.
      */
     bool intersects(const vec3& start,
-                    const vec3& direction, Hit& hit);
+                    const vec3& direction, Hit& hit) const;
+
+    /** Check if a ray hits the sphere closer than hit._t,
+     * without working out the point, normal or material.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param hit The closest hit so far, set if this one is closer.
+     * @return true if the ray hits the sphere before hit._t.
+     */
+    bool find_hit(const vec3& start, const vec3& direction,
+                  Lazy_Hit& hit) const;
+
+    /** Fill in the hit that find_hit() found.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param lazy What find_hit() set.
+     * @param hit The hit to set.
+     */
+    void finalize_hit(const vec3& start, const vec3& direction,
+                      const Lazy_Hit& lazy, Hit& hit) const;
+
+    /** Get a box that contains the whole sphere.
+     * @return The sphere's bounds.
+     */
+    Bounding_Box bounds() const;
+
+    /** Move the sphere.
+     * @param offset How far to move its center.
+     */
+    void translate(const vec3& offset);
+
+    /** Does the sphere block a ray before it goes t_max?
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip Ignored (a sphere has no parts to skip).
+     * @return true if the ray hits the sphere before t_max.
+     */
+    bool occludes(const vec3& start, const vec3& direction, float t_max,
+                  const Shape *skip) const;
+
+    /** Is the light behind the sphere's surface at a hit point?
+     * @param hit A hit on the sphere's surface.
+     * @param L Unit vector from the hit point towards the light.
+     * @return true if the point faces away from the light.
+     */
+    bool shadows_itself(const Hit& hit, const vec3& L) const;
+
+    /** Copy the sphere's geometry, for accelerators to keep.
+     * @return The sphere's center and radius.
+     */
+    Sphere_Record record() const;
 
     /** Sphere's center point */
     vec3 _center;
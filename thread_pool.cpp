@@ -0,0 +1,179 @@
+#include "thread_pool.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+
+// Which share of a batch this thread works on: 0 for threads
+// that call parallel_for() from outside, i for a pool's thread i.
+static thread_local int thread_slot = 0;
+
+Thread_Pool::Thread_Pool(int num_threads, bool pin)
+    : _batches_started(0), _stop(false)
+{
+    if (num_threads <= 0) {
+        num_threads = (int)std::thread::hardware_concurrency();
+    }
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 1; i < num_threads; i++) {
+        _threads.push_back(std::thread(&Thread_Pool::worker_loop, this, i));
+        if (pin) { pin_thread(_threads.back(), i % cores); }
+    }
+}
+
+Thread_Pool::~Thread_Pool() {
+    {
+        unique_lock<mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+int Thread_Pool::size() const {
+    return (int)_threads.size() + 1;
+}
+
+void Thread_Pool::pin_thread(std::thread& thread, int core) {
+#if defined(__linux__)
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cores), &cores);
+#endif
+}
+
+bool Thread_Pool::claim(Batch& batch, int& begin, int& end) {
+    int num_ranges = (int)batch._ranges.size();
+    int slot = thread_slot % num_ranges;
+    Range& own = batch._ranges[slot];
+    {
+        lock_guard<mutex> lock(own._mutex);
+        if (own._begin < own._end) {
+            begin = own._begin++;
+            end = begin + 1;
+            return true;
+        }
+    }
+
+    // Steal from the others, starting with the next one along.
+    for (int i = 1; i < num_ranges; i++) {
+        Range& victim = batch._ranges[(slot + i) % num_ranges];
+        {
+            lock_guard<mutex> lock(victim._mutex);
+            int left = victim._end - victim._begin;
+            if (left <= 0) { continue; }
+            end = victim._end;
+            begin = end - (left + 1) / 2;
+            victim._end = begin;
+        }
+
+        // Keep the rest where it can be stolen in turn. (Only if
+        // another thread with the same slot hasn't refilled the
+        // share in the meantime; then this thread runs them all.)
+        lock_guard<mutex> lock(own._mutex);
+        if (own._begin >= own._end) {
+            own._begin = begin + 1;
+            own._end = end;
+            end = begin + 1;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool Thread_Pool::help(unique_lock<mutex>& lock) {
+    if (_batches.empty()) { return false; }
+
+    // Newest first, so that nested batches finish before
+    // their parents hand out more work.
+    Batch *batch = _batches.back();
+    int started = _batches_started;
+    batch->_users++;
+    lock.unlock();
+
+    bool empty = false;
+    while (_batches_started == started) {
+        int begin, end;
+        if (!claim(*batch, begin, end)) {
+            empty = true;
+            break;
+        }
+        for (int i = begin; i < end; i++) {
+            (*batch->_task)(i);
+        }
+        if ((batch->_done += end - begin) == batch->_count) {
+            lock_guard<mutex> done_lock(_mutex);
+            _wake.notify_all();
+        }
+    }
+
+    lock.lock();
+    if (empty) {
+        auto it = std::find(_batches.begin(), _batches.end(), batch);
+        if (it != _batches.end()) { _batches.erase(it); }
+    }
+    batch->_users--;
+    if (batch->_users == 0) { _wake.notify_all(); }
+    return true;
+}
+
+void Thread_Pool::worker_loop(int slot) {
+    thread_slot = slot;
+    unique_lock<mutex> lock(_mutex);
+    while (!_stop) {
+        if (!help(lock)) {
+            _wake.wait(lock);
+        }
+    }
+}
+
+void Thread_Pool::parallel_for(int count, const function<void(int)>& task) {
+    if (count <= 0) { return; }
+    if (_threads.empty() || count == 1) {
+        for (int i = 0; i < count; i++) {
+            task(i);
+        }
+        return;
+    }
+
+    // Each thread's share starts out as an even slice.
+    int num_ranges = size();
+    Batch batch(num_ranges);
+    batch._task = &task;
+    batch._count = count;
+    for (int i = 0; i < num_ranges; i++) {
+        batch._ranges[i]._begin = (int)((long long)count * i / num_ranges);
+        batch._ranges[i]._end = (int)((long long)count * (i + 1) / num_ranges);
+    }
+    batch._done = 0;
+    batch._users = 0;
+
+    unique_lock<mutex> lock(_mutex);
+    _batches.push_back(&batch);
+    _batches_started++;
+    _wake.notify_all();
+
+    // Help out until every task in the batch is done.
+    while (batch._done < batch._count) {
+        if (!help(lock)) {
+            _wake.wait(lock);
+        }
+    }
+
+    // Then wait for the other threads to stop looking at it.
+    auto it = std::find(_batches.begin(), _batches.end(), &batch);
+    if (it != _batches.end()) { _batches.erase(it); }
+    while (batch._users > 0) {
+        _wake.wait(lock);
+    }
+}
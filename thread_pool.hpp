@@ -0,0 +1,118 @@
+#ifndef _THREAD_POOL_HPP
+#define _THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::function;
+using std::shared_ptr;
+using std::vector;
+
+class Thread_Pool {
+    /** A fixed set of threads that run numbered tasks.
+     * The thread that hands out the tasks helps to run them, so a
+     * task may itself call parallel_for() without deadlocking.
+     *
+     * Each thread gets its own share of a batch's task numbers, one
+     * run of them side by side, and works through it from the front.
+     * A thread that runs out steals half of what's left of another
+     * thread's share, from the back. So threads mostly only touch
+     * their own share, and neighbouring tasks (tiles of an image,
+     * say) mostly run on the same thread.
+     */
+ public:
+    /** Constructor.
+     * @param num_threads How many threads run tasks, counting the
+     *                    caller of parallel_for(). 0 or less means
+     *                    one per hardware thread.
+     * @param pin Whether to pin each of the pool's own threads to a
+     *            core (Linux only; the caller isn't pinned).
+     */
+    Thread_Pool(int num_threads, bool pin);
+
+    /** Destructor. Waits for the threads to finish.
+     */
+    ~Thread_Pool();
+
+    /** How many threads run tasks, counting the caller.
+     * @return The thread count.
+     */
+    int size() const;
+
+    /** Run task(0) ... task(count - 1), spread over the threads,
+     * in no particular order. Returns when they're all done.
+     * @param count Number of tasks.
+     * @param task What to do for each task number.
+     */
+    void parallel_for(int count, const function<void(int)>& task);
+
+ private:
+    /** One thread's share of a batch: task numbers [_begin, _end) */
+    struct Range {
+        std::mutex _mutex;
+        int _begin;
+        int _end;
+    };
+
+    struct Batch {
+        Batch(int num_ranges) : _ranges(num_ranges) {}
+
+        const function<void(int)> *_task;
+        int _count;
+        /** One share per thread (see claim()) */
+        vector<Range> _ranges;
+        /** How many tasks have finished */
+        std::atomic<int> _done;
+        /** How many threads are working on the batch (guarded by
+         * _mutex); it can't go away until they stop */
+        int _users;
+    };
+
+    /** Work on the newest batch, if there is one, until it has no
+     * more tasks to hand out, or a newer batch turns up.
+     * The lock is held on entry and on return, but not during tasks.
+     * @return false if there was no batch to work on.
+     */
+    bool help(std::unique_lock<std::mutex>& lock);
+
+    /** Claim tasks from a batch: the next one in the calling thread's
+     * share, or else half of what's left of another share, which
+     * becomes the thread's share.
+     * @param batch The batch.
+     * @param begin First task claimed.
+     * @param end One past the last task claimed (usually begin + 1).
+     * @return false if there was nothing left to claim.
+     */
+    bool claim(Batch& batch, int& begin, int& end);
+
+    void worker_loop(int slot);
+
+    /** Pin a thread to a core (if the platform can).
+     * @param thread The thread.
+     * @param core Which core.
+     */
+    static void pin_thread(std::thread& thread, int core);
+
+    // Not copyable: it owns its threads.
+    Thread_Pool(const Thread_Pool&);
+    Thread_Pool& operator=(const Thread_Pool&);
+
+    vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    /** Batches that may have tasks left to hand out, newest last */
+    vector<Batch*> _batches;
+    /** How many batches have been started (so a thread working on
+     * one can tell when there's a newer one) */
+    std::atomic<int> _batches_started;
+    bool _stop;
+};
+
+typedef shared_ptr<Thread_Pool> SP_Thread_Pool;
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "hit.hpp"
 #include "shape.hpp"
+#include "shape_records.hpp"
 
 class Triangle : public virtual Shape {
   /** A triangle in 3D space. */
@@ -11,10 +12,11 @@ public:
    * @param v1 First vertex.
    * @param v2 Second vertex.
    * @param v3 Third vertex.
-   * @param material Triangle's material.
+   * @param material Index of the triangle's material.
+   * @param name Index of the triangle's name.
    */
   Triangle(const vec3 &v1, const vec3 &v2, const vec3 &v3,
-           const Material &material, const string &name);
+           int material, int name);
 
   /** Check if a ray intersects the triangle.
    * If it does, return true, and set the hit parameter.
@@ -24,7 +26,43 @@ public:
    * @param hit A Hit object. Call its .set() method if there's an intersection
    * @return true if there is an intersection, false otherwise.
    */
-  bool intersects(const vec3 &start, const vec3 &direction, Hit &hit);
+  bool intersects(const vec3 &start, const vec3 &direction,
+                  Hit &hit) const;
+
+  /** Check if a ray hits the triangle closer than hit._t,
+   * without working out the point, normal or material.
+   * @param start Ray's starting point.
+   * @param direction Ray's direction vector.
+   * @param hit The closest hit so far, set if this one is closer.
+   * @return true if the ray hits the triangle before hit._t.
+   */
+  bool find_hit(const vec3 &start, const vec3 &direction,
+                Lazy_Hit &hit) const;
+
+  /** Fill in the hit that find_hit() found.
+   * @param start Ray's starting point.
+   * @param direction Ray's direction vector.
+   * @param lazy What find_hit() set.
+   * @param hit The hit to set.
+   */
+  void finalize_hit(const vec3 &start, const vec3 &direction,
+                    const Lazy_Hit &lazy, Hit &hit) const;
+
+  /** Get a box that contains the whole triangle.
+   * @return The triangle's bounds.
+   */
+  Bounding_Box bounds() const;
+
+  /** Move the triangle.
+   * @param offset How far to move each vertex.
+   */
+  void translate(const vec3 &offset);
+
+  /** Copy the triangle's geometry, for accelerators to keep.
+   * @return The triangle's vertices and normal.
+   */
+  Triangle_Record record() const;
+
   /** Check if a ray intersect the triangle.
    * Unlike the intersects(), this projects the triangle
    * onto 2D, and counts how many 2D edges cross a ray
@@ -34,7 +72,8 @@ public:
    * @param hit A Hit object. Call its .set() method if there's an intersection
    * @return true if there is an intersection, false otherwise.
    */
-  bool intersects2(const vec3 &start, const vec3 &direction, Hit &hit);
+  bool intersects2(const vec3 &start, const vec3 &direction,
+                   Hit &hit) const;
 
   /** Vertices */
   vec3 _A, _B_2, _C_2;
@@ -48,6 +87,8 @@ public:
 
 private:
   vec3 _N_2, _Q;
+  /** Edges from _A to _B_2 and _C_2 */
+  vec3 _E1, _E2;
 };
 
 #endif
@@ -0,0 +1,352 @@
+#include "wide_bvh.hpp"
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Marks a child as a leaf.
+#define LEAF_BIT ((int32_t)0x80000000)
+// An unused child: a leaf with no shapes.
+#define EMPTY_CHILD LEAF_BIT
+// Low bits of a leaf child that hold its shape count.
+#define COUNT_BITS 4
+// A leaf's first shape has to fit between LEAF_BIT and the count.
+#define MAX_SHAPES (1 << (31 - COUNT_BITS))
+// Enough for (WIDTH - 1) children per level, 128 levels deep.
+#define STACK_SIZE 1024
+
+static_assert(MAX_LEAF_SIZE < (1 << COUNT_BITS),
+              "a leaf's shape count doesn't fit in COUNT_BITS");
+
+// Quantized coordinate q of a box, along one axis.
+// The traversal computes exactly this, so the boxes stay conservative.
+static float dequantize(float origin, float scale, int q) {
+    return origin + (float)q * scale;
+}
+
+#ifdef __SSE2__
+// Four quantized coordinates, as floats.
+static __m128 load_quantized(const uint8_t *q) {
+    int32_t bits;
+    memcpy(&bits, q, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_cvtsi32_si128(bits);
+    v = _mm_unpacklo_epi8(v, zero);
+    v = _mm_unpacklo_epi16(v, zero);
+    return _mm_cvtepi32_ps(v);
+}
+#endif
+
+template <int WIDTH>
+Wide_BVH<WIDTH>::Wide_BVH()
+    : _leaf_count(0), _binary_node_count(0), _binary_bytes(0)
+{
+    ; // nothing to do: no nodes, no shapes, builds on one thread.
+}
+
+template <int WIDTH>
+Wide_BVH<WIDTH>::Wide_BVH(const SP_Thread_Pool& pool)
+    : _pool(pool), _leaf_count(0), _binary_node_count(0), _binary_bytes(0)
+{
+    ; // nothing left to do
+}
+
+template <int WIDTH>
+void Wide_BVH<WIDTH>::build(const vector<Shape*>& shapes) {
+    _nodes.clear();
+    _shapes.clear();
+    _store.clear();
+    _refs.clear();
+    _leaf_count = 0;
+    _binary_node_count = 0;
+    _binary_bytes = 0;
+    if (shapes.empty()) { return; }
+    if (shapes.size() > (size_t)MAX_SHAPES) {
+        throw std::invalid_argument("Wide_BVH::build.  Can't hold "
+                                    + std::to_string(shapes.size())
+                                    + " shapes, only "
+                                    + std::to_string(MAX_SHAPES));
+    }
+
+    BVH binary(_pool);
+    binary.build(shapes);
+    _shapes = binary._shapes;
+    _store = binary._store;
+    _refs = binary._refs;
+    _binary_node_count = binary.node_count();
+    _binary_bytes = binary._nodes.size() * sizeof(BVH::Node);
+
+    // Each wide node replaces WIDTH - 1 binary interior nodes, or so.
+    _nodes.reserve(_binary_node_count / (2 * (WIDTH - 1)) + 1);
+    collapse(binary, 0);
+}
+
+template <int WIDTH>
+int Wide_BVH<WIDTH>::collapse(const BVH& binary, int binary_index) {
+    const vector<BVH::Node>& binary_nodes = binary._nodes;
+    const BVH::Node& binary_node = binary_nodes[binary_index];
+
+    // Start with the node's children, and keep replacing the
+    // biggest interior one with its own two children.
+    int children[WIDTH];
+    int count = 0;
+    if (binary_node._count > 0) {
+        children[count++] = binary_index;
+    } else {
+        children[count++] = binary_node._first;
+        children[count++] = binary_node._first + 1;
+    }
+    while (count < WIDTH) {
+        int biggest = -1;
+        float biggest_area = -1;
+        for (int i = 0; i < count; i++) {
+            const BVH::Node& child = binary_nodes[children[i]];
+            float area = child._box.surface_area();
+            if (child._count == 0 && area > biggest_area) {
+                biggest = i;
+                biggest_area = area;
+            }
+        }
+        if (biggest < 0) { break; }
+        int opened = children[biggest];
+        children[biggest] = binary_nodes[opened]._first;
+        children[count++] = binary_nodes[opened]._first + 1;
+    }
+
+    int node_index = (int)_nodes.size();
+    _nodes.push_back(Node());
+
+    // Quantize the children's boxes to 255 steps across this node's box,
+    // rounding outwards.
+    Node node;
+    const Bounding_Box& box = binary_node._box;
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = box._min[axis];
+        float extent = box._max[axis] - origin;
+        float scale = extent / 255;
+        while (dequantize(origin, scale, 255) < box._max[axis]) {
+            scale = std::nextafter(scale, INFINITY);
+        }
+        node._origin[axis] = origin;
+        node._scale[axis] = scale;
+
+        for (int i = 0; i < WIDTH; i++) {
+            if (i >= count) {
+                node._lo[axis][i] = 1;
+                node._hi[axis][i] = 0;
+                continue;
+            }
+            const Bounding_Box& child_box = binary_nodes[children[i]]._box;
+            int lo = 0;
+            int hi = 0;
+            if (scale > 0) {
+                lo = (int)std::floor((child_box._min[axis] - origin) / scale);
+                hi = (int)std::ceil((child_box._max[axis] - origin) / scale);
+                lo = std::max(0, std::min(lo, 255));
+                hi = std::max(0, std::min(hi, 255));
+                while (lo > 0 && dequantize(origin, scale, lo) > child_box._min[axis]) {
+                    lo--;
+                }
+                while (hi < 255 && dequantize(origin, scale, hi) < child_box._max[axis]) {
+                    hi++;
+                }
+            }
+            node._lo[axis][i] = (uint8_t)lo;
+            node._hi[axis][i] = (uint8_t)hi;
+        }
+    }
+
+    for (int i = 0; i < WIDTH; i++) {
+        if (i >= count) {
+            node._child[i] = EMPTY_CHILD;
+            continue;
+        }
+        const BVH::Node& child = binary_nodes[children[i]];
+        if (child._count > 0) {
+            node._child[i] = LEAF_BIT | (child._first << COUNT_BITS)
+                | child._count;
+            _leaf_count++;
+        } else {
+            // _nodes may move while the child is built, so
+            // the node is only stored afterwards.
+            node._child[i] = collapse(binary, children[i]);
+        }
+    }
+    _nodes[node_index] = node;
+    return node_index;
+}
+
+template <int WIDTH>
+int Wide_BVH<WIDTH>::intersect_children(const Node& node, const vec3& start,
+                                        const vec3& inv_direction, float t_max,
+                                        float t_near[WIDTH]) const {
+    // For each axis, the ray enters each box through the plane
+    // on the side it comes from. A box with lo > hi is never hit.
+    const uint8_t *near_q[3];
+    const uint8_t *far_q[3];
+    for (int axis = 0; axis < 3; axis++) {
+        bool backwards = inv_direction[axis] < 0;
+        near_q[axis] = backwards ? node._hi[axis] : node._lo[axis];
+        far_q[axis] = backwards ? node._lo[axis] : node._hi[axis];
+    }
+
+    int mask = 0;
+#ifdef __SSE2__
+    for (int group = 0; group < WIDTH; group += 4) {
+        __m128 t0 = _mm_setzero_ps();
+        __m128 t1 = _mm_set1_ps(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 origin = _mm_set1_ps(node._origin[axis]);
+            __m128 scale = _mm_set1_ps(node._scale[axis]);
+            __m128 s = _mm_set1_ps(start[axis]);
+            __m128 inv = _mm_set1_ps(inv_direction[axis]);
+            __m128 near_plane = _mm_add_ps(
+                origin, _mm_mul_ps(load_quantized(near_q[axis] + group), scale));
+            __m128 far_plane = _mm_add_ps(
+                origin, _mm_mul_ps(load_quantized(far_q[axis] + group), scale));
+            __m128 t_in = _mm_mul_ps(_mm_sub_ps(near_plane, s), inv);
+            __m128 t_out = _mm_mul_ps(_mm_sub_ps(far_plane, s), inv);
+            // max/min return their second operand if either is a NaN
+            // (0 * inf), which leaves t0/t1 unchanged.
+            t0 = _mm_max_ps(t_in, t0);
+            t1 = _mm_min_ps(t_out, t1);
+        }
+        mask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << group;
+        _mm_storeu_ps(t_near + group, t0);
+    }
+#else
+    for (int i = 0; i < WIDTH; i++) {
+        float t0 = 0;
+        float t1 = t_max;
+        for (int axis = 0; axis < 3; axis++) {
+            float origin = node._origin[axis];
+            float scale = node._scale[axis];
+            float t_in = (dequantize(origin, scale, near_q[axis][i])
+                          - start[axis]) * inv_direction[axis];
+            float t_out = (dequantize(origin, scale, far_q[axis][i])
+                           - start[axis]) * inv_direction[axis];
+            t0 = t_in > t0 ? t_in : t0;
+            t1 = t_out < t1 ? t_out : t1;
+        }
+        if (t0 <= t1) { mask |= 1 << i; }
+        t_near[i] = t0;
+    }
+#endif
+    return mask;
+}
+
+template <int WIDTH>
+bool Wide_BVH<WIDTH>::first_hit(const vec3& start, const vec3& direction,
+                                 float t_max, Hit& hit) const {
+    if (_nodes.empty()) { return false; }
+
+    vec3 inv_direction = 1.0f / direction;
+    Lazy_Hit nearest(t_max);
+    const float& closest = nearest._t;
+    bool found = false;
+
+    // Children still to visit, with the distance where the ray enters them.
+    int32_t stack[STACK_SIZE];
+    float stack_t[STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    stack_t[top] = 0;
+    top++;
+
+    while (top > 0) {
+        top--;
+        if (stack_t[top] >= closest) { continue; }
+        int32_t child = stack[top];
+
+        if (child & LEAF_BIT) {
+            int first = (child & ~LEAF_BIT) >> COUNT_BITS;
+            int count = child & ((1 << COUNT_BITS) - 1);
+            if (_store.first_hit(&_refs[first], count, start, direction,
+                                 nearest)) {
+                found = true;
+            }
+            continue;
+        }
+
+        const Node& node = _nodes[child];
+        float t_near[WIDTH];
+        int mask = intersect_children(node, start, inv_direction,
+                                      closest, t_near);
+
+        // Push the children that were hit, farthest first,
+        // so that the nearest one is visited next.
+        int hits[WIDTH];
+        int num_hits = 0;
+        for (int i = 0; i < WIDTH; i++) {
+            if (!(mask & (1 << i))) { continue; }
+            int j = num_hits++;
+            while (j > 0 && t_near[hits[j - 1]] < t_near[i]) {
+                hits[j] = hits[j - 1];
+                j--;
+            }
+            hits[j] = i;
+        }
+        for (int k = 0; k < num_hits; k++) {
+            stack[top] = node._child[hits[k]];
+            stack_t[top] = t_near[hits[k]];
+            top++;
+        }
+    }
+    if (found) { nearest.finalize(start, direction, hit); }
+    return found;
+}
+
+template <int WIDTH>
+Shape *Wide_BVH<WIDTH>::any_hit(const vec3& start, const vec3& direction,
+                                float t_max, const Shape *skip) const {
+    if (_nodes.empty()) { return nullptr; }
+
+    vec3 inv_direction = 1.0f / direction;
+
+    int32_t stack[STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        int32_t child = stack[--top];
+        if (child & LEAF_BIT) {
+            int first = (child & ~LEAF_BIT) >> COUNT_BITS;
+            int count = child & ((1 << COUNT_BITS) - 1);
+            for (int i = first; i < first + count; i++) {
+                Shape *shape = _shapes[i];
+                if (shape != skip
+                    && _store.occludes(_refs[i], start, direction, t_max, skip)) {
+                    return shape;
+                }
+            }
+            continue;
+        }
+
+        const Node& node = _nodes[child];
+        float t_near[WIDTH];
+        int mask = intersect_children(node, start, inv_direction,
+                                      t_max, t_near);
+        for (int i = WIDTH - 1; i >= 0; i--) {
+            if (mask & (1 << i)) { stack[top++] = node._child[i]; }
+        }
+    }
+    return nullptr;
+}
+
+template <int WIDTH>
+void Wide_BVH<WIDTH>::print_stats(ostream& os) const {
+    double mb = 1024.0 * 1024.0;
+    os << "BVH" << WIDTH << ": " << _shapes.size() << " shapes, "
+       << _nodes.size() << " nodes of " << sizeof(Node) << " bytes ("
+       << _nodes.size() * sizeof(Node) / mb << " MB), "
+       << _leaf_count << " leaves; binary BVH had "
+       << _binary_node_count << " nodes of " << sizeof(BVH::Node)
+       << " bytes (" << _binary_bytes / mb << " MB)";
+}
+
+template class Wide_BVH<4>;
+template class Wide_BVH<8>;
@@ -0,0 +1,129 @@
+#ifndef _WIDE_BVH_HPP
+#define _WIDE_BVH_HPP
+
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <vector>
+#include "accelerator.hpp"
+#include "bounding_box.hpp"
+#include "shape.hpp"
+#include "hit.hpp"
+#include "shape_store.hpp"
+#include "thread_pool.hpp"
+#include "aligned_allocator.hpp"
+
+using glm::vec3;
+using std::vector;
+
+class BVH;
+
+template <int WIDTH>
+class Wide_BVH : public Accelerator {
+    /** A bounding volume hierarchy with WIDTH (4 or 8) children per node.
+     * Built as a binary BVH, then collapsed: each node takes over
+     * its biggest descendants until it has WIDTH children.
+     * A node stores all its children's boxes, quantized to 8 bits
+     * per coordinate relative to its own box, so that one cache line
+     * (two for WIDTH 8) holds a whole node, and one SIMD slab test
+     * checks a ray against every child. Nodes are padded to whole
+     * cache lines, and stored starting on one, so a node never
+     * straddles more lines than it needs.
+     */
+ public:
+    /** Constructor.
+     * Makes an empty hierarchy, which nothing can hit.
+     */
+    Wide_BVH();
+
+    /** Constructor.
+     * Makes an empty hierarchy, which builds on a pool of threads.
+     * @param pool The threads to build with.
+     */
+    Wide_BVH(const SP_Thread_Pool& pool);
+
+    /** Build the hierarchy, throwing away any previous one.
+     * Throws invalid_argument if there are more shapes than a
+     * leaf child can index (2^27).
+     * @param shapes The shapes to put in the hierarchy.
+     */
+    void build(const vector<Shape*>& shapes);
+
+    /** Finds the closest hit along a ray.
+     * Visits a node's children nearest first, and skips any
+     * node that starts beyond the closest hit found so far.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits further than this don't count.
+     * @param hit Hit record, which will be set if there's a hit.
+     * @return true/false if the ray does/doesn't hit some Shape.
+     */
+    bool first_hit(const vec3& start, const vec3& direction,
+                   float t_max, Hit& hit) const;
+
+    /** Finds some shape that blocks a ray (used for shadows).
+     * Stops at the first one found, which needn't be the closest.
+     * @param start Ray's starting point.
+     * @param direction Ray's direction vector.
+     * @param t_max Hits at or beyond this ray distance don't count.
+     * @param skip A shape to ignore (the one the ray starts on), or nullptr.
+     * @return The blocking shape, or nullptr if nothing blocks the ray.
+     */
+    Shape *any_hit(const vec3& start, const vec3& direction,
+                   float t_max, const Shape *skip) const;
+
+    /** Print the node count and size, the memory the nodes take,
+     * and what the binary hierarchy they came from took.
+     * @param os The stream.
+     */
+    void print_stats(ostream& os) const;
+
+ private:
+    struct alignas(CACHE_LINE_BYTES) Node {
+        /** Corner of the node's box that quantized coordinates start at */
+        float _origin[3];
+        /** Size of one quantization step, along each axis */
+        float _scale[3];
+        /** Children's boxes: quantized low and high corners,
+         * by axis, then by child. Unused children have lo > hi,
+         * which no ray can hit.
+         */
+        uint8_t _lo[3][WIDTH];
+        uint8_t _hi[3][WIDTH];
+        /** Interior child: its node index.
+         * Leaf child: LEAF_BIT | (first shape << 4) | shape count.
+         */
+        int32_t _child[WIDTH];
+    };
+
+    /** Add a node made from a binary node and its biggest
+     * descendants, and everything below them.
+     * @return Index of the new node.
+     */
+    int collapse(const BVH& binary, int binary_index);
+
+    /** Test a ray against all of a node's children.
+     * @param t_near Set to where the ray enters each child that it hits.
+     * @return Bit i is set if the ray hits child i before t_max.
+     */
+    int intersect_children(const Node& node, const vec3& start,
+                           const vec3& inv_direction, float t_max,
+                           float t_near[WIDTH]) const;
+
+    vector<Node, Aligned_Allocator<Node, CACHE_LINE_BYTES>> _nodes;
+    /** The shapes, ordered so that each leaf's shapes are contiguous */
+    vector<Shape*> _shapes;
+    /** The binary hierarchy's records of the shapes, and refs to them */
+    Shape_Store _store;
+    vector<Shape_Store::Ref> _refs;
+    SP_Thread_Pool _pool;
+    /** Number of leaves (children that hold shapes) */
+    int _leaf_count;
+    /** Node count and bytes of the binary hierarchy it was built from */
+    int _binary_node_count;
+    size_t _binary_bytes;
+};
+
+typedef Wide_BVH<4> BVH4;
+typedef Wide_BVH<8> BVH8;
+
+#endif